@@ -32,7 +32,17 @@ public:
 protected:
 
 private:
+    /**
+     * Encode the speed references once, see ParserPacket::prepareCommand()
+     */
+    void prepareSpeedCommands();
+
     ParserPacket* _uNav; ///< uNav communication object
+
+    /// MOTOR_VEL_REF of each motor and of both motors, each call patches
+    /// and sends a copy, so concurrent calls never share a frame
+    PreparedCommand _speedCommand[2];
+    PreparedCommand _speedsCommand;
 };
 
 #endif // UNAVINTERFACE_H
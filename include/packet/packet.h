@@ -119,12 +119,16 @@ typedef union _packet_buffer {
  * Structure with information about packet to send with serial port:
  * * length of packet
  * * buffer with data
- * * time to send packet (NOT IN USE)
+ * * monotonic time in microseconds when the packet was received, 0 if the
+ *   timestamps are disabled (not used to send)
+ * * for a reply to a sync packet, monotonic time in microseconds when the
+ *   request was written, 0 if unknown (not used to send)
  */
 typedef struct _packet {
     unsigned int length;
     unsigned char buffer[MAX_BUFF_RX];
-    unsigned int time;
+    uint64_t time;
+    uint64_t time_sent;
 } packet_t;
 
 #endif	/* PACKET_H */
@@ -9,18 +9,81 @@
 #define	ASYNCSERIAL_H
 
 #include <vector>
+#include <stdint.h>
 #include <boost/asio.hpp>
 #include <boost/bind.hpp>
 #include <boost/thread.hpp>
 #include <boost/utility.hpp>
 #include <boost/function.hpp>
 #include <boost/shared_array.hpp>
+#include "TxRing.h"
+#include "SerialTransport.h"
+#include "SerialReactor.h"
 
 /**
  * Used internally (pimpl)
  */
 class AsyncSerialImpl;
 
+/**
+ * Transmit counters:
+ * * writes committed (frames)
+ * * write operations started on the device
+ * * bytes written
+ * * frames dropped by WRITE_DROP_OLDEST
+ * * reservations refused by WRITE_FAIL
+ * * bytes and frames in the transmit queue when the counters are read
+ * The batching factor achieved is frames / writes.
+ */
+typedef struct _write_statistics {
+    unsigned long frames;
+    unsigned long writes;
+    unsigned long bytes;
+    unsigned long dropped;
+    unsigned long rejected;
+    size_t queued_bytes;
+    size_t queued_frames;
+} write_statistics_t;
+
+/**
+ * What a writer does when the transmit queue is full:
+ * * wait for room
+ * * throw at once
+ * * drop the oldest frames not yet being written
+ */
+typedef enum _write_policy {
+    WRITE_BLOCK,
+    WRITE_FAIL,
+    WRITE_DROP_OLDEST
+} write_policy_t;
+
+/**
+ * Transmit lanes, each with its own queue. A write operation sends the
+ * frames of the higher lanes first, so they overtake the lower ones at
+ * frame boundaries:
+ * * stop commands, example STATE_CONTROL_EMERGENCY
+ * * references and state changes
+ * * parameters, names and requests
+ */
+typedef enum _write_priority {
+    WRITE_PRIORITY_EMERGENCY,
+    WRITE_PRIORITY_CONTROL,
+    WRITE_PRIORITY_BULK
+} write_priority_t;
+
+/**
+ * Delay of the frames of a transmit lane, from writeCommit() to the end of
+ * their write operation, measured only while timestamps are enabled:
+ * * frames measured
+ * * sum of the delays in microseconds
+ * * maximum delay in microseconds
+ */
+typedef struct _write_lane_statistics {
+    unsigned long frames;
+    uint64_t total_delay;
+    uint64_t max_delay;
+} write_lane_statistics_t;
+
 /**
  * Asyncronous serial class.
  * Intended to be a base class.
@@ -78,6 +141,29 @@ public:
             boost::asio::serial_port_base::stop_bits(
                 boost::asio::serial_port_base::stop_bits::one));
 
+    /**
+     * Opens a transport other than a serial device, example a pseudo
+     * terminal or a socket to a stand-in board.
+     * \param transport open transport, created on ioService()
+     * \throws boost::system::system_error if the transport is not open
+     */
+    void open(boost::shared_ptr<SerialTransport> transport);
+
+    /**
+     * Run the read/write operations on a reactor shared with other ports,
+     * instead of a thread owned by this port. Must be called while the port
+     * is closed.
+     * \param reactor the shared reactor
+     * \throws boost::system::system_error if the port is open
+     */
+    void setReactor(boost::shared_ptr<SerialReactor> reactor);
+
+    /**
+     * \return the io_service that runs the read/write operations, to create
+     * a transport for open()
+     */
+    boost::asio::io_service& ioService();
+
     /**
      * \return true if serial device is open
      */
@@ -98,8 +184,10 @@ public:
      * Write data asynchronously. Returns immediately.
      * \param data array of char to be sent through the serial device
      * \param size array size
+     * \param priority transmit lane
      */
-    void write(const char *data, size_t size);
+    void write(const char *data, size_t size,
+            write_priority_t priority=WRITE_PRIORITY_CONTROL);
 
      /**
      * Write data asynchronously. Returns immediately.
@@ -115,12 +203,116 @@ public:
     */
     void writeString(const std::string& s);
 
+    /**
+     * Reserve a slot in the transmit buffer, to encode data in place without
+     * any copy. When the transmit queue is full, acts as the write policy
+     * says.
+     * Many slots can be reserved at the same time, the slots of a lane are
+     * sent in the same order they were reserved.
+     * \param size slot size, at most the queue byte limit
+     * \param priority transmit lane
+     * \return the slot to fill and pass to writeCommit()
+     * \throws boost::system::system_error if the slot can't be reserved
+     */
+    tx_slot_t writeReserve(size_t size,
+            write_priority_t priority=WRITE_PRIORITY_CONTROL);
+
+    /**
+     * Send a slot reserved with writeReserve(). Returns immediately.
+     * \param slot the filled slot
+     */
+    void writeCommit(const tx_slot_t& slot);
+
+    /**
+     * Limit the transmit queue of each lane, so that a stalled board or a
+     * saturated link does not queue stale commands.
+     * \param bytes maximum queued bytes, 0 for writeBufferSize. Below twice
+     * the largest write, a write at the end of the ring waits until the queue
+     * is empty.
+     * \param frames maximum queued writes, 0 for writeBufferFrames
+     * \param policy what writers do when the queue is full
+     */
+    void setWriteQueueLimit(size_t bytes, size_t frames,
+            write_policy_t policy=WRITE_BLOCK);
+
+    /**
+     * Limit the bytes handed to the device by a single write operation, so
+     * that a frame of a higher lane waits at most for them, plus one frame
+     * of each lane. Frames of the emergency lane are never held back and
+     * never wait for the coalescing.
+     * \param bytes bytes of a write operation, 0 (default) for no limit
+     */
+    void setWriteQuantum(size_t bytes);
+
+    /**
+     * Coalesce many small writes in a single write operation. When no write
+     * is in progress, a new write is started only when enough bytes are
+     * queued, when the delay expires or when flush() is called. Writes queued
+     * while a write is in progress are always sent together with a single
+     * write operation as soon as it ends.
+     * \param bytes queued bytes that start a write, 0 disables coalescing
+     * \param delay maximum delay of the first queued byte, pos_infin to wait
+     * only for the bytes threshold or flush()
+     */
+    void setWriteCoalescing(size_t bytes,
+            const boost::posix_time::time_duration& delay);
+
+    /**
+     * Start writing all the queued data now
+     */
+    void flush();
+
+    /**
+     * Record when data are received and when writes end. Disabled by
+     * default, when disabled the clock is never read.
+     * \param enable true to record the timestamps
+     */
+    void setTimestamps(bool enable);
+
+    /**
+     * \param sequence index of a slot returned by writeReserve()
+     * \param priority transmit lane of the slot
+     * \return monotonic time in microseconds when the write of the slot
+     * ended, 0 if it is not written yet, timestamps are disabled or it is
+     * one of the oldest writeBufferFrames slots of its lane
+     */
+    uint64_t writeTimestamp(size_t sequence,
+            write_priority_t priority=WRITE_PRIORITY_CONTROL) const;
+
+    /**
+     * \return monotonic time in microseconds, the clock of the timestamps
+     */
+    static uint64_t monotonicTime();
+
+    /**
+     * \return transmit counters since the port was opened and queue depth
+     */
+    write_statistics_t writeStatistics() const;
+
+    /**
+     * \param priority transmit lane
+     * \return delay of the frames of the lane since the port was opened
+     */
+    write_lane_statistics_t writeLaneStatistics(
+            write_priority_t priority) const;
+
     virtual ~AsyncSerial()=0;
 
     /**
      * Read buffer maximum size
      */
     static const int readBufferSize=512;
+
+    /**
+     * Transmit buffer size and maximum number of queued writes, for each lane
+     */
+    static const int writeBufferSize=4096;
+    static const int writeBufferFrames=128;
+
+    /**
+     * Number of transmit lanes
+     */
+    static const int writePriorities=3;
 private:
 
     /**
@@ -150,11 +342,30 @@ private:
      */
     void writeEnd(const boost::system::error_code& error);
 
+    /**
+     * Callback to start the coalescing timer.
+     * This callback is called by the io_service in the spawned thread.
+     */
+    void doWriteTimer();
+
+    /**
+     * Callback called when the coalescing delay expires, starts a write
+     * operation if none is in progress.
+     * This callback is called by the io_service in the spawned thread.
+     */
+    void writeTimerEnd(const boost::system::error_code& error);
+
     /**
      * Callback to close serial port
      */
     void doClose();
 
+    /**
+     * Callback posted by close(), closes the serial port and lets close()
+     * return
+     */
+    void closeEnd();
+
     boost::shared_ptr<AsyncSerialImpl> pimpl;
 
 protected:
@@ -171,6 +382,13 @@ protected:
     void setReadCallback(const
             boost::function<void (const char*, size_t)>& callback);
 
+    /**
+     * To be called from the read callback
+     * \return monotonic time in microseconds when the data passed to the
+     * read callback were received, 0 if timestamps are disabled
+     */
+    uint64_t readTimestamp() const;
+
     /**
      * To unregister the read callback in the derived class destructor so it
      * does not get called after the derived class destructor but before the
@@ -0,0 +1,88 @@
+/*
+ * Copyright (C) 2014 Officine Robotiche
+ * Author: Raffaello Bonghi
+ * email:  raffaello.bonghi@officinerobotiche.it
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the GNU Lesser General Public License
+ * (LGPL) version 2.1 which accompanies this distribution, and is available at
+ * http://www.gnu.org/licenses/lgpl-2.1.html
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#ifndef FRAGMENTASSEMBLER_H
+#define	FRAGMENTASSEMBLER_H
+
+#include <cstddef>
+#include <vector>
+#include <boost/utility.hpp>
+#include "packet/packet.h"
+
+/**
+ * A message longer than a frame is sent in fragments, each in a frame with
+ * the data:
+ * -------------------------------------------------
+ * | SEQUENCE | INDEX | LAST | DATA                 |
+ * -------------------------------------------------
+ *      1         1      1     0 -> FRAGMENT_DATA
+ * * sequence of the message, the same for all its fragments
+ * * index of the fragment, from 0
+ * * index of the last fragment of the message
+ */
+#define FRAGMENT_HEAD 3
+/// Bytes of the message in a fragment
+#define FRAGMENT_DATA (MAX_BUFF_RX - FRAGMENT_HEAD)
+/// Longest message, 256 fragments
+#define FRAGMENT_MESSAGE (256 * FRAGMENT_DATA)
+
+/**
+ * Reassembly of the messages from their fragments. The frames of a link
+ * arrive in order, so a fragment out of sequence means a lost fragment:
+ * the message is dropped.
+ */
+class FragmentAssembler : private boost::noncopyable {
+public:
+
+    FragmentAssembler();
+
+    /**
+     * Add a received fragment
+     * @param fragment frame of the fragment
+     * @param lost increased by the number of messages dropped
+     * @return true if the fragment completes a message, see message()
+     */
+    bool add(const packet_t& fragment, unsigned int& lost);
+
+    /**
+     * @return the message completed by add(), valid until the next add()
+     */
+    const unsigned char* message() const {
+        return &buffer[0];
+    }
+
+    /**
+     * @return length of the message completed by add()
+     */
+    size_t size() const {
+        return length;
+    }
+
+    /**
+     * Drop the message being assembled
+     * @return true if a message was being assembled
+     */
+    bool reset();
+
+private:
+    std::vector<unsigned char> buffer;
+    size_t length;
+    bool active;
+    unsigned char sequence;
+    unsigned char next;
+    unsigned char last;
+};
+
+#endif	/* FRAGMENTASSEMBLER_H */
@@ -0,0 +1,78 @@
+/*
+ * Copyright (C) 2014 Officine Robotiche
+ * Author: Raffaello Bonghi
+ * email:  raffaello.bonghi@officinerobotiche.it
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the GNU Lesser General Public License
+ * (LGPL) version 2.1 which accompanies this distribution, and is available at
+ * http://www.gnu.org/licenses/lgpl-2.1.html
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#ifndef FRAMECHECKSUM_H
+#define	FRAMECHECKSUM_H
+
+#include <cstddef>
+#include <stdint.h>
+
+/// Initial value of frameCrc16()
+#define FRAME_CRC16_INIT 0xFFFF
+
+/**
+ * Checksum of a frame: sum of the bytes, modulo 256.
+ * The kernel is chosen at the first call, from the instruction sets of the
+ * CPU: AVX2 or SSE2 on x86, otherwise a portable kernel that adds eight
+ * bytes at a time.
+ * @param data first byte
+ * @param size number of bytes
+ * @return the checksum
+ */
+unsigned char frameChecksum(const unsigned char* data, size_t size);
+
+/**
+ * @return name of the kernel used by frameChecksum(): "avx2", "sse2" or
+ * "portable"
+ */
+const char* frameChecksumKernel();
+
+/**
+ * CRC-16/MODBUS: polynomial 0x8005 reflected, no final xor.
+ * Folded sixteen bytes at a time with PCLMULQDQ when the CPU has it,
+ * otherwise computed eight bytes at a time with slicing-by-8 tables, about
+ * ten times the cost of frameChecksum(). Frames under 32 bytes always take
+ * the tables. Where the protocol is free to choose, frameCrc32c() with
+ * SSE4.2 is the cheapest CRC.
+ * @param data first byte
+ * @param size number of bytes
+ * @param crc result of the previous bytes, FRAME_CRC16_INIT for the first
+ * @return the CRC of the bytes, example 0x4B37 for "123456789"
+ */
+uint16_t frameCrc16(const unsigned char* data, size_t size, uint16_t crc = FRAME_CRC16_INIT);
+
+/**
+ * @return name of the kernel used by frameCrc16(): "pclmul" or
+ * "slicing-by-8"
+ */
+const char* frameCrc16Kernel();
+
+/**
+ * CRC-32C (Castagnoli): polynomial 0x1EDC6F41 reflected, with the SSE4.2
+ * crc32 instruction when the CPU has it, otherwise with slicing-by-8 tables.
+ * @param data first byte
+ * @param size number of bytes
+ * @param crc result of the previous bytes, 0 for the first
+ * @return the CRC of the bytes, example 0xE3069283 for "123456789"
+ */
+uint32_t frameCrc32c(const unsigned char* data, size_t size, uint32_t crc = 0);
+
+/**
+ * @return name of the kernel used by frameCrc32c(): "sse4.2" or
+ * "slicing-by-8"
+ */
+const char* frameCrc32cKernel();
+
+#endif	/* FRAMECHECKSUM_H */
@@ -0,0 +1,117 @@
+/*
+ * Copyright (C) 2014 Officine Robotiche
+ * Author: Raffaello Bonghi
+ * email:  raffaello.bonghi@officinerobotiche.it
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the GNU Lesser General Public License
+ * (LGPL) version 2.1 which accompanies this distribution, and is available at
+ * http://www.gnu.org/licenses/lgpl-2.1.html
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#ifndef FRAMECOBS_H
+#define	FRAMECOBS_H
+
+#include <cstddef>
+
+/// End of a frame encoded with COBS, the only zero byte on the line
+#define COBS_DELIMITER 0x00
+/// Longest encoding of size bytes, without the delimiter
+#define COBS_MAX_SIZE(size) ((size) + (size) / 254 + 1)
+
+/**
+ * Consistent overhead byte stuffing: the zero bytes of the data are
+ * replaced by the distance to the next one, so that a zero byte can end the
+ * frame. Each block is a code byte followed by code - 1 bytes without zeros
+ * and a zero, except for code 0xFF and the last block.
+ * @param data first byte to encode
+ * @param size number of bytes
+ * @param out at least COBS_MAX_SIZE(size) bytes. It may be data - 1 to
+ * encode in place if size is less than 254: the encoding is then size + 1
+ * bytes long and never overtakes the bytes still to read.
+ * @return bytes written in out
+ */
+size_t cobsEncode(const unsigned char* data, size_t size, unsigned char* out);
+
+/**
+ * Decoder of a stream of COBS frames, a read at a time. The data of a frame
+ * is decoded in a buffer of the caller while it arrives, up to the
+ * delimiter. A frame broken by noise ends at the next delimiter whatever
+ * its content: the following frame is never lost.
+ */
+class CobsDecoder {
+public:
+
+    /**
+     * @param buffer where the frames are decoded
+     * @param capacity bytes of the buffer, a longer frame is broken()
+     */
+    CobsDecoder(unsigned char* buffer, size_t capacity) : buffer(buffer), capacity(capacity) {
+        reset();
+    }
+
+    /**
+     * Decode the bytes up to the end of the frame
+     * @param data first byte
+     * @param end end of the bytes
+     * @param ended set if a delimiter ended the frame, see size() and
+     * broken(), call reset() before the next frame
+     * @return byte after the delimiter if the frame ended, otherwise end
+     */
+    const unsigned char* decode(const unsigned char* data, const unsigned char* end, bool& ended);
+
+    /**
+     * @return bytes decoded in the buffer
+     */
+    size_t size() const {
+        return length;
+    }
+
+    /**
+     * @return true if no byte arrived before the delimiter
+     */
+    bool empty() const {
+        return !started;
+    }
+
+    /**
+     * @return true if the delimiter cut a block or the frame is longer than
+     * the buffer
+     */
+    bool broken() const {
+        return cut || overflow;
+    }
+
+    /**
+     * Start a new frame
+     */
+    void reset() {
+        length = 0;
+        remaining = 0;
+        zero = false;
+        started = false;
+        cut = false;
+        overflow = false;
+    }
+
+private:
+    /// Copy decoded bytes, the bytes that don't fit are dropped
+    void append(const unsigned char* data, size_t size);
+
+    unsigned char* buffer;
+    size_t capacity;
+    size_t length;
+    /// Bytes of the block still to come
+    size_t remaining;
+    /// The block ends with a zero, written if another block follows
+    bool zero;
+    bool started;
+    bool cut;
+    bool overflow;
+};
+
+#endif	/* FRAMECOBS_H */
@@ -0,0 +1,472 @@
+/*
+ * Copyright (C) 2014 Officine Robotiche
+ * Author: Raffaello Bonghi
+ * email:  raffaello.bonghi@officinerobotiche.it
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the GNU Lesser General Public License
+ * (LGPL) version 2.1 which accompanies this distribution, and is available at
+ * http://www.gnu.org/licenses/lgpl-2.1.html
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#ifndef FRAMINGCORE_H
+#define	FRAMINGCORE_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <boost/utility.hpp>
+#include "FrameChecksum.h"
+#include "FrameCobs.h"
+#include "packet/packet.h"
+
+#define HEADER_SYNC '#'
+#define HEADER_ASYNC '@'
+/// Sync packet with a request id, the id is the first byte of the data
+#define HEADER_SYNC_ID '$'
+/// Fragment of a message longer than a frame, see FragmentAssembler.h
+#define HEADER_FRAGMENT '%'
+#define HEAD_PKG 2
+/// Bytes of the longest check
+#define FRAME_CHECK_MAX 4
+
+/**
+ * Integrity check at the end of each frame, both ends must use the same
+ */
+typedef enum _frame_check {
+    FRAME_CHECK_SUM, ///< 8 bit sum of the data, the check of the old firmware
+    FRAME_CHECK_CRC16, ///< CRC-16/MODBUS of header, length and data, low byte first
+    FRAME_CHECK_CRC32 ///< CRC-32C of header, length and data, low byte first
+} frame_check_t;
+
+/**
+ * @return MAX_BUFF_RX zero bytes, to extend a CRC
+ */
+inline const unsigned char* frameZeros() {
+    static const unsigned char zeros[HEAD_PKG + MAX_BUFF_RX] = {0};
+    return zeros;
+}
+
+/**
+ * Checks of FramingCore, at the end of each frame:
+ * * size() bytes of the check
+ * * seal() writes the check after the header, the length and the data
+ * * patch() updates the check of a sealed frame for new bytes, before
+ *   they overwrite the old ones
+ * * verify() checks the check bytes of a received frame
+ */
+
+/// 8 bit sum of the data, the check of the old firmware
+struct SumCheck {
+
+    static size_t size() {
+        return 1;
+    }
+
+    static void seal(unsigned char* frame, size_t size) {
+        frame[size] = frameChecksum(&frame[HEAD_PKG], size - HEAD_PKG);
+    }
+
+    static void patch(unsigned char* frame, size_t size, size_t offset, const unsigned char* bytes, size_t length) {
+        unsigned char check = frame[size];
+        for (size_t i = 0; i < length; ++i)
+            check += bytes[i] - frame[offset + i];
+        frame[size] = check;
+    }
+
+    static bool verify(unsigned char /*header*/, const packet_t& packet, const unsigned char* check) {
+        return frameChecksum(packet.buffer, packet.length) == check[0];
+    }
+};
+
+/// CRC-16/MODBUS of header, length and data, low byte first
+struct Crc16Check {
+
+    static size_t size() {
+        return 2;
+    }
+
+    static void seal(unsigned char* frame, size_t size) {
+        uint16_t crc = frameCrc16(frame, size);
+        frame[size] = crc & 0xFF;
+        frame[size + 1] = crc >> 8;
+    }
+
+    static void patch(unsigned char* frame, size_t size, size_t offset, const unsigned char* bytes, size_t length) {
+        //The CRC is linear: it changes by the CRC from 0 of the change of
+        //the bytes, followed by the bytes up to the check as zeros
+        unsigned char change[HEAD_PKG + MAX_BUFF_RX];
+        for (size_t i = 0; i < length; ++i)
+            change[i] = bytes[i] ^ frame[offset + i];
+        uint16_t delta = frameCrc16(change, length, 0);
+        delta = frameCrc16(frameZeros(), size - offset - length, delta);
+        frame[size] ^= delta & 0xFF;
+        frame[size + 1] ^= delta >> 8;
+    }
+
+    static bool verify(unsigned char header, const packet_t& packet, const unsigned char* check) {
+        const unsigned char head[HEAD_PKG] = {header, (unsigned char) packet.length};
+        uint16_t crc = frameCrc16(packet.buffer, packet.length, frameCrc16(head, HEAD_PKG));
+        return check[0] == (crc & 0xFF) && check[1] == (crc >> 8);
+    }
+};
+
+/// CRC-32C of header, length and data, low byte first
+struct Crc32Check {
+
+    static size_t size() {
+        return 4;
+    }
+
+    static void seal(unsigned char* frame, size_t size) {
+        uint32_t crc = frameCrc32c(frame, size);
+        for (size_t i = 0; i < 4; ++i)
+            frame[size + i] = (crc >> (8 * i)) & 0xFF;
+    }
+
+    static void patch(unsigned char* frame, size_t size, size_t offset, const unsigned char* bytes, size_t length) {
+        //As Crc16Check, frameCrc32c() inverts the CRC before and after
+        unsigned char change[HEAD_PKG + MAX_BUFF_RX];
+        for (size_t i = 0; i < length; ++i)
+            change[i] = bytes[i] ^ frame[offset + i];
+        uint32_t delta = frameCrc32c(change, length, 0xFFFFFFFF);
+        delta = ~frameCrc32c(frameZeros(), size - offset - length, delta);
+        for (size_t i = 0; i < 4; ++i)
+            frame[size + i] ^= (delta >> (8 * i)) & 0xFF;
+    }
+
+    static bool verify(unsigned char header, const packet_t& packet, const unsigned char* check) {
+        const unsigned char head[HEAD_PKG] = {header, (unsigned char) packet.length};
+        uint32_t crc = frameCrc32c(packet.buffer, packet.length, frameCrc32c(head, HEAD_PKG));
+        for (size_t i = 0; i < 4; ++i) {
+            if (check[i] != ((crc >> (8 * i)) & 0xFF))
+                return false;
+        }
+        return true;
+    }
+};
+
+/**
+ * @return bytes of the check at the end of a frame
+ */
+inline size_t frameCheckSize(frame_check_t check) {
+    switch (check) {
+        case FRAME_CHECK_CRC16:
+            return Crc16Check::size();
+        case FRAME_CHECK_CRC32:
+            return Crc32Check::size();
+        default:
+            return SumCheck::size();
+    }
+}
+
+/**
+ * Write the check after the header, the length and the data of a frame
+ * @param frame first byte of the frame
+ * @param size bytes of the frame before the check
+ */
+inline void sealFrame(unsigned char* frame, size_t size, frame_check_t check) {
+    switch (check) {
+        case FRAME_CHECK_CRC16:
+            Crc16Check::seal(frame, size);
+            break;
+        case FRAME_CHECK_CRC32:
+            Crc32Check::seal(frame, size);
+            break;
+        default:
+            SumCheck::seal(frame, size);
+            break;
+    }
+}
+
+/**
+ * Overwrite bytes of a sealed frame and update its check from the old and
+ * the new bytes only, without reading the rest of the frame
+ * @param frame first byte of the frame
+ * @param size bytes of the frame before the check
+ * @param offset first byte to overwrite, after the length
+ * @param bytes new bytes
+ * @param length number of bytes
+ */
+inline void patchFrame(unsigned char* frame, size_t size, size_t offset, const unsigned char* bytes,
+        size_t length, frame_check_t check) {
+    switch (check) {
+        case FRAME_CHECK_CRC16:
+            Crc16Check::patch(frame, size, offset, bytes, length);
+            break;
+        case FRAME_CHECK_CRC32:
+            Crc32Check::patch(frame, size, offset, bytes, length);
+            break;
+        default:
+            SumCheck::patch(frame, size, offset, bytes, length);
+            break;
+    }
+    memcpy(&frame[offset], bytes, length);
+}
+
+/// Frames found by their header byte: header, length, data and check
+struct HeaderFraming {
+};
+
+/// The same frames encoded with COBS between two COBS_DELIMITER
+struct CobsFraming {
+};
+
+/**
+ * @return true if the byte is the header of a frame
+ */
+inline bool isFrameHeader(unsigned char byte) {
+    return byte == HEADER_SYNC || byte == HEADER_ASYNC || byte == HEADER_SYNC_ID || byte == HEADER_FRAGMENT;
+}
+
+/**
+ * Find the first header of a frame
+ * @return the header, end if there isn't one
+ */
+inline const unsigned char* findFrameHeader(const unsigned char* data, const unsigned char* end) {
+    static const unsigned char headers[] = {HEADER_SYNC, HEADER_ASYNC, HEADER_SYNC_ID, HEADER_FRAGMENT};
+    //Search the headers a window at a time, so the frames of a long read
+    //aren't rescanned up to the end looking for the other headers
+    const ptrdiff_t window_size = 64;
+    while (data < end) {
+        if (isFrameHeader(*data))
+            return data;
+        const unsigned char* window = data + std::min(end - data, window_size);
+        bool found = false;
+        for (size_t i = 0; i < sizeof (headers); ++i) {
+            const void* header = memchr(data, headers[i], window - data);
+            if (header != NULL) {
+                window = static_cast<const unsigned char*> (header);
+                found = true;
+            }
+        }
+        if (found)
+            return window;
+        data = window;
+    }
+    return end;
+}
+
+/**
+ * Parser of the frames received on a link, fed with the bytes of each read.
+ * A frame may span several reads.
+ */
+class FrameParser : private boost::noncopyable {
+public:
+
+    virtual ~FrameParser() {
+    }
+
+    /**
+     * Parse the bytes of a read
+     * @param data first byte
+     * @param end end of the bytes
+     */
+    virtual void parse(const unsigned char* data, const unsigned char* end) = 0;
+};
+
+/**
+ * Parser with the framing, the check and the handler of the frames known
+ * at compile time, so that the search of the frames, their check and
+ * their delivery are inlined in one loop. Through FrameParser the only
+ * indirect call is the one of each read. The Handler is copied, it gets
+ * the results in the thread of parse():
+ * * frame(header, packet) for each frame with a good check, the packet
+ *   can be changed and is reused for the next frame
+ * * headerErrors(count) for the bytes skipped looking for a header
+ * * lengthError(), checkError() and framingError() for each broken frame
+ */
+template <class Framing, class Check, class Handler>
+class FramingCore;
+
+/**
+ * Frames found by their header:
+ * -------------------------------------------
+ * | HEADER | LENGTH | DATA        | CHECK    |
+ * -------------------------------------------
+ *     1        1      0 -> MAX_BUFF_RX  Check::size()
+ * The bytes of a frame rejected by its check are parsed again, the header
+ * may have been noise hiding the next frame.
+ */
+template <class Check, class Handler>
+class FramingCore<HeaderFraming, Check, Handler> : public FrameParser {
+public:
+
+    explicit FramingCore(const Handler& handler) : handler(handler), header(0), check_index(0),
+    index_data(0), state(PARSE_HEADER) {
+    }
+
+    void parse(const unsigned char* data, const unsigned char* end) {
+        //The bytes are parsed a field at a time, not a byte at a time
+        while (data < end) {
+            if (parseField(data, end))
+                continue;
+            //The header was noise or the frame is broken: the next frame may
+            //start among the bytes taken as its length, payload and check.
+            //They are copied because the rescan reuses packet; a frame
+            //found in them is shorter than this one, so the recursion is
+            //bounded by MAX_BUFF_RX.
+            unsigned char rescan[1 + MAX_BUFF_RX + FRAME_CHECK_MAX];
+            size_t size = 1 + packet.length + check_index;
+            rescan[0] = packet.length;
+            memcpy(&rescan[1], packet.buffer, packet.length);
+            memcpy(&rescan[1 + packet.length], check_bytes, check_index);
+            state = PARSE_HEADER;
+            parse(rescan, rescan + size);
+        }
+    }
+
+private:
+
+    /// Field of the frame the next byte belongs to
+    typedef enum _parse_state {
+        PARSE_HEADER,
+        PARSE_LENGTH,
+        PARSE_DATA,
+        PARSE_CHECKSUM
+    } parse_state_t;
+
+    /**
+     * Parse the next field of the frame
+     * @param data first byte not parsed yet, moved after the bytes consumed
+     * @param end end of the bytes
+     * @return false if the check rejected the frame
+     */
+    bool parseField(const unsigned char*& data, const unsigned char* end) {
+        switch (state) {
+            case PARSE_HEADER:
+            {
+                //Skip the noise before the header, each byte is a header error
+                const unsigned char* found = findFrameHeader(data, end);
+                if (found != data)
+                    handler.headerErrors(found - data);
+                data = found;
+                if (found != end) {
+                    header = *data++;
+                    check_index = 0;
+                    state = PARSE_LENGTH;
+                }
+                return true;
+            }
+            case PARSE_LENGTH:
+                //A wrong length can't be a header, parse again after it
+                if (*data > MAX_BUFF_RX) {
+                    handler.lengthError();
+                    state = PARSE_HEADER;
+                    ++data;
+                    return true;
+                }
+                packet.length = *data++;
+                index_data = 0;
+                state = (packet.length > 0 ? PARSE_DATA : PARSE_CHECKSUM);
+                return true;
+            case PARSE_DATA:
+            {
+                //Copy as much of the payload as these bytes hold
+                size_t span = std::min<size_t>(end - data, packet.length - index_data);
+                memcpy(&packet.buffer[index_data], data, span);
+                data += span;
+                index_data += span;
+                if (index_data == packet.length)
+                    state = PARSE_CHECKSUM;
+                return true;
+            }
+            case PARSE_CHECKSUM:
+            {
+                //The check may be split between two reads
+                size_t span = std::min<size_t>(end - data, Check::size() - check_index);
+                memcpy(&check_bytes[check_index], data, span);
+                data += span;
+                check_index += span;
+                if (check_index < Check::size())
+                    return true;
+                if (!Check::verify(header, packet, check_bytes)) {
+                    handler.checkError();
+                    return false;
+                }
+                state = PARSE_HEADER;
+                index_data = 0;
+                handler.frame(header, packet);
+                return true;
+            }
+        }
+        return true;
+    }
+
+    Handler handler;
+    /// Header of the frame being parsed
+    unsigned char header;
+    /// Check bytes received so far
+    unsigned char check_bytes[FRAME_CHECK_MAX];
+    size_t check_index;
+    packet_t packet;
+    size_t index_data;
+    parse_state_t state;
+};
+
+/**
+ * Frames encoded with COBS between two COBS_DELIMITER, see FrameCobs.h.
+ * The bytes between the delimiters are the frame of HeaderFraming.
+ */
+template <class Check, class Handler>
+class FramingCore<CobsFraming, Check, Handler> : public FrameParser {
+public:
+
+    explicit FramingCore(const Handler& handler) : handler(handler), decoder(frame, sizeof (frame)) {
+    }
+
+    void parse(const unsigned char* data, const unsigned char* end) {
+        while (data < end) {
+            bool ended;
+            data = decoder.decode(data, end, ended);
+            if (!ended)
+                return;
+            //Two delimiters in a row are not a frame
+            if (!decoder.empty())
+                parseFrame();
+            decoder.reset();
+        }
+    }
+
+private:
+
+    /**
+     * Check the frame decoded and deliver it
+     */
+    void parseFrame() {
+        if (decoder.broken()) {
+            handler.framingError();
+            return;
+        }
+        //The length must agree with the bytes between the delimiters
+        size_t size = decoder.size();
+        if (size < HEAD_PKG + Check::size() || frame[1] > MAX_BUFF_RX
+                || frame[1] != size - HEAD_PKG - Check::size()) {
+            handler.lengthError();
+            return;
+        }
+        if (!isFrameHeader(frame[0])) {
+            handler.headerErrors(1);
+            return;
+        }
+        packet.length = frame[1];
+        memcpy(packet.buffer, &frame[HEAD_PKG], packet.length);
+        if (!Check::verify(frame[0], packet, &frame[HEAD_PKG + packet.length])) {
+            handler.checkError();
+            return;
+        }
+        handler.frame(frame[0], packet);
+    }
+
+    Handler handler;
+    /// Frame decoded: header, length, data and check
+    unsigned char frame[HEAD_PKG + MAX_BUFF_RX + FRAME_CHECK_MAX];
+    CobsDecoder decoder;
+    packet_t packet;
+};
+
+#endif	/* FRAMINGCORE_H */
@@ -0,0 +1,124 @@
+/*
+ * Copyright (C) 2014 Officine Robotiche
+ * Author: Raffaello Bonghi
+ * email:  raffaello.bonghi@officinerobotiche.it
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the GNU Lesser General Public License
+ * (LGPL) version 2.1 which accompanies this distribution, and is available at
+ * http://www.gnu.org/licenses/lgpl-2.1.html
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#ifndef HANDLERALLOCATOR_H
+#define	HANDLERALLOCATOR_H
+
+#include <cstddef>
+#include <new>
+#include <boost/atomic.hpp>
+#include <boost/type_traits/aligned_storage.hpp>
+#include <boost/utility.hpp>
+
+/**
+ * Memory for the asio operations of a loop that has at most one operation
+ * pending at a time, example the read loop of a port. The same block is
+ * recycled by every operation of the loop, a bigger operation or a second
+ * one pending at the same time falls back to the heap.
+ */
+class HandlerMemory : private boost::noncopyable {
+public:
+
+    HandlerMemory() : in_use(false) {
+    }
+
+    void* allocate(size_t size) {
+        if (size <= sizeof (storage) && !in_use.exchange(true, boost::memory_order_acquire))
+            return &storage;
+        return ::operator new(size);
+    }
+
+    void deallocate(void* pointer) {
+        if (pointer == &storage)
+            in_use.store(false, boost::memory_order_release);
+        else
+            ::operator delete(pointer);
+    }
+
+private:
+    /// Large enough for a composed write through a strand wrapped handler
+    boost::aligned_storage<512>::type storage;
+    boost::atomic<bool> in_use;
+};
+
+/**
+ * Wraps a handler so that asio allocates its operations from a
+ * HandlerMemory. The memory must outlive the operations.
+ */
+template <class Handler>
+class RecyclingHandler {
+public:
+
+    RecyclingHandler(HandlerMemory& memory, const Handler& handler) : memory(&memory), handler(handler) {
+    }
+
+    void operator()() {
+        handler();
+    }
+
+    template <class Arg1>
+    void operator()(const Arg1& arg1) {
+        handler(arg1);
+    }
+
+    template <class Arg1, class Arg2>
+    void operator()(const Arg1& arg1, const Arg2& arg2) {
+        handler(arg1, arg2);
+    }
+
+    friend void* asio_handler_allocate(size_t size, RecyclingHandler* context) {
+        return context->memory->allocate(size);
+    }
+
+    friend void asio_handler_deallocate(void* pointer, size_t, RecyclingHandler* context) {
+        context->memory->deallocate(pointer);
+    }
+
+private:
+    HandlerMemory* memory;
+    Handler handler;
+};
+
+/**
+ * Calls a handler owned by someone else, so that passing it to asio does not
+ * copy it. The handler must stay valid until it is called.
+ */
+template <class Handler>
+class HandlerReference {
+public:
+
+    explicit HandlerReference(const Handler& handler) : handler(&handler) {
+    }
+
+    template <class Arg1, class Arg2>
+    void operator()(const Arg1& arg1, const Arg2& arg2) const {
+        (*handler)(arg1, arg2);
+    }
+
+private:
+    const Handler* handler;
+};
+
+template <class Handler>
+inline RecyclingHandler<Handler> makeRecyclingHandler(HandlerMemory& memory, const Handler& handler) {
+    return RecyclingHandler<Handler>(memory, handler);
+}
+
+template <class Handler>
+inline RecyclingHandler<HandlerReference<Handler> > makeRecyclingHandler(HandlerMemory& memory, const Handler* handler) {
+    return RecyclingHandler<HandlerReference<Handler> >(memory, HandlerReference<Handler>(*handler));
+}
+
+#endif	/* HANDLERALLOCATOR_H */
@@ -0,0 +1,328 @@
+/*
+ * Copyright (C) 2014 Officine Robotiche
+ * Author: Raffaello Bonghi
+ * email:  raffaello.bonghi@officinerobotiche.it
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the GNU Lesser General Public License
+ * (LGPL) version 2.1 which accompanies this distribution, and is available at
+ * http://www.gnu.org/licenses/lgpl-2.1.html
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#ifndef IOURINGENGINE_H
+#define	IOURINGENGINE_H
+
+#ifdef __linux__
+
+#include <vector>
+#include <boost/shared_ptr.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread.hpp>
+#include <boost/utility.hpp>
+#include "SerialTransport.h"
+
+/**
+ * Options of an io_uring engine:
+ * * submission queue entries, rounded up to a power of two by the kernel
+ * * read buffers registered with the kernel, one for each transport
+ * * size of each registered read buffer
+ * * a kernel thread polls the submission queue, so submitting does not
+ *   need a system call while it is awake
+ * * idle time in milliseconds before the polling thread sleeps
+ */
+typedef struct _io_uring_engine_options {
+    unsigned int entries;
+    unsigned int buffers;
+    size_t buffer_size;
+    bool sqpoll;
+    unsigned int sqpoll_idle;
+} io_uring_engine_options_t;
+
+/**
+ * Counters of an io_uring engine:
+ * * io_uring_enter calls made to submit
+ * * io_uring_enter calls made to wait for completions
+ * * submission queue entries submitted
+ * * completion queue entries reaped
+ * * true if the read buffers are registered, otherwise reads go straight
+ *   to the buffer of the caller
+ */
+typedef struct _io_uring_statistics {
+    unsigned long submit_calls;
+    unsigned long wait_calls;
+    unsigned long submitted;
+    unsigned long completed;
+    bool registered_buffers;
+} io_uring_statistics_t;
+
+/**
+ * An operation submitted to an io_uring engine
+ */
+class IoUringOperation {
+public:
+
+    virtual ~IoUringOperation() {
+    }
+
+    /**
+     * Called from the engine thread for each completion entry of the
+     * operation
+     * @param result bytes transferred or minus errno
+     */
+    virtual void complete(int result) = 0;
+};
+
+/**
+ * One io_uring shared by many IoUringTransport. A thread owned by the
+ * engine reaps the completions of all the transports; submissions made
+ * while it is running are sent to the kernel together with its next wait,
+ * in a single system call.
+ * The engine must outlive all the transports using it: they keep a shared
+ * pointer to it.
+ */
+class IoUringEngine : private boost::noncopyable {
+public:
+    /**
+     * Create the ring and start the engine thread
+     * \param options engine options, see defaultOptions()
+     * \throws boost::system::system_error if the kernel does not support
+     * io_uring
+     */
+    explicit IoUringEngine(const io_uring_engine_options_t& options = defaultOptions());
+
+    /**
+     * Stop and join the engine thread, then destroy the ring
+     */
+    ~IoUringEngine();
+
+    /**
+     * Take a registered read buffer
+     * @param data filled with the buffer
+     * @return index of the buffer, -1 if the buffers are not registered
+     * \throws boost::system::system_error if all the buffers are taken
+     */
+    int acquireBuffer(char*& data);
+
+    /**
+     * Give back a registered read buffer
+     * @param index index returned by acquireBuffer
+     */
+    void releaseBuffer(int index);
+
+    /**
+     * @return size of each registered read buffer
+     */
+    size_t bufferSize() const {
+        return options.buffer_size;
+    }
+
+    /**
+     * Submit a read
+     * @param op completed once
+     * @param fd file descriptor
+     * @param data buffer, the registered buffer if index is not -1
+     * @param size buffer size
+     * @param index registered buffer index, -1 for none
+     */
+    void read(IoUringOperation* op, int fd, char* data, size_t size, int index);
+
+    /**
+     * Submit a write of many buffers as a chain of linked writes, executed
+     * in order. A short write cancels the rest of the chain.
+     * @param op completed once for each buffer, or once with 0 bytes if
+     * there are no buffers
+     * @param fd file descriptor
+     * @param buffers data to write
+     * @param count number of buffers, at most chainLimit()
+     * \throws boost::system::system_error if the chain is too long
+     */
+    void write(IoUringOperation* op, int fd, const boost::asio::const_buffer* buffers, size_t count);
+
+    /**
+     * Ask to cancel the operations of op still in progress, they complete
+     * with -ECANCELED
+     */
+    void cancel(IoUringOperation* op);
+
+    /**
+     * @return the engine counters
+     */
+    io_uring_statistics_t statistics() const;
+
+    /**
+     * @return buffers of the longest chain, the submission queue entries
+     */
+    unsigned int chainLimit() const {
+        return sq_entries;
+    }
+
+    /**
+     * @return options with 256 entries and 16 buffers of 512 bytes, without
+     * submission polling
+     */
+    static io_uring_engine_options_t defaultOptions();
+
+private:
+
+    /**
+     * Body of the engine thread
+     */
+    void run();
+
+    /**
+     * Wait until count submission entries are free, with ringMutex locked
+     * @return the first entry, the others follow it in the ring
+     */
+    unsigned int reserveEntries(boost::unique_lock<boost::mutex>& l, unsigned int count);
+
+    /**
+     * @return the submission entry at position index of the ring
+     */
+    void* entry(unsigned int index);
+
+    /**
+     * Make count prepared entries visible to the kernel and submit them,
+     * unless the engine thread is going to, with ringMutex locked
+     */
+    void publishEntries(unsigned int count);
+
+    /**
+     * Send to the kernel the entries not yet submitted, with ringMutex locked
+     */
+    void flush();
+
+    /**
+     * io_uring_enter system call
+     * @return the result, minus errno if failed
+     */
+    int enter(unsigned int to_submit, unsigned int min_complete, unsigned int flags);
+
+    io_uring_engine_options_t options;
+    int ring_fd;
+
+    /// Rings shared with the kernel
+    void* sq_ring;
+    void* cq_ring;
+    void* sqes;
+    size_t sq_ring_size, cq_ring_size, sqes_size;
+    unsigned int *sq_head, *sq_tail, *sq_mask, *sq_flags, *sq_array;
+    unsigned int *cq_head, *cq_tail, *cq_mask;
+    void* cqes;
+    unsigned int sq_entries;
+
+    /// Tail of the entries prepared, published to the kernel at submission
+    unsigned int sq_local_tail;
+    /// Entries published and not yet passed to io_uring_enter
+    unsigned int unsubmitted;
+    /// True while the engine thread is going to wait in the kernel
+    bool waiting;
+    bool stop;
+    mutable boost::mutex ringMutex; ///< Mutex for access to submission ring
+
+    std::vector<char> buffer_memory;
+    std::vector<bool> buffer_used;
+    bool registered;
+
+    io_uring_statistics_t stats;
+    boost::scoped_ptr<boost::thread> engine_thread;
+};
+
+/**
+ * Transport driven by an io_uring engine instead of the asio reactor.
+ * Reads use the registered buffer of the transport, writes are submitted
+ * as linked writes. The handlers are called from the engine thread.
+ */
+class IoUringTransport : public SerialTransport {
+public:
+    /**
+     * Use an open file descriptor, example the master of a pseudo terminal
+     * or one end of a socketpair
+     * \param engine engine running the operations
+     * \param fd file descriptor, the transport closes it
+     * \throws boost::system::system_error if all the buffers are taken
+     */
+    IoUringTransport(boost::shared_ptr<IoUringEngine> engine, int fd);
+
+    /**
+     * Open a Linux serial device
+     * \param engine engine running the operations
+     * \param devname serial device name, example "/dev/ttyUSB0"
+     * \param options device options, see linuxSerialDefaultOptions()
+     * \throws boost::system::system_error if cannot open the serial device
+     */
+    IoUringTransport(boost::shared_ptr<IoUringEngine> engine, const std::string& devname, const linux_serial_options_t& options);
+
+    virtual ~IoUringTransport();
+
+    void asyncReadSome(char* data, size_t size, const handler_t& handler);
+
+    void asyncWrite(const TxBufferSequence& buffers, const handler_t& handler);
+
+    void cancel(boost::system::error_code& ec);
+
+    void close(boost::system::error_code& ec);
+
+    bool isOpen() const {
+        return fd >= 0;
+    }
+
+    /**
+     * @return the settings achieved on the serial device, if opened by name
+     */
+    const linux_serial_status_t& status() const {
+        return serial_status;
+    }
+
+private:
+
+    class ReadOperation : public IoUringOperation {
+    public:
+        void complete(int result);
+
+        IoUringTransport* transport;
+        char* data; ///< Buffer of the caller
+        size_t size;
+        const handler_t* handler; ///< Owned by the caller
+    };
+
+    class WriteOperation : public IoUringOperation {
+    public:
+        void complete(int result);
+
+        /**
+         * Submit the buffers from the first byte not yet written, in chains
+         * of at most IoUringEngine::chainLimit() buffers
+         */
+        void submit();
+
+        IoUringTransport* transport;
+        /// Data not yet written, the first buffer is trimmed after a short write
+        std::vector<boost::asio::const_buffer> buffers;
+        size_t done; ///< Bytes written by all the chains
+        size_t chain_done; ///< Bytes written by the current chain
+        size_t chain_size; ///< Bytes submitted by the current chain
+        size_t pending; ///< Completions of the chain not yet arrived
+        int error; ///< First error of the chain, not counting cancellations
+        bool canceled; ///< True if cancel() was called
+        boost::mutex cancelMutex; ///< Mutex for access to canceled
+        const handler_t* handler; ///< Owned by the caller
+    };
+
+    void init();
+
+    boost::shared_ptr<IoUringEngine> engine;
+    int fd;
+    char* buffer; ///< Registered read buffer
+    int buffer_index;
+    ReadOperation read_op;
+    WriteOperation write_op;
+    linux_serial_status_t serial_status;
+};
+
+#endif
+
+#endif	/* IOURINGENGINE_H */
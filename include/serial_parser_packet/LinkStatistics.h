@@ -0,0 +1,122 @@
+/*
+ * Copyright (C) 2014 Officine Robotiche
+ * Author: Raffaello Bonghi
+ * email:  raffaello.bonghi@officinerobotiche.it
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the GNU Lesser General Public License
+ * (LGPL) version 2.1 which accompanies this distribution, and is available at
+ * http://www.gnu.org/licenses/lgpl-2.1.html
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#ifndef LINKSTATISTICS_H
+#define	LINKSTATISTICS_H
+
+#include <stdint.h>
+#include <boost/atomic.hpp>
+#include <boost/utility.hpp>
+
+/// Number of error counters, the errors of code ERROR_X are at -ERROR_X
+#define LINK_ERRORS 18
+
+/**
+ * Counters of a packet link, since the port was created:
+ * * errors, indexed by the opposite of the ERROR_* codes
+ * * bytes read and frames received with a good checksum
+ * * bytes and frames queued to be sent
+ */
+typedef struct _link_statistics {
+    uint64_t errors[LINK_ERRORS];
+    uint64_t bytes_in;
+    uint64_t frames_in;
+    uint64_t bytes_out;
+    uint64_t frames_out;
+} link_statistics_t;
+
+/**
+ * Counter alone in its cache line, so that the threads updating the other
+ * counters or reading them don't slow down its writer
+ */
+class LinkCounter : private boost::noncopyable {
+public:
+
+    LinkCounter() : value(0) {
+    }
+
+    void add(uint64_t count) {
+        value.fetch_add(count, boost::memory_order_relaxed);
+    }
+
+    uint64_t load() const {
+        return value.load(boost::memory_order_relaxed);
+    }
+
+private:
+    boost::atomic<uint64_t> value;
+    char padding[64 - sizeof (boost::atomic<uint64_t>)];
+};
+
+/**
+ * Counters of a link, updated by the I/O thread and by the callers without
+ * locks. A snapshot reads every counter once, it doesn't stop the writers,
+ * so two counters of the same snapshot may be a few updates apart.
+ */
+class LinkStatistics : private boost::noncopyable {
+public:
+
+    /**
+     * \param code ERROR_* code, other values are ignored
+     * \param count number of errors
+     */
+    void error(int code, uint64_t count = 1) {
+        if (code < 0 && code > -LINK_ERRORS)
+            errors[-code].add(count);
+    }
+
+    void received(uint64_t bytes, uint64_t frames) {
+        bytes_in.add(bytes);
+        if (frames != 0)
+            frames_in.add(frames);
+    }
+
+    void sent(uint64_t bytes, uint64_t frames) {
+        bytes_out.add(bytes);
+        frames_out.add(frames);
+    }
+
+    link_statistics_t snapshot() const {
+        link_statistics_t statistics;
+        for (int i = 0; i < LINK_ERRORS; ++i)
+            statistics.errors[i] = errors[i].load();
+        statistics.bytes_in = bytes_in.load();
+        statistics.frames_in = frames_in.load();
+        statistics.bytes_out = bytes_out.load();
+        statistics.frames_out = frames_out.load();
+        return statistics;
+    }
+
+    /**
+     * \return the counts between two snapshots
+     */
+    static link_statistics_t delta(const link_statistics_t& now,
+            const link_statistics_t& before) {
+        link_statistics_t statistics;
+        for (int i = 0; i < LINK_ERRORS; ++i)
+            statistics.errors[i] = now.errors[i] - before.errors[i];
+        statistics.bytes_in = now.bytes_in - before.bytes_in;
+        statistics.frames_in = now.frames_in - before.frames_in;
+        statistics.bytes_out = now.bytes_out - before.bytes_out;
+        statistics.frames_out = now.frames_out - before.frames_out;
+        return statistics;
+    }
+
+private:
+    LinkCounter errors[LINK_ERRORS];
+    LinkCounter bytes_in, frames_in, bytes_out, frames_out;
+};
+
+#endif	/* LINKSTATISTICS_H */
@@ -0,0 +1,77 @@
+/*
+ * Copyright (C) 2014 Officine Robotiche
+ * Author: Raffaello Bonghi
+ * email:  raffaello.bonghi@officinerobotiche.it
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the GNU Lesser General Public License
+ * (LGPL) version 2.1 which accompanies this distribution, and is available at
+ * http://www.gnu.org/licenses/lgpl-2.1.html
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#ifndef LINUXSERIALPORT_H
+#define	LINUXSERIALPORT_H
+
+/*
+ * This header must not include asio or <termios.h>: the implementation uses
+ * the kernel termios2 structure, that clashes with the libc one.
+ */
+#include <string>
+
+/**
+ * Options for a Linux serial device:
+ * * baud rate, any value: rates without a Bxxx constant use BOTHER
+ * * parity 'N' none, 'E' even, 'O' odd
+ * * character size 5 -> 8 bit
+ * * stop bits 1 or 2
+ * * RTS/CTS hardware flow control
+ * * ASYNC_LOW_LATENCY, the driver pushes every byte without waiting
+ * * VMIN, VTIME non canonical read tuning
+ */
+typedef struct _linux_serial_options {
+    unsigned int baud_rate;
+    char parity;
+    unsigned char character_size;
+    unsigned char stop_bits;
+    bool rtscts;
+    bool low_latency;
+    unsigned char vmin;
+    unsigned char vtime;
+} linux_serial_options_t;
+
+/**
+ * Settings achieved on the device:
+ * * baud rate read back from the driver
+ * * true if the rate was set with BOTHER
+ * * true if ASYNC_LOW_LATENCY is enabled
+ * * errno of the low latency request, zero if not requested or done
+ */
+typedef struct _linux_serial_status {
+    unsigned int baud_rate;
+    bool custom_baud;
+    bool low_latency;
+    int low_latency_error;
+} linux_serial_status_t;
+
+/**
+ * Default options: 8N1, no flow control, low latency, VMIN 1 and VTIME 0
+ * @param baud_rate serial baud rate
+ * @return the options
+ */
+linux_serial_options_t linuxSerialDefaultOptions(unsigned int baud_rate);
+
+/**
+ * Open and configure a serial device in raw mode with termios2
+ * @param devname serial device name, example "/dev/ttyUSB0"
+ * @param options requested options
+ * @param status filled with the settings achieved
+ * @return the non blocking file descriptor, the caller must close it
+ * \throws boost::system::system_error if cannot open or configure the device
+ */
+int linuxSerialOpen(const std::string& devname, const linux_serial_options_t& options, linux_serial_status_t& status);
+
+#endif	/* LINUXSERIALPORT_H */
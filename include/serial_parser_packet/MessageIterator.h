@@ -0,0 +1,148 @@
+/*
+ * Copyright (C) 2014 Officine Robotiche
+ * Author: Raffaello Bonghi
+ * email:  raffaello.bonghi@officinerobotiche.it
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the GNU Lesser General Public License
+ * (LGPL) version 2.1 which accompanies this distribution, and is available at
+ * http://www.gnu.org/licenses/lgpl-2.1.html
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#ifndef MESSAGEITERATOR_H
+#define	MESSAGEITERATOR_H
+
+#include <cstddef>
+#include <cstring>
+#include "packet/packet.h"
+
+/**
+ * A message of a received packet, read in place: the head as laid out by
+ * packet_information_t and a pointer to the data, nothing is copied.
+ * Valid as long as the buffer of the packet.
+ */
+class MessageView {
+public:
+
+    MessageView() : bytes(NULL), length(0) {
+    }
+
+    MessageView(const unsigned char* data, size_t size) : bytes(data), length(size) {
+    }
+
+    /**
+     * @return first byte of the message, its length
+     */
+    const unsigned char* data() const {
+        return bytes;
+    }
+
+    /**
+     * @return bytes of the message in the packet, head included
+     */
+    size_t size() const {
+        return length;
+    }
+
+    /**
+     * The bytes of the head missing from a truncated message read as 0,
+     * as the fields of a message decoded by ParserPacket::parsing()
+     */
+    unsigned char option() const {
+        return length > 1 ? bytes[1] : 0;
+    }
+
+    unsigned char type() const {
+        return length > 2 ? bytes[2] : 0;
+    }
+
+    unsigned char command() const {
+        return length > 3 ? bytes[3] : 0;
+    }
+
+    /**
+     * @return first byte of the data, after the head
+     */
+    const unsigned char* payload() const {
+        return &bytes[LNG_HEAD_INFORMATION_PACKET];
+    }
+
+    /**
+     * @return bytes of the data
+     */
+    size_t payloadSize() const {
+        return length > LNG_HEAD_INFORMATION_PACKET ? length - LNG_HEAD_INFORMATION_PACKET : 0;
+    }
+
+    /**
+     * The data as read by the callbacks. The data after a message of odd
+     * length is not aligned for the union, it is copied only then.
+     * @param aligned storage of the caller for a copy of the data
+     * @return the data in place, or in aligned
+     */
+    const message_abstract_u* message(message_abstract_u& aligned) const {
+        const unsigned char* data = payload();
+        if ((size_t) data % __alignof__(message_abstract_u) == 0 && payloadSize() != 0)
+            return reinterpret_cast<const message_abstract_u*> (data);
+        memset(&aligned, 0, sizeof (message_abstract_u));
+        memcpy(&aligned, data, payloadSize());
+        return &aligned;
+    }
+
+private:
+    const unsigned char* bytes;
+    size_t length;
+};
+
+/**
+ * Walk the messages of a received packet in place, as laid out by
+ * ParserPacket::encoder(): each message starts with its length, a zero
+ * length ends the packet.
+ * -------------------------------------------------
+ * | LENGTH | OPTION | TYPE | COMMAND | DATA       |
+ * -------------------------------------------------
+ *     1        1       1        1      LENGTH - 4
+ */
+class MessageIterator {
+public:
+
+    explicit MessageIterator(const packet_t& packet) : buffer(packet.buffer), end(packet.length), offset(0) {
+    }
+
+    /**
+     * @param data first message
+     * @param size bytes of the messages, example a message received in
+     * fragments
+     */
+    MessageIterator(const unsigned char* data, size_t size) : buffer(data), end(size), offset(0) {
+    }
+
+    /**
+     * Read the next message
+     * @param view filled with the message
+     * @return false at the end of the packet
+     */
+    bool next(MessageView& view) {
+        if (offset >= end || buffer[offset] == 0)
+            return false;
+        size_t length = buffer[offset];
+        if (length > end - offset)
+            length = end - offset;
+        if (length > sizeof (packet_information_t))
+            length = sizeof (packet_information_t);
+        view = MessageView(&buffer[offset], length);
+        offset += buffer[offset];
+        return true;
+    }
+
+private:
+    const unsigned char* buffer;
+    size_t end;
+    size_t offset;
+};
+
+#endif	/* MESSAGEITERATOR_H */
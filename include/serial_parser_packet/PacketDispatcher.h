@@ -0,0 +1,174 @@
+/*
+ * Copyright (C) 2014 Officine Robotiche
+ * Author: Raffaello Bonghi
+ * email:  raffaello.bonghi@officinerobotiche.it
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the GNU Lesser General Public License
+ * (LGPL) version 2.1 which accompanies this distribution, and is available at
+ * http://www.gnu.org/licenses/lgpl-2.1.html
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#ifndef PACKETDISPATCHER_H
+#define	PACKETDISPATCHER_H
+
+#include <vector>
+#include <stdint.h>
+#include <boost/atomic.hpp>
+#include <boost/function.hpp>
+#include <boost/scoped_array.hpp>
+#include <boost/utility.hpp>
+#include "packet/packet.h"
+
+/// Packets queued for each dispatch thread
+#define DISPATCH_QUEUE 64
+/// Maximum number of callbacks of a dispatcher, and of message callbacks
+#define DISPATCH_CALLBACKS 10
+
+/**
+ * Activity of a callback run by a dispatcher:
+ * * packets delivered to the callback
+ * * time spent in the callback and its longest run, in microseconds
+ * * dispatch thread running the callback
+ * * packets waiting in the queue of the thread and the most ever waiting
+ * * packets dropped by the thread because its queue was full
+ */
+typedef struct _dispatch_statistics {
+    uint64_t calls;
+    uint64_t time_total;
+    uint64_t time_max;
+    unsigned int thread;
+    size_t queue;
+    size_t queue_max;
+    uint64_t dropped;
+} dispatch_statistics_t;
+
+/**
+ * Threads running the async callbacks out of the I/O thread. Callback i
+ * always runs on thread i % threads, so each callback gets the packets in
+ * the order they were received. The I/O thread copies a packet in a
+ * lock-free queue of each thread and wakes the threads once per read, or
+ * earlier if a queue is half full.
+ *
+ * Messages reassembled from fragments go the same way: message callback i
+ * runs on thread i % threads too, after the packets received before the
+ * message and before the ones received after it. They are copied in a
+ * locked queue of each thread, a slower path for the rare long messages.
+ */
+class PacketDispatcher : private boost::noncopyable {
+public:
+    typedef boost::function<void (const packet_t*) > callback_t;
+    typedef boost::function<void (const unsigned char*, size_t) > message_callback_t;
+
+    /**
+     * Start the dispatch threads
+     * @param threads number of threads, at least one
+     * @param queue packets queued for each thread
+     */
+    PacketDispatcher(unsigned int threads, size_t queue = DISPATCH_QUEUE);
+
+    /**
+     * Stop and join the threads, the packets still queued are dropped
+     */
+    ~PacketDispatcher();
+
+    /**
+     * @param callback run for each packet dispatched from now on
+     * @return false if there are already DISPATCH_CALLBACKS callbacks
+     */
+    bool addCallback(const callback_t& callback);
+
+    /**
+     * @param callback run for each message dispatched from now on
+     * @return false if there are already DISPATCH_CALLBACKS message
+     * callbacks
+     */
+    bool addMessageCallback(const message_callback_t& callback);
+
+    /**
+     * Remove all the callbacks, message ones included. Returns once none
+     * of them is running.
+     */
+    void clearCallbacks();
+
+    /**
+     * Queue a packet for all the callbacks, called by the I/O thread
+     * @param packet received packet
+     * @return number of threads that dropped the packet, queue full
+     */
+    size_t dispatch(const packet_t& packet);
+
+    /**
+     * Queue a copy of a message for all the message callbacks, called by
+     * the I/O thread
+     * @param message reassembled message
+     * @param length bytes of the message
+     * @return number of threads that dropped the message, queue full
+     */
+    size_t dispatchMessage(const unsigned char* message, size_t length);
+
+    /**
+     * Wake the threads sleeping with packets queued, called by the I/O
+     * thread at the end of a read
+     */
+    void wake();
+
+    /**
+     * @return activity of each callback, the message callbacks excluded
+     */
+    std::vector<dispatch_statistics_t> statistics() const;
+
+    /**
+     * @return number of dispatch threads
+     */
+    unsigned int threads() const {
+        return workers.size();
+    }
+
+private:
+    struct Worker;
+    struct Subscriber;
+    struct Message;
+
+    /**
+     * Body of a dispatch thread
+     */
+    void run(Worker* worker);
+
+    /**
+     * Run the callbacks of a thread on a packet
+     */
+    void deliver(Worker* worker, const packet_t& packet);
+
+    /**
+     * Take the first message queued if no packet received before it is
+     * still queued
+     * @return false if there is no such message
+     */
+    bool popMessage(Worker* worker, std::vector<unsigned char>& message);
+
+    /**
+     * Run the message callbacks of a thread on a message
+     */
+    void deliverMessage(Worker* worker, const std::vector<unsigned char>& message);
+
+    /**
+     * Wake a thread if it sleeps, called by the I/O thread
+     */
+    void wake(Worker* worker);
+
+    std::vector<Worker*> workers;
+    boost::scoped_array<Subscriber> subscribers;
+    boost::scoped_array<message_callback_t> message_subscribers;
+    /// Written by addCallback() and clearCallbacks() only
+    boost::atomic<unsigned int> count;
+    /// Written by addMessageCallback() and clearCallbacks() only
+    boost::atomic<unsigned int> message_count;
+    boost::atomic<bool> running;
+};
+
+#endif	/* PACKETDISPATCHER_H */
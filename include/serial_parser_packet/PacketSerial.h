@@ -17,11 +17,19 @@
 #define	PACKETSERIAL_H
 
 #include "AsyncSerial.h"
+#include "FragmentAssembler.h"
+#include "FrameCobs.h"
+#include "FramingCore.h"
+#include "LinkStatistics.h"
+#include "PacketDispatcher.h"
+#include "PreparedCommand.h"
+#include "RxRing.h"
 #include "packet/packet.h"
 
-#define HEADER_SYNC '#'
-#define HEADER_ASYNC '@'
-#define HEAD_PKG 2
+/// Sync packets received and not yet read
+#define SYNC_QUEUE 16
+/// Request ids, the window of pipelined requests is at most half of them
+#define SYNC_IDS 256
 
 #define ERROR_FRAMMING -1
 #define ERROR_FRAMMING_STRING "Framming"
@@ -47,13 +55,42 @@
 #define ERROR_CREATE_PKG_STRING "Creation packet"
 #define ERROR_TIMEOUT_SYNC_PACKET -12
 #define ERROR_TIMEOUT_SYNC_PACKET_STRING "Timeout sync packet"
+#define ERROR_SYNC_QUEUE_FULL -13
+#define ERROR_SYNC_QUEUE_FULL_STRING "Sync queue full"
+#define ERROR_STALE_PACKET -14
+#define ERROR_STALE_PACKET_STRING "Stale packet"
 #define ERROR_MAX_ASYNC_CALLBACK -15
 #define ERROR_MAX_ASYNC_CALLBACK_STRING "Max async callback"
+#define ERROR_DISPATCH_QUEUE_FULL -16
+#define ERROR_DISPATCH_QUEUE_FULL_STRING "Dispatch queue full"
+#define ERROR_FRAGMENT -17
+#define ERROR_FRAGMENT_STRING "Fragment"
+/**
+ * Delimitation of the frames on the line, both ends must use the same.
+ * With FRAME_FORMAT_COBS the frame [HEADER, LENGTH, DATA, CHECK] is encoded
+ * with COBS between two zero bytes, the only zeros on the line: a frame
+ * broken by noise never hides the next one.
+ */
+typedef enum _frame_format {
+    FRAME_FORMAT_HEADER, ///< header, length, data and check, the format of the old firmware
+    FRAME_FORMAT_COBS ///< COBS_DELIMITER, the same frame encoded with COBS, COBS_DELIMITER
+} frame_format_t;
+
 /**
  * Used internally (pkgimpl)
  */
 class AsyncPacketImpl;
 
+/**
+ * Used internally (requestimpl)
+ */
+class SyncRequestImpl;
+
+/**
+ * Used internally (parser)
+ */
+class PacketFrameHandler;
+
 /**
  * Thrown if timeout occurs
  */
@@ -87,17 +124,121 @@ public:
     /**
      * Write data asynchronously. Returns immediately.
      * \param data to be sent through the serial device
+     * \param priority transmit lane
+     * \return sequence of the frame in its lane, for writeTimestamp()
      */
-    void writePacket(packet_t packet, unsigned char header = HEADER_SYNC);
+    size_t writePacket(const packet_t& packet, unsigned char header = HEADER_SYNC,
+            write_priority_t priority = WRITE_PRIORITY_CONTROL);
 
     /**
-     * Read some data, blocking
-     * \return the receive buffer. It is empty if no data is available
-     * \throws boost::system::system_error if any error
-     * \throws timeout_exception in case of timeout
+     * Write data asynchronously, encoded straight from the caller buffer.
+     * \param data to be sent through the serial device
+     * \param length bytes of data, at most MAX_BUFF_RX
+     * \return sequence of the frame in its lane, for writeTimestamp()
+     * \throws packet_exception if the data is too long
+     */
+    size_t writePacket(const unsigned char* data, size_t length,
+            unsigned char header = HEADER_SYNC,
+            write_priority_t priority = WRITE_PRIORITY_CONTROL);
+
+    /**
+     * Write a message of any length up to FRAGMENT_MESSAGE asynchronously,
+     * in HEADER_FRAGMENT frames queued at once in the same lane. The board
+     * must support them. With the write policy WRITE_BLOCK a long message
+     * waits for room in the transmit queue.
+     * \param data message
+     * \param length bytes of the message
+     * \param priority transmit lane
+     * \return number of frames written
+     * \throws packet_exception if the message is too long
+     */
+    size_t writeMessage(const unsigned char* data, size_t length,
+            write_priority_t priority = WRITE_PRIORITY_BULK);
+
+    /**
+     * Write a prepared frame asynchronously in its lane, copied as it is.
+     * It is sealed again first if the check changed since it was sealed.
+     * \param command frame to send
+     * \return sequence of the frame in its lane, for writeTimestamp()
+     */
+    size_t writePrepared(PreparedCommand& command);
+
+    /**
+     * Read the oldest sync packet received, blocking. Up to SYNC_QUEUE
+     * packets are queued, the packets received while the queue is full are
+     * dropped and counted as ERROR_SYNC_QUEUE_FULL.
+     * \return the oldest sync packet not read yet
+     * \throws packet_exception in case of timeout
      */
     packet_t readPacket(const boost::posix_time::millisec& wait_duration = boost::posix_time::millisec(1000));
 
+    /**
+     * As readPacket(), into a packet of the caller
+     * \param packet set to the oldest sync packet not read yet
+     */
+    void readPacket(packet_t& packet,
+            const boost::posix_time::millisec& wait_duration = boost::posix_time::millisec(1000));
+
+    /**
+     * Drop the sync packets received and not read, example the late replies
+     * of a request that timed out. Call it before sending a request, the
+     * packets dropped are counted as ERROR_STALE_PACKET.
+     * \return number of packets dropped
+     */
+    size_t discardPackets();
+
+    /**
+     * Send a sync packet with a request id in a HEADER_SYNC_ID frame, the
+     * board must reply with a HEADER_SYNC_ID frame with the same id.
+     * Returns once the request is queued: up to syncWindow() requests can
+     * wait for their reply at the same time and the replies can arrive in
+     * any order.
+     * \param packet request, at most MAX_BUFF_RX - 1 bytes
+     * \param priority transmit lane
+     * \param wait_duration maximum wait for a place in the window
+     * \return id of the request, for waitReply()
+     * \throws packet_exception if the window stays full
+     */
+    unsigned char requestPacket(const packet_t& packet,
+            write_priority_t priority = WRITE_PRIORITY_CONTROL,
+            const boost::posix_time::millisec& wait_duration = boost::posix_time::millisec(1000));
+
+    /**
+     * As requestPacket(), encoded straight from the caller buffer
+     * \param length bytes of data, at most MAX_BUFF_RX - 1
+     */
+    unsigned char requestPacket(const unsigned char* data, size_t length,
+            write_priority_t priority = WRITE_PRIORITY_CONTROL,
+            const boost::posix_time::millisec& wait_duration = boost::posix_time::millisec(1000));
+
+    /**
+     * Wait for the reply of a request and end the request. A reply with an
+     * id not waited, late or duplicate, is counted as ERROR_STALE_PACKET.
+     * \param id returned by requestPacket()
+     * \return the reply, without the id
+     * \throws packet_exception in case of timeout, the request is ended
+     */
+    packet_t waitReply(unsigned char id,
+            const boost::posix_time::millisec& wait_duration = boost::posix_time::millisec(1000));
+
+    /**
+     * As waitReply(), into a packet of the caller
+     * \param reply set to the reply, without the id
+     */
+    void waitReply(unsigned char id, packet_t& reply,
+            const boost::posix_time::millisec& wait_duration = boost::posix_time::millisec(1000));
+
+    /**
+     * \param requests maximum requests waiting for their reply, from 1 to
+     * SYNC_IDS / 2. The default is 1.
+     */
+    void setSyncWindow(size_t requests);
+
+    /**
+     * \return maximum requests waiting for their reply
+     */
+    size_t syncWindow() const;
+
     /**
      * To allow derived classes to set a read callback
      */
@@ -112,21 +253,132 @@ public:
             boost::function<void (const packet_t*) >& callback);
 
     /**
-     * To unregister the read callback in the derived class destructor so it
-     * does not get called after the derived class destructor but before the
-     * base class destructor
+     * To allow derived classes to set a batch callback
+     */
+    template <class T> void setAsyncBatchCallback(void(T::*fp)(const packet_t*, size_t), T* obj) {
+        setAsyncBatchCallback(boost::bind(fp, obj, _1, _2));
+    }
+
+    /**
+     * Callback with all the async packets of a read in a single call, in
+     * the order received, after the read callbacks of the same packets
+     * were queued or run. It runs in the I/O thread, also with dispatch
+     * threads, and the packets are valid during the call only.
+     * @param callback called with the packets and their number
+     */
+    void setAsyncBatchCallback(const
+            boost::function<void (const packet_t*, size_t) >& callback);
+
+    /**
+     * To allow derived classes to set a message callback
+     */
+    template <class T> void setMessageCallback(void(T::*fp)(const unsigned char*, size_t), T* obj) {
+        setMessageCallback(boost::bind(fp, obj, _1, _2));
+    }
+
+    /**
+     * Callback with each message reassembled from HEADER_FRAGMENT frames.
+     * It runs in the I/O thread or, with dispatch threads, message callback
+     * i runs on the thread of the read callback i, in order with its
+     * packets. The message is valid during the call only. A message with a
+     * fragment missing is dropped and counted as ERROR_FRAGMENT.
+     * @param callback called with the message and its length
+     */
+    void setMessageCallback(const
+            boost::function<void (const unsigned char*, size_t) >& callback);
+
+    /**
+     * To unregister the read, batch and message callbacks in the derived
+     * class destructor so they do not get called after the derived class
+     * destructor but before the base class destructor
      */
     void clearAsyncPacketCallback();
 
     /**
-     * 
-     * @return 
+     * Run the async and message callbacks on dispatch threads, so that a
+     * slow callback doesn't delay the reads. Callback i always runs on
+     * thread i % threads and gets the packets and the messages in order. A
+     * packet or a message that finds the queue of a thread full is dropped
+     * for the callbacks of that thread and counted as
+     * ERROR_DISPATCH_QUEUE_FULL. Call it before open().
+     * @param threads dispatch threads, 0 to run the callbacks in the I/O
+     * thread, the default
+     * @param queue packets queued for each thread
+     */
+    void setDispatchThreads(unsigned int threads, size_t queue = DISPATCH_QUEUE);
+
+    /**
+     * Activity of the async callbacks, to find the slow ones
+     * @return one entry for each callback, empty without dispatch threads
+     */
+    std::vector<dispatch_statistics_t> getDispatchStatistics() const;
+
+    /**
+     * Select the integrity check of the frames sent and received. Switch
+     * the board first, example with a system message, then the host. The
+     * frame being parsed is dropped.
+     * @param check integrity check, FRAME_CHECK_SUM by default
+     */
+    void setFrameCheck(frame_check_t check);
+
+    /**
+     * @return integrity check of the frames
+     */
+    frame_check_t frameCheck() const;
+
+    /**
+     * Select the delimitation of the frames sent and received. Switch the
+     * board first, then the host. The frame being parsed is dropped; in
+     * COBS format the bytes up to the first delimiter are a broken frame,
+     * counted as ERROR_FRAMMING.
+     * @param format FRAME_FORMAT_HEADER by default
      */
-    std::map<std::string, int> getMapError();
+    void setFrameFormat(frame_format_t format);
+
+    /**
+     * @return delimitation of the frames
+     */
+    frame_format_t frameFormat() const;
+
+    /**
+     * Errors by name, built from getLinkStatistics()
+     * @return number of errors for each ERROR_*_STRING
+     */
+    std::map<std::string, int> getMapError() const;
+
+    /**
+     * Snapshot of the link counters. It doesn't lock, it can be polled at
+     * any rate without slowing down the reads.
+     * @return counters since the port was created
+     */
+    link_statistics_t getLinkStatistics() const;
+
+    /**
+     * Counters since a previous snapshot, for polling
+     * @param previous snapshot, replaced with the current one
+     * @return counts between previous and now
+     */
+    link_statistics_t getLinkStatistics(link_statistics_t& previous) const;
 
 protected:
-    std::map<std::string, int> map_error;
+
+    /**
+     * End a request without waiting for its reply
+     * \param id returned by requestPacket()
+     */
+    void cancelRequest(unsigned char id);
+
+    LinkStatistics link_statistics;
 private:
+    friend class PacketFrameHandler;
+
+    /**
+     * Encode a frame in the transmit buffer
+     * \param prefix bytes of the data before the data of the caller
+     * \return sequence of the frame in its lane
+     */
+    size_t writeFrame(unsigned char header, const unsigned char* prefix, size_t prefix_length,
+            const unsigned char* data, size_t length, write_priority_t priority);
 
     /**
      * Read callback, stores data in the buffer
@@ -136,27 +388,45 @@ private:
     void readCallback(const char *data, size_t len);
 
     /**
-     * Init map error
+     * Parser of the bytes received with a framing and a check
+     * @return a FramingCore with a PacketFrameHandler
      */
-    void initMapError();
+    FrameParser* createParser(frame_format_t format, frame_check_t check);
 
-    bool decode_pkgs(unsigned char rxchar);
-    bool pkg_header(unsigned char rxchar);
-    bool pkg_length(unsigned char rxchar);
-    bool pkg_data(unsigned char rxchar);
-    unsigned char pkg_checksum(volatile unsigned char* Buffer, int FirstIndx, int LastIndx);
+    /**
+     * Send a frame received to the callbacks, to readPacket() or to the
+     * request waiting for it
+     */
+    void deliverFrame(unsigned char header, packet_t& packet);
 
-    bool async, data_ready;
-    packet_t receive_pkg;
-    unsigned short index_data;
-    bool (PacketSerial::*pkg_parse) (unsigned char inchar);
+    /// Counts of the read being parsed, added to the statistics at its end
+    typedef struct _parse_counts {
+        int framing;
+        int header;
+        int length;
+        int checksum;
+        int frames;
+    } parse_counts_t;
+
+    /// Parser of the bytes received, built for the format and the check
+    /// selected when they change, used by the I/O thread only
+    boost::shared_ptr<FrameParser> parser;
+    frame_format_t parse_format;
+    frame_check_t parse_check;
+    parse_counts_t parse_counts;
+    boost::atomic<int> frame_format;
+    boost::atomic<int> frame_check;
+    RxRing sync_queue;
+    /// Serializes the readers of sync_queue
     boost::mutex readQueueMutex;
     boost::condition_variable readPacketCond;
+    FragmentAssembler assembler;
+    /// Keeps the fragments of a message together, with the next sequence
+    boost::mutex writeMessageMutex;
+    unsigned char message_sequence;
 
     boost::shared_ptr<AsyncPacketImpl> pkgimpl;
-
-    unsigned char* BufferTx;
-    int BufferTxSize;
+    boost::shared_ptr<SyncRequestImpl> requestimpl;
 };
 
 #endif	/* PACKETSERIAL_H */
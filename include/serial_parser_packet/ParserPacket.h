@@ -17,6 +17,7 @@
 #define	PARSERPACKET_H
 
 #include "PacketSerial.h"
+#include "MessageIterator.h"
 
 
 /**
@@ -54,16 +55,100 @@ public:
     
     virtual ~ParserPacket();
 
-    void sendAsyncPacket(packet_t packet);
-
-    packet_t sendSyncPacket(packet_t packet, const unsigned int repeat = 0, const boost::posix_time::millisec& wait_duration = boost::posix_time::millisec(1000));
-    void parserSendPacket(std::vector<packet_information_t> list_send, const unsigned int repeat = 0, const boost::posix_time::millisec& wait_duration = boost::posix_time::millisec(1000));
-    void parserSendPacket(packet_information_t send, const unsigned int repeat = 0, const boost::posix_time::millisec& wait_duration = boost::posix_time::millisec(1000));
-
-    std::vector<packet_information_t> parsing(packet_t packet_receive);
-    packet_t encoder(std::vector<packet_information_t> list_send);
-    packet_t encoder(packet_information_t *list_send, size_t len);
-    packet_t encoder(packet_information_t list_send);
+    void sendAsyncPacket(const packet_t& packet);
+
+    packet_t sendSyncPacket(const packet_t& packet, const unsigned int repeat = 0, const boost::posix_time::millisec& wait_duration = boost::posix_time::millisec(1000));
+
+    /**
+     * As sendSyncPacket(), the reply is written in a packet of the caller
+     */
+    void sendSyncPacket(const packet_t& packet, packet_t& reply, const unsigned int repeat = 0, const boost::posix_time::millisec& wait_duration = boost::posix_time::millisec(1000));
+
+    /**
+     * As sendAsyncPacket() and sendSyncPacket(), for a command from
+     * prepareCommand() with HEADER_ASYNC or HEADER_SYNC. With the request
+     * ids a sync command is sent as a packet, its id changes the frame.
+     * \throws packet_exception if the header of the command is another
+     */
+    void sendAsyncPacket(PreparedCommand& command);
+    void sendSyncPacket(PreparedCommand& command, packet_t& reply, const unsigned int repeat = 0, const boost::posix_time::millisec& wait_duration = boost::posix_time::millisec(1000));
+
+    /**
+     * Send many sync packets and collect their replies. With the request
+     * ids, up to syncWindow() requests are in flight at the same time,
+     * otherwise they are sent one after the other.
+     * @return the replies, in the order of the packets
+     */
+    std::vector<packet_t> sendSyncPackets(const std::vector<packet_t>& packets, const unsigned int repeat = 0, const boost::posix_time::millisec& wait_duration = boost::posix_time::millisec(1000));
+
+    /**
+     * Send the sync packets with a request id (HEADER_SYNC_ID), so that the
+     * requests of many threads and of sendSyncPackets() are pipelined. The
+     * board must support it. Disabled by default.
+     */
+    void setSyncIds(bool enable);
+
+    /**
+     * Send many messages at once without waiting for replies: in an async
+     * packet if they fit, otherwise in fragments (see writeMessage()). The
+     * messages received in fragments go to the callbacks as the async ones.
+     * @return number of frames written
+     * \throws packet_exception if the messages are longer than FRAGMENT_MESSAGE
+     */
+    size_t sendMessages(const packet_information_t *list_send, size_t len, write_priority_t priority = WRITE_PRIORITY_BULK);
+    size_t sendMessages(const std::vector<packet_information_t>& list_send, write_priority_t priority = WRITE_PRIORITY_BULK);
+
+    void parserSendPacket(const std::vector<packet_information_t>& list_send, const unsigned int repeat = 0, const boost::posix_time::millisec& wait_duration = boost::posix_time::millisec(1000));
+    void parserSendPacket(const packet_information_t& send, const unsigned int repeat = 0, const boost::posix_time::millisec& wait_duration = boost::posix_time::millisec(1000));
+    void parserSendPacket(PreparedCommand& command, const unsigned int repeat = 0, const boost::posix_time::millisec& wait_duration = boost::posix_time::millisec(1000));
+
+    /**
+     * Decode the messages of a packet in a list, to read them in place
+     * without copies see MessageIterator
+     */
+    std::vector<packet_information_t> parsing(const packet_t& packet_receive);
+
+    /**
+     * Decode the messages of a packet in a list of the caller, the list is
+     * cleared first and its memory is reused
+     */
+    void parsing(const packet_t& packet_receive, std::vector<packet_information_t>& list_data);
+
+    packet_t encoder(const std::vector<packet_information_t>& list_send);
+    packet_t encoder(const packet_information_t *list_send, size_t len);
+    packet_t encoder(const packet_information_t& list_send);
+
+    /**
+     * Encode the messages in a packet of the caller
+     * \throws packet_exception if the messages don't fit in MAX_BUFF_RX
+     */
+    void encoder(const packet_information_t *list_send, size_t len, packet_t& packet_send);
+
+    /**
+     * Encode the messages in a buffer of the caller, of any length
+     */
+    void encoder(const packet_information_t *list_send, size_t len, std::vector<unsigned char>& message);
+
+    /**
+     * Encode the messages once in a frame sent again and again, example the
+     * references of the motors. Change the data of its messages with
+     * setCommandMessage(), send it with sendAsyncPacket() or
+     * sendSyncPacket(). The lane is chosen here, as for a packet.
+     * @param header HEADER_ASYNC or HEADER_SYNC
+     * \throws packet_exception if the messages don't fit in MAX_BUFF_RX
+     */
+    PreparedCommand prepareCommand(const std::vector<packet_information_t>& list_send, unsigned char header = HEADER_ASYNC);
+    PreparedCommand prepareCommand(const packet_information_t& send, unsigned char header = HEADER_ASYNC);
+
+    /**
+     * Overwrite the data of a message of a prepared command, the check is
+     * updated from the bytes changed
+     * @param command from prepareCommand()
+     * @param message index of the message in the command
+     * @param packet new data, as long as the data of the message
+     * \throws packet_exception if the command has no such message
+     */
+    static void setCommandMessage(PreparedCommand& command, size_t message, const message_abstract_u* packet);
 
     packet_information_t createPacket(unsigned char command, unsigned char option, unsigned char type = HASHMAP_SYSTEM, message_abstract_u * packet = NULL);
     packet_information_t createDataPacket(unsigned char command, unsigned char type, message_abstract_u * packet);
@@ -82,11 +167,69 @@ public:
     void clearCallback(unsigned char type=HASHMAP_SYSTEM);
     void clearErrorCallback();
 
+    /**
+     * Callback with all the messages of the async packets of a read in a
+     * single call, in the order received. It runs in the I/O thread as
+     * the batch callbacks of PacketSerial, the list is valid during the
+     * call only.
+     */
+    void addBatchCallback(const boost::function<void (const std::vector<packet_information_t>&) >& callback);
+
+    template <class T> void addBatchCallback(void(T::*fp)(const std::vector<packet_information_t>&), T* obj) {
+        addBatchCallback(boost::bind(fp, obj, _1));
+    }
+
+    void clearBatchCallback();
+
+    /**
+     * Transmit lane of a packet, from the most urgent of its messages:
+     * * emergency for a motor state STATE_CONTROL_EMERGENCY
+     * * control for the other motor states and the references
+     * * bulk for the parameters, the system messages and the requests
+     * @param packet encoded packet
+     * @return the lane used by sendAsyncPacket and sendSyncPacket
+     */
+    static write_priority_t packetPriority(const packet_t& packet);
+
 private:
 
     void actionAsync(const packet_t* packet);
 
+    /**
+     * Parse the async packets of a read for the batch callbacks
+     */
+    void actionBatch(const packet_t* packets, size_t count);
+
+    /**
+     * Parse a message received in fragments for the callbacks
+     */
+    void actionMessage(const unsigned char* message, size_t length);
+
+    /**
+     * Wait for the reply of a request sent with an id
+     */
+    void waitSyncReply(unsigned char id, packet_t& reply, const unsigned int repeat, const boost::posix_time::millisec& wait_duration);
+
+    /**
+     * Read the reply of a sync packet just written, readPacketMutex locked
+     * @param sequence of the packet in its lane
+     */
+    void readSyncReply(size_t sequence, write_priority_t priority, packet_t& reply, const unsigned int repeat, const boost::posix_time::millisec& wait_duration);
+
+    /**
+     * Throw the timeout of a sync packet
+     */
+    void syncTimeout(const unsigned int repeat);
+
     boost::mutex readPacketMutex;
+    boost::atomic<bool> sync_ids;
+    /// Messages of the async packets of the last read
+    std::vector<packet_information_t> batch_list;
+    /// actionBatch is set as batch callback with the first batch callback
+    bool batch_registered;
+    /// Encoded messages for sendMessages()
+    std::vector<unsigned char> send_buffer;
+    boost::mutex sendMessagesMutex;
     boost::shared_ptr<ParserPacketImpl> parser_impl;
 
     unsigned int hashmap_system[HASHMAP_SYSTEM_NUMBER];
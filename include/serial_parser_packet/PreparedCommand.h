@@ -0,0 +1,108 @@
+/*
+ * Copyright (C) 2014 Officine Robotiche
+ * Author: Raffaello Bonghi
+ * email:  raffaello.bonghi@officinerobotiche.it
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the GNU Lesser General Public License
+ * (LGPL) version 2.1 which accompanies this distribution, and is available at
+ * http://www.gnu.org/licenses/lgpl-2.1.html
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#ifndef PREPAREDCOMMAND_H
+#define	PREPAREDCOMMAND_H
+
+#include "AsyncSerial.h"
+#include "FramingCore.h"
+
+/**
+ * Frame sent again and again with new values in the same places, example
+ * the speed references of the motors. The frame is encoded and sealed
+ * once; set() then overwrites only the bytes that change and updates the
+ * check from their old and new values. See PacketSerial::writePrepared().
+ */
+class PreparedCommand {
+public:
+
+    /**
+     * Empty frame with HEADER_SYNC
+     */
+    PreparedCommand();
+
+    /**
+     * Encode and seal a frame
+     * @param header of the frame
+     * @param data of the frame
+     * @param length bytes of data
+     * @param check of the frame, the check of PacketSerial
+     * @param priority transmit lane of the frame
+     * \throws packet_exception if the data is longer than MAX_BUFF_RX
+     */
+    PreparedCommand(unsigned char header, const unsigned char* data, size_t length,
+            frame_check_t check = FRAME_CHECK_SUM, write_priority_t priority = WRITE_PRIORITY_CONTROL);
+
+    /**
+     * Overwrite bytes of the data
+     * @param offset first byte of the data to overwrite
+     * @param data new bytes
+     * @param size number of bytes
+     * \throws packet_exception if the bytes are beyond the data
+     */
+    void set(size_t offset, const void* data, size_t size);
+
+    /**
+     * Seal the frame again with another check
+     */
+    void seal(frame_check_t check);
+
+    /**
+     * @return the frame: header, length, data and check
+     */
+    const unsigned char* frame() const {
+        return frame_data;
+    }
+
+    /**
+     * @return bytes of the frame
+     */
+    size_t size() const {
+        return HEAD_PKG + frame_data[1] + frameCheckSize(frame_check);
+    }
+
+    /**
+     * @return data of the frame
+     */
+    const unsigned char* data() const {
+        return &frame_data[HEAD_PKG];
+    }
+
+    /**
+     * @return bytes of data
+     */
+    size_t length() const {
+        return frame_data[1];
+    }
+
+    unsigned char header() const {
+        return frame_data[0];
+    }
+
+    frame_check_t check() const {
+        return frame_check;
+    }
+
+    write_priority_t priority() const {
+        return write_priority;
+    }
+
+private:
+    unsigned char frame_data[HEAD_PKG + MAX_BUFF_RX + FRAME_CHECK_MAX];
+    frame_check_t frame_check;
+    write_priority_t write_priority;
+};
+
+#endif	/* PREPAREDCOMMAND_H */
@@ -0,0 +1,83 @@
+/*
+ * Copyright (C) 2014 Officine Robotiche
+ * Author: Raffaello Bonghi
+ * email:  raffaello.bonghi@officinerobotiche.it
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the GNU Lesser General Public License
+ * (LGPL) version 2.1 which accompanies this distribution, and is available at
+ * http://www.gnu.org/licenses/lgpl-2.1.html
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ */
+
+
+#ifndef RXRING_H
+#define	RXRING_H
+
+#include <cstddef>
+#include <boost/atomic.hpp>
+#include <boost/scoped_array.hpp>
+#include <boost/utility.hpp>
+#include "packet/packet.h"
+
+/**
+ * Preallocated ring of received packets, between one producer (the I/O
+ * thread) and one consumer at a time. push() and pop() don't lock; the owner
+ * serializes the consumers.
+ */
+class RxRing : private boost::noncopyable {
+public:
+    /**
+     * Build the ring
+     * @param packets maximum number of queued packets
+     */
+    explicit RxRing(size_t packets);
+
+    /**
+     * Copy a packet at the end of the ring, producer side
+     * @param packet received packet
+     * @return false if the ring is full, the packet is not queued
+     */
+    bool push(const packet_t& packet);
+
+    /**
+     * Copy out the oldest packet, consumer side
+     * @param packet filled with the oldest packet
+     * @return false if the ring is empty
+     */
+    bool pop(packet_t& packet);
+
+    /**
+     * Drop all the queued packets, consumer side
+     * @return number of packets dropped
+     */
+    size_t clear();
+
+    /**
+     * @return number of packets queued, a few updates apart from the
+     * producer and the consumer running meanwhile
+     */
+    size_t size() const {
+        return tail.load(boost::memory_order_acquire) - head.load(boost::memory_order_acquire);
+    }
+
+    /**
+     * @return true if no packet is queued
+     */
+    bool empty() const {
+        return head.load(boost::memory_order_acquire) == tail.load(boost::memory_order_acquire);
+    }
+
+private:
+    boost::scoped_array<packet_t> packets;
+    size_t capacity;
+    /// Positions only grow, the producer writes tail and the consumer head
+    boost::atomic<size_t> head;
+    char padding[64 - sizeof (boost::atomic<size_t>)];
+    boost::atomic<size_t> tail;
+};
+
+#endif	/* RXRING_H */
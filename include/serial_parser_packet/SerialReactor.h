@@ -0,0 +1,155 @@
+/*
+ * Copyright (C) 2014 Officine Robotiche
+ * Author: Raffaello Bonghi
+ * email:  raffaello.bonghi@officinerobotiche.it
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the GNU Lesser General Public License
+ * (LGPL) version 2.1 which accompanies this distribution, and is available at
+ * http://www.gnu.org/licenses/lgpl-2.1.html
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#ifndef SERIALREACTOR_H
+#define	SERIALREACTOR_H
+
+#include <vector>
+#include <boost/asio.hpp>
+#include <boost/thread.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/utility.hpp>
+
+/**
+ * Real-time options for the worker threads:
+ * * CPUs to pin the threads to, thread i uses cpus[i % size], empty for none
+ * * SCHED_FIFO priority 1 -> 99, 0 keeps the default scheduling
+ * * lock all the current and future memory of the process (mlockall)
+ * * bytes of stack touched when the thread starts, so it is never faulted
+ *   in the control loop
+ */
+typedef struct _reactor_thread_options {
+    std::vector<int> cpus;
+    int priority;
+    bool lock_memory;
+    size_t prefault_stack;
+} reactor_thread_options_t;
+
+/**
+ * Settings achieved by a worker thread:
+ * * CPU the thread is pinned to, -1 if not pinned
+ * * scheduling policy (SCHED_*, 0 where there is none) and priority in use
+ * * true if the memory is locked
+ * * errno of each request, zero if not requested or done
+ */
+typedef struct _reactor_thread_status {
+    int cpu;
+    int policy;
+    int priority;
+    bool memory_locked;
+    int affinity_error;
+    int priority_error;
+    int lock_error;
+} reactor_thread_status_t;
+
+/**
+ * io_service and worker threads shared by many AsyncSerial.
+ * Each AsyncSerial serializes its own handlers with a strand, so any number
+ * of worker threads can be used.
+ * A reactor must outlive all the AsyncSerial attached to it: they keep a
+ * shared pointer to it.
+ */
+class SerialReactor : private boost::noncopyable {
+public:
+    /**
+     * Reactor with its own io_service
+     * \param threads number of worker threads running the io_service
+     */
+    explicit SerialReactor(unsigned int threads = 1);
+
+    /**
+     * Reactor with its own io_service and real-time worker threads.
+     * The options are applied by each thread when it starts, the failures
+     * do not throw and they are reported by threadStatus().
+     * \param threads number of worker threads running the io_service
+     * \param options real-time options
+     */
+    SerialReactor(unsigned int threads, const reactor_thread_options_t& options);
+
+    /**
+     * Reactor over an io_service owned by the application. No thread is
+     * started: the application runs the io_service, and it must keep it
+     * running until all the attached AsyncSerial are closed.
+     * \param io application io_service
+     */
+    explicit SerialReactor(boost::asio::io_service& io);
+
+    /**
+     * Stop and join the worker threads
+     */
+    ~SerialReactor();
+
+    /**
+     * \return the io_service running the read/write operations
+     */
+    boost::asio::io_service& ioService() {
+        return io;
+    }
+
+    /**
+     * \return number of worker threads, zero for an application io_service
+     */
+    unsigned int threads() const {
+        return workers.size();
+    }
+
+    /**
+     * \return true if the calling thread is a worker thread of this reactor
+     * or, with Boost 1.66 or later, any thread running its io_service
+     */
+    bool runningInThisThread() const;
+
+    /**
+     * \return the settings achieved by each worker thread
+     */
+    std::vector<reactor_thread_status_t> threadStatus() const;
+
+    /**
+     * \return options without any real-time setting
+     */
+    static reactor_thread_options_t defaultThreadOptions();
+
+private:
+
+    /**
+     * Start the worker threads and wait until they applied the options
+     */
+    void start(unsigned int threads);
+
+    /**
+     * Body of a worker thread
+     * \param index thread index
+     */
+    void worker(unsigned int index);
+
+    /**
+     * Apply the real-time options to the calling thread
+     */
+    reactor_thread_status_t applyOptions(unsigned int index);
+
+    boost::scoped_ptr<boost::asio::io_service> own_io;
+    boost::asio::io_service& io;
+    /// Keep the worker threads running while there is nothing to do
+    boost::scoped_ptr<boost::asio::io_service::work> work;
+    std::vector<boost::thread*> workers;
+
+    reactor_thread_options_t options;
+    std::vector<reactor_thread_status_t> status;
+    unsigned int started; ///< Threads that applied the options
+    mutable boost::mutex statusMutex; ///< Mutex for access to status
+    boost::condition_variable startedCond;
+};
+
+#endif	/* SERIALREACTOR_H */
@@ -0,0 +1,238 @@
+/*
+ * Copyright (C) 2014 Officine Robotiche
+ * Author: Raffaello Bonghi
+ * email:  raffaello.bonghi@officinerobotiche.it
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the GNU Lesser General Public License
+ * (LGPL) version 2.1 which accompanies this distribution, and is available at
+ * http://www.gnu.org/licenses/lgpl-2.1.html
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#ifndef SERIALTRANSPORT_H
+#define	SERIALTRANSPORT_H
+
+#include <string>
+#include <boost/asio.hpp>
+#include <boost/function.hpp>
+#include <boost/utility.hpp>
+#include "TxRing.h"
+#include "HandlerAllocator.h"
+#include "LinuxSerialPort.h"
+
+/**
+ * Byte stream used by AsyncSerial to talk with a board.
+ * All the operations are started from the io_service thread of the
+ * AsyncSerial that owns the transport, and the handlers are called from it.
+ */
+class SerialTransport : private boost::noncopyable {
+public:
+    /// Completion handler: error and bytes transferred
+    typedef boost::function<void (const boost::system::error_code&, size_t) > handler_t;
+
+    virtual ~SerialTransport() {
+    }
+
+    /**
+     * Start an asynchronous read of at least one byte
+     * @param data buffer for the data read
+     * @param size buffer size
+     * @param handler called at the end of the read, it is not copied and
+     * must stay valid until it is called
+     */
+    virtual void asyncReadSome(char* data, size_t size, const handler_t& handler) = 0;
+
+    /**
+     * Start an asynchronous write of all the buffers
+     * @param buffers data to write, they must stay valid until the handler is called
+     * @param handler called at the end of the write, it is not copied and
+     * must stay valid until it is called
+     */
+    virtual void asyncWrite(const TxBufferSequence& buffers, const handler_t& handler) = 0;
+
+    /**
+     * Abort all the asynchronous operations in progress
+     */
+    virtual void cancel(boost::system::error_code& ec) = 0;
+
+    /**
+     * Close the transport
+     */
+    virtual void close(boost::system::error_code& ec) = 0;
+
+    /**
+     * @return true if the transport is open
+     */
+    virtual bool isOpen() const = 0;
+};
+
+/**
+ * Transport over any asio stream object. The operations of the read loop and
+ * of the write loop recycle their memory, so they do not allocate.
+ */
+template <class Stream>
+class StreamTransport : public SerialTransport {
+public:
+
+    explicit StreamTransport(boost::asio::io_service& io) : stream(io) {
+    }
+
+    void asyncReadSome(char* data, size_t size, const handler_t& handler) {
+        stream.async_read_some(boost::asio::buffer(data, size), makeRecyclingHandler(read_memory, &handler));
+    }
+
+    void asyncWrite(const TxBufferSequence& buffers, const handler_t& handler) {
+        boost::asio::async_write(stream, buffers, makeRecyclingHandler(write_memory, &handler));
+    }
+
+    void cancel(boost::system::error_code& ec) {
+        stream.cancel(ec);
+    }
+
+    void close(boost::system::error_code& ec) {
+        stream.close(ec);
+    }
+
+    bool isOpen() const {
+        return stream.is_open();
+    }
+
+    /**
+     * @return the underlying asio object
+     */
+    Stream& native() {
+        return stream;
+    }
+
+protected:
+    Stream stream;
+
+private:
+    HandlerMemory read_memory, write_memory;
+};
+
+/**
+ * Serial port device, example "/dev/ttyS0" or "COM1"
+ */
+class SerialPortTransport : public StreamTransport<boost::asio::serial_port> {
+public:
+    /**
+     * Open the serial device
+     * \throws boost::system::system_error if cannot open the serial device
+     */
+    SerialPortTransport(boost::asio::io_service& io, const std::string& devname, unsigned int baud_rate,
+            boost::asio::serial_port_base::parity opt_parity =
+            boost::asio::serial_port_base::parity(
+            boost::asio::serial_port_base::parity::none),
+            boost::asio::serial_port_base::character_size opt_csize =
+            boost::asio::serial_port_base::character_size(8),
+            boost::asio::serial_port_base::flow_control opt_flow =
+            boost::asio::serial_port_base::flow_control(
+            boost::asio::serial_port_base::flow_control::none),
+            boost::asio::serial_port_base::stop_bits opt_stop =
+            boost::asio::serial_port_base::stop_bits(
+            boost::asio::serial_port_base::stop_bits::one));
+};
+
+#ifdef BOOST_ASIO_HAS_POSIX_STREAM_DESCRIPTOR
+
+/**
+ * Master side of a new pseudo terminal, in raw mode.
+ * A stand-in board opens slaveName() as if it was a real serial device.
+ */
+class PtyTransport : public StreamTransport<boost::asio::posix::stream_descriptor> {
+public:
+    /**
+     * \throws boost::system::system_error if cannot create the pseudo terminal
+     */
+    explicit PtyTransport(boost::asio::io_service& io);
+    virtual ~PtyTransport();
+
+    /**
+     * @return name of the slave device, example "/dev/pts/3"
+     */
+    const std::string& slaveName() const {
+        return slave_name;
+    }
+
+private:
+    std::string slave_name;
+    /// Kept open, otherwise reading the master fails until a slave is opened
+    int slave;
+};
+
+#endif
+
+#ifdef __linux__
+
+/**
+ * Linux serial device configured with termios2, it supports any baud rate,
+ * the low latency mode of the driver and the VMIN/VTIME tuning.
+ * The raw file descriptor is driven directly by the epoll reactor of asio.
+ */
+class LinuxSerialTransport : public StreamTransport<boost::asio::posix::stream_descriptor> {
+public:
+    /**
+     * Open the serial device
+     * \param io io_service of the AsyncSerial that will use the transport
+     * \param devname serial device name, example "/dev/ttyUSB0"
+     * \param options device options, see linuxSerialDefaultOptions()
+     * \throws boost::system::system_error if cannot open the serial device
+     */
+    LinuxSerialTransport(boost::asio::io_service& io, const std::string& devname, const linux_serial_options_t& options);
+
+    /**
+     * @return the settings achieved on the device
+     */
+    const linux_serial_status_t& status() const {
+        return serial_status;
+    }
+
+private:
+    linux_serial_status_t serial_status;
+};
+
+#endif
+
+#ifdef BOOST_ASIO_HAS_LOCAL_SOCKETS
+
+/**
+ * One end of a Unix socketpair, the other end is left to a stand-in board
+ */
+class SocketPairTransport : public StreamTransport<boost::asio::local::stream_protocol::socket> {
+public:
+    /**
+     * \throws boost::system::system_error if cannot create the socketpair
+     */
+    explicit SocketPairTransport(boost::asio::io_service& io);
+    virtual ~SocketPairTransport();
+
+    /**
+     * Give away the other end of the socketpair
+     * @return file descriptor, the caller must close it
+     */
+    int releasePeer();
+
+private:
+    int peer;
+};
+
+#endif
+
+/**
+ * TCP connection, example to a serial to ethernet bridge
+ */
+class TcpTransport : public StreamTransport<boost::asio::ip::tcp::socket> {
+public:
+    /**
+     * Connect to the server, Nagle algorithm is disabled
+     * \throws boost::system::system_error if cannot connect
+     */
+    TcpTransport(boost::asio::io_service& io, const std::string& host, const std::string& port);
+};
+
+#endif	/* SERIALTRANSPORT_H */
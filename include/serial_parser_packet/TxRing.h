@@ -0,0 +1,230 @@
+/*
+ * Copyright (C) 2014 Officine Robotiche
+ * Author: Raffaello Bonghi
+ * email:  raffaello.bonghi@officinerobotiche.it
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the GNU Lesser General Public License
+ * (LGPL) version 2.1 which accompanies this distribution, and is available at
+ * http://www.gnu.org/licenses/lgpl-2.1.html
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#ifndef TXRING_H
+#define	TXRING_H
+
+#include <vector>
+#include <cstddef>
+#include <boost/atomic.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/scoped_array.hpp>
+#include <boost/asio/buffer.hpp>
+#include <boost/utility.hpp>
+
+/**
+ * A slot reserved in the transmit ring. The caller encodes the frame
+ * directly in [data, data + size) and then commits the slot.
+ */
+typedef struct _tx_slot {
+    char* data;
+    size_t size;
+    size_t index; ///< Frame sequence inside the ring, it wraps at 2^32
+    int lane; ///< Ring of the slot, when the owner has more than one
+} tx_slot_t;
+
+/**
+ * Lightweight view over an array of const_buffer, used as buffer sequence
+ * for async_write without copying the array in the write handler.
+ */
+class TxBufferSequence {
+public:
+    typedef boost::asio::const_buffer value_type;
+    typedef const boost::asio::const_buffer* const_iterator;
+
+    TxBufferSequence(const_iterator begin, const_iterator end) : first(begin), last(end) {
+    }
+
+    const_iterator begin() const {
+        return first;
+    }
+
+    const_iterator end() const {
+        return last;
+    }
+
+private:
+    const_iterator first, last;
+};
+
+/**
+ * Preallocated transmit ring.
+ * Writers reserve a contiguous slot, encode the frame in place and commit it.
+ * The I/O thread claims the committed frames as a list of contiguous spans
+ * (adjacent frames are merged), sends them and then releases them.
+ * Frames are always delivered in reservation order: a frame reserved but not
+ * yet committed holds back all the frames reserved after it.
+ *
+ * The ring does not allocate after construction. reserve() and commit() are
+ * lock free and can be called by many writers at the same time; the other
+ * members change the consumer side and the owner serializes them.
+ */
+class TxRing : private boost::noncopyable {
+public:
+    /**
+     * Build the ring
+     * @param size bytes available, rounded up to a power of two
+     * @param frames maximum number of queued frames, rounded up to a power of two
+     */
+    TxRing(size_t size, size_t frames);
+
+    /**
+     * Reserve a contiguous slot, lock free
+     * @param size dimension of the slot
+     * @param slot reserved slot
+     * @return false if there is no room for the slot
+     */
+    bool reserve(size_t size, tx_slot_t& slot);
+
+    /**
+     * Mark a slot ready to be sent, lock free
+     * @param slot slot returned from reserve
+     */
+    void commit(const tx_slot_t& slot);
+
+    /**
+     * Claim the committed frames not already claimed, in order
+     * @param spans array filled with contiguous spans to send
+     * @param max_spans dimension of the array
+     * @param max_bytes stop before the frame that would exceed it, the first
+     * frame is claimed anyway
+     * @return number of spans filled, zero if there is nothing to send
+     */
+    size_t claim(boost::asio::const_buffer* spans, size_t max_spans, size_t max_bytes = size_t(-1));
+
+    /**
+     * Free all the claimed frames
+     */
+    void release();
+
+    /**
+     * Drop the oldest committed frame not yet claimed. Its room is free at
+     * once if no frame is claimed, otherwise at the next release().
+     * @return size of the dropped frame, zero if there is no frame to drop
+     */
+    size_t dropOldest();
+
+    /**
+     * Drop all the frames, there must be no writer
+     */
+    void clear();
+
+    /**
+     * Limit the queued data below the dimension of the ring. The bytes
+     * skipped to keep a slot contiguous count against the limit unless the
+     * ring is empty: with a limit below twice the largest slot, a slot that
+     * wraps waits until the ring is empty.
+     * @param bytes maximum queued bytes, 0 for the dimension of the ring
+     * @param frames maximum queued frames, 0 for the dimension of the ring
+     */
+    void setLimit(size_t bytes, size_t frames);
+
+    /**
+     * @return maximum queued bytes
+     */
+    size_t byteLimit() const {
+        return byte_limit.load(boost::memory_order_relaxed);
+    }
+
+    /**
+     * @return true if there are committed frames not claimed
+     */
+    bool ready() const;
+
+    /**
+     * @return bytes committed and not yet claimed
+     */
+    size_t readyBytes() const {
+        return ready_bytes.load(boost::memory_order_relaxed);
+    }
+
+    /**
+     * @return sequence of the first claimed frame not yet released
+     */
+    size_t claimedBegin() const {
+        return frame_tail.load(boost::memory_order_relaxed);
+    }
+
+    /**
+     * @return number of claimed frames not yet released, their sequences
+     * follow claimedBegin() and wrap at 2^32 as the slot index does
+     */
+    size_t claimedFrames() const {
+        return position_t(frame_claim.load(boost::memory_order_relaxed) -
+                frame_tail.load(boost::memory_order_relaxed));
+    }
+
+    /**
+     * @return bytes reserved and not yet released
+     */
+    size_t queuedBytes() const {
+        return position_t(byteHead(head.load(boost::memory_order_acquire)) -
+                byte_tail.load(boost::memory_order_acquire));
+    }
+
+    /**
+     * @return frames reserved and not yet released
+     */
+    size_t queuedFrames() const {
+        return position_t(frameHead(head.load(boost::memory_order_acquire)) -
+                frame_tail.load(boost::memory_order_acquire));
+    }
+
+    /**
+     * @return dimension of the ring in bytes
+     */
+    size_t size() const {
+        return buffer.size();
+    }
+
+private:
+
+    /// Absolute positions, they only grow (wrapping) and are masked to address the arrays
+    typedef boost::uint32_t position_t;
+
+    typedef struct _tx_frame {
+        position_t begin; ///< First byte (absolute position)
+        position_t end; ///< Last byte + 1 (absolute position)
+        /// Sequence of the frame once committed, an older one before
+        boost::atomic<position_t> committed;
+    } tx_frame_t;
+
+    /// The writers advance frame and byte head together with a single CAS
+    static boost::uint64_t makeHead(position_t frame, position_t byte) {
+        return (boost::uint64_t(frame) << 32) | byte;
+    }
+
+    static position_t frameHead(boost::uint64_t value) {
+        return position_t(value >> 32);
+    }
+
+    static position_t byteHead(boost::uint64_t value) {
+        return position_t(value);
+    }
+
+    static size_t roundPowerOfTwo(size_t value);
+
+    std::vector<char> buffer;
+    boost::scoped_array<tx_frame_t> frames;
+    size_t frame_count;
+    position_t byte_mask, frame_mask;
+    boost::atomic<position_t> byte_limit, frame_limit;
+    boost::atomic<boost::uint64_t> head;
+    boost::atomic<position_t> byte_tail;
+    boost::atomic<position_t> frame_claim, frame_tail;
+    boost::atomic<size_t> ready_bytes;
+};
+
+#endif	/* TXRING_H */
@@ -7,7 +7,22 @@ INCLUDEPATH += $$PATH/include
 HEADERS += \
     $$PATH/include/serial_parser_packet/AsyncSerial.h \
     $$PATH/include/serial_parser_packet/AsyncSerial.h \
+    $$PATH/include/serial_parser_packet/FragmentAssembler.h \
+    $$PATH/include/serial_parser_packet/FrameChecksum.h \
+    $$PATH/include/serial_parser_packet/FrameCobs.h \
+    $$PATH/include/serial_parser_packet/FramingCore.h \
+    $$PATH/include/serial_parser_packet/HandlerAllocator.h \
+    $$PATH/include/serial_parser_packet/IoUringEngine.h \
+    $$PATH/include/serial_parser_packet/LinkStatistics.h \
+    $$PATH/include/serial_parser_packet/LinuxSerialPort.h \
+    $$PATH/include/serial_parser_packet/MessageIterator.h \
+    $$PATH/include/serial_parser_packet/PacketDispatcher.h \
     $$PATH/include/serial_parser_packet/ParserPacket.h \
+    $$PATH/include/serial_parser_packet/PreparedCommand.h \
+    $$PATH/include/serial_parser_packet/RxRing.h \
+    $$PATH/include/serial_parser_packet/SerialReactor.h \
+    $$PATH/include/serial_parser_packet/SerialTransport.h \
+    $$PATH/include/serial_parser_packet/TxRing.h \
     $$PATH/include/packet/frame_motion.h \
     $$PATH/include/packet/frame_motor.h \
     $$PATH/include/packet/frame_navigation.h \
@@ -17,8 +32,19 @@ HEADERS += \
 
 SOURCES += \
     $$PATH/src/serial_parser_packet/AsyncSerial.cpp \
+    $$PATH/src/serial_parser_packet/FragmentAssembler.cpp \
+    $$PATH/src/serial_parser_packet/FrameChecksum.cpp \
+    $$PATH/src/serial_parser_packet/FrameCobs.cpp \
+    $$PATH/src/serial_parser_packet/IoUringEngine.cpp \
+    $$PATH/src/serial_parser_packet/PacketDispatcher.cpp \
     $$PATH/src/serial_parser_packet/PacketSerial.cpp \
+    $$PATH/src/serial_parser_packet/LinuxSerialPort.cpp \
     $$PATH/src/serial_parser_packet/ParserPacket.cpp \
+    $$PATH/src/serial_parser_packet/PreparedCommand.cpp \
+    $$PATH/src/serial_parser_packet/RxRing.cpp \
+    $$PATH/src/serial_parser_packet/SerialReactor.cpp \
+    $$PATH/src/serial_parser_packet/SerialTransport.cpp \
+    $$PATH/src/serial_parser_packet/TxRing.cpp \
     $$PATH/src/interface/unavinterface.cpp	
 
 linux {
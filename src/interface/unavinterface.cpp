@@ -28,6 +28,7 @@ bool UNavInterface::connect( const std::string& devname, unsigned int baud_rate
     try
     {
         _uNav = new ParserPacket( devname, baud_rate );
+        prepareSpeedCommands();
     }
     catch( parser_exception& e)
     {
@@ -51,6 +52,26 @@ bool UNavInterface::connect( const std::string& devname, unsigned int baud_rate
     return true;
 }
 
+void UNavInterface::prepareSpeedCommands()
+{
+    int16_t speed = 0;
+    vector<packet_information_t> packet_list;
+
+    motor_command_map_t motor_command_;
+    motor_command_.bitset.command = MOTOR_VEL_REF; ///< Set command to velocity control
+
+    for( uint8_t motor = 0; motor < 2; motor++ )
+    {
+        motor_command_.bitset.motor = motor;
+        packet_list.push_back(
+                    _uNav->createDataPacket(motor_command_.command_message,
+                                            HASHMAP_MOTOR,
+                                            (message_abstract_u*) &speed) );
+        _speedCommand[motor] = _uNav->prepareCommand( packet_list.back(), HEADER_SYNC );
+    }
+    _speedsCommand = _uNav->prepareCommand( packet_list, HEADER_SYNC );
+}
+
 void UNavInterface::disconnect()
 {
     if( _uNav )
@@ -365,28 +386,15 @@ bool UNavInterface::getPIDGains(uint8_t motIdx, double& kp, double& ki, double&
 
 bool UNavInterface::sendMotorSpeeds( int16_t speed_0, int16_t speed_1 )
 {
-    vector<packet_information_t> packet_list;
-
-    motor_command_map_t motor_command_;
-    motor_command_.bitset.command = MOTOR_VEL_REF; ///< Set command to velocity control
-
-    //Build a command message
-    motor_command_.bitset.motor = 0;
-    packet_list.push_back(
-                _uNav->createDataPacket(motor_command_.command_message,
-                                        HASHMAP_MOTOR,
-                                        (message_abstract_u*) &speed_0) );
-
-    //Build a command message
-    motor_command_.bitset.motor = 1;
-    packet_list.push_back(
-                _uNav->createDataPacket(motor_command_.command_message,
-                                        HASHMAP_MOTOR,
-                                        (message_abstract_u*) &speed_1) );
-
     try
     {
-        _uNav->parserSendPacket(packet_list, 3, boost::posix_time::millisec(200));
+        //Only the speeds and the check of the prepared frame change, in a
+        //copy of its own for each call: the calls may come from many threads
+        PreparedCommand command = _speedsCommand;
+        ParserPacket::setCommandMessage( command, 0, (message_abstract_u*) &speed_0 );
+        ParserPacket::setCommandMessage( command, 1, (message_abstract_u*) &speed_1 );
+
+        _uNav->parserSendPacket(command, 3, boost::posix_time::millisec(200));
     }
     catch( parser_exception& e)
     {
@@ -418,13 +426,23 @@ bool UNavInterface::sendMotorSpeed( uint8_t motorIdx, int16_t speed )
 
     try
     {
-        motor_command_map_t command;
-        command.bitset.motor = motorIdx;
-        command.bitset.command = MOTOR_VEL_REF;
+        if( motorIdx < 2 )
+        {
+            packet_t reply;
+            PreparedCommand command = _speedCommand[motorIdx];
+            ParserPacket::setCommandMessage( command, 0, (message_abstract_u*) &speed );
+            _uNav->sendSyncPacket(command, reply, 3, boost::posix_time::millisec(200));
+        }
+        else
+        {
+            motor_command_map_t command;
+            command.bitset.motor = motorIdx;
+            command.bitset.command = MOTOR_VEL_REF;
 
-        packet_t packet_send = _uNav->encoder(_uNav->createDataPacket(command.command_message, HASHMAP_MOTOR, (message_abstract_u*) &speed));
+            packet_t packet_send = _uNav->encoder(_uNav->createDataPacket(command.command_message, HASHMAP_MOTOR, (message_abstract_u*) &speed));
 
-        _uNav->sendSyncPacket(packet_send, 3, boost::posix_time::millisec(200));
+            _uNav->sendSyncPacket(packet_send, 3, boost::posix_time::millisec(200));
+        }
     }
     catch( parser_exception& e)
     {
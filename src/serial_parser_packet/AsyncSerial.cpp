@@ -28,13 +28,97 @@
 #include "serial_parser_packet/AsyncSerial.h"
 
 #include <string>
+#include <cstring>
 #include <algorithm>
 #include <iostream>
 #include <boost/bind.hpp>
 
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
 using namespace std;
 using namespace boost;
 
+//
+//Class TxLane
+//
+
+/**
+ * Transmit lane: the queue of the frames of one priority, when they were
+ * committed and when their write ended
+ */
+class TxLane: private boost::noncopyable
+{
+public:
+    TxLane(): queue(AsyncSerial::writeBufferSize,
+            AsyncSerial::writeBufferFrames),
+            writeTimes(AsyncSerial::writeBufferFrames),
+            commitTimes(AsyncSerial::writeBufferFrames)
+    {
+        clear();
+    }
+
+    /**
+     * Drop all the frames and the statistics, there must be no writer
+     */
+    void clear()
+    {
+        queue.clear();
+        std::fill(writeTimes.begin(),writeTimes.end(),
+                std::make_pair(size_t(0),uint64_t(0)));
+        std::fill(commitTimes.begin(),commitTimes.end(),0);
+        memset(&statistics,0,sizeof(statistics));
+    }
+
+    /**
+     * Record the end of the write of the claimed slots, with writeQueueMutex
+     * locked
+     */
+    void recordWriteTimes(uint64_t time)
+    {
+        size_t first=queue.claimedBegin();
+        for(size_t i=0;i<queue.claimedFrames();i++)
+        {
+            size_t sequence=uint32_t(first+i);
+            //Dropped behind the write, it was never sent
+            uint64_t committed=commitTimes[sequence % commitTimes.size()];
+            if(committed==droppedFrame) continue;
+            writeTimes[sequence % writeTimes.size()]=
+                    std::make_pair(sequence,time);
+            //Committed while the timestamps were disabled
+            if(committed==0 || committed>time) continue;
+            statistics.frames++;
+            statistics.total_delay+=time-committed;
+            statistics.max_delay=std::max(statistics.max_delay,time-committed);
+        }
+    }
+
+    /// Commit time of a frame dropped before its write
+    static const uint64_t droppedFrame=uint64_t(-1);
+
+    TxRing queue; ///< Frames of the lane
+    /// Sequence and end of the write of the last released slots
+    std::vector<std::pair<size_t, uint64_t> > writeTimes;
+    /// When the slots being queued were committed, 0 if unknown
+    std::vector<uint64_t> commitTimes;
+    write_lane_statistics_t statistics; ///< Delay of the frames
+};
+
+/**
+ * \return the lane of a priority
+ * \throws boost::system::system_error if the priority is not valid
+ */
+static TxLane& writeLane(TxLane* lanes, int priority)
+{
+    if(priority<0 || priority>=AsyncSerial::writePriorities)
+        throw(boost::system::system_error(boost::system::error_code(),
+                "Invalid write priority"));
+    return lanes[priority];
+}
+
 //
 //Class AsyncSerial
 //
@@ -44,25 +128,127 @@ using namespace boost;
 class AsyncSerialImpl: private boost::noncopyable
 {
 public:
-    AsyncSerialImpl(): io(), port(io), backgroundThread(), open(false),
-            error(false) {}
+    AsyncSerialImpl(): reactor(), strand(), transport(), open(false),
+            error(false), writeScheduled(false), writePolicy(WRITE_BLOCK),
+            writeQuantum(0), coalesceBytes(0), coalesceTimed(false),
+            coalesceDelay(posix_time::pos_infin), writeTimerArmed(false),
+            committedFrames(0), timestamps(false), readTime(0), pending(0)
+    {
+        memset(&writeStatistics,0,sizeof(writeStatistics));
+    }
 
-    boost::asio::io_service io; ///< Io service object
-    boost::asio::serial_port port; ///< Serial port object
-    boost::thread backgroundThread; ///< Thread that runs read/write operations
-    bool open; ///< True if port open
+    /**
+     * Like beginOperation(), for the writer threads: they may race with
+     * close(), that waits only for the operations begun while the port is
+     * still open
+     * \return false if the port is closed and the operation can't begin
+     */
+    bool beginWriterOperation()
+    {
+        beginOperation();
+        if(open) return true;
+        endOperation();
+        return false;
+    }
+
+    /**
+     * To be called before posting a handler or starting an operation
+     * that close() must wait for
+     */
+    void beginOperation()
+    {
+        lock_guard<mutex> l(pendingMutex);
+        pending++;
+    }
+
+    /**
+     * To be called when the handler or the operation ends
+     */
+    void endOperation()
+    {
+        lock_guard<mutex> l(pendingMutex);
+        if(--pending==0) pendingCond.notify_all();
+    }
+
+    /**
+     * Wait until all the handlers and operations are completed
+     */
+    void waitOperations()
+    {
+        unique_lock<mutex> l(pendingMutex);
+        while(pending>0) pendingCond.wait(l);
+    }
+
+    /**
+     * \return true if any lane has committed frames not claimed
+     */
+    bool ready() const
+    {
+        for(int i=0;i<AsyncSerial::writePriorities;i++)
+            if(lanes[i].queue.ready()) return true;
+        return false;
+    }
+
+    /**
+     * \return bytes committed and not yet claimed in all the lanes
+     */
+    size_t readyBytes() const
+    {
+        size_t result=0;
+        for(int i=0;i<AsyncSerial::writePriorities;i++)
+            result+=lanes[i].queue.readyBytes();
+        return result;
+    }
+
+    /// Runs read/write operations, shared or private to this port
+    boost::shared_ptr<SerialReactor> reactor;
+    /// Serializes the handlers of this port on the reactor threads
+    boost::scoped_ptr<boost::asio::io_service::strand> strand;
+    boost::shared_ptr<SerialTransport> transport; ///< Serial port or stand-in
+    SerialTransport::handler_t readHandler; ///< Calls readEnd in strand
+    SerialTransport::handler_t writeHandler; ///< Calls writeEnd in strand
+    /// Memory recycled to dispatch readEnd and writeEnd in strand
+    HandlerMemory readEndMemory, writeEndMemory;
+    boost::atomic<bool> open; ///< True if port open
     bool error; ///< Error flag
     mutable boost::mutex errorMutex; ///< Mutex for access to error
 
-    /// Data are queued here before they go in writeBuffer
-    std::vector<char> writeQueue;
-    boost::shared_array<char> writeBuffer; ///< Data being written
-    size_t writeBufferSize; ///< Size of writeBuffer
-    boost::mutex writeQueueMutex; ///< Mutex for access to writeQueue
+    /// Data are encoded here by the writers and sent from here
+    TxLane lanes[AsyncSerial::writePriorities];
+    /// Spans of the lanes being written, the higher lanes first
+    boost::asio::const_buffer writeBuffer[16];
+    size_t writeBufferCount; ///< Number of spans in writeBuffer
+    /// True if doWrite is posted or a write is in progress
+    boost::atomic<bool> writeScheduled;
+    /// Mutex for the consumer side of the lanes and for the writers that
+    /// find one full, reserve() and commit() don't need it
+    boost::mutex writeQueueMutex;
+    /// Signaled when room is freed in a lane
+    boost::condition_variable writeQueueCond;
+    write_policy_t writePolicy; ///< What writers do when a lane is full
+    size_t writeQuantum; ///< Bytes of a write operation, 0 no limit
+    /// Queued bytes that start a write, 0 disabled
+    boost::atomic<size_t> coalesceBytes;
+    boost::atomic<bool> coalesceTimed; ///< True if coalesceDelay is finite
+    posix_time::time_duration coalesceDelay; ///< Maximum coalescing delay
+    boost::scoped_ptr<boost::asio::deadline_timer> writeTimer;
+    /// True if the coalescing delay is running
+    boost::atomic<bool> writeTimerArmed;
+    /// Memory recycled by doWrite and doWriteTimer, one is posted at a time
+    HandlerMemory writePostMemory, writeTimerMemory;
+    /// Writes committed, counted out of writeQueueMutex
+    boost::atomic<unsigned long> committedFrames;
+    write_statistics_t writeStatistics; ///< Transmit counters
+    boost::atomic<bool> timestamps; ///< True if timestamps are recorded
+    uint64_t readTime; ///< When the data in readBuffer were received
     char readBuffer[AsyncSerial::readBufferSize]; ///< data being read
 
     /// Read complete callback
     boost::function<void (const char*, size_t)> callback;
+
+    int pending; ///< Handlers and operations not yet completed
+    boost::mutex pendingMutex; ///< Mutex for access to pending
+    boost::condition_variable pendingCond; ///< Signaled when pending is 0
 };
 
 AsyncSerial::AsyncSerial(): pimpl(new AsyncSerialImpl)
@@ -89,20 +275,55 @@ void AsyncSerial::open(const std::string& devname, unsigned int baud_rate,
     if(isOpen()) close();
 
     setErrorStatus(true);//If an exception is thrown, error_ remains true
-    pimpl->port.open(devname);
-    pimpl->port.set_option(asio::serial_port_base::baud_rate(baud_rate));
-    pimpl->port.set_option(opt_parity);
-    pimpl->port.set_option(opt_csize);
-    pimpl->port.set_option(opt_flow);
-    pimpl->port.set_option(opt_stop);
+    open(boost::shared_ptr<SerialTransport>(new SerialPortTransport(ioService(),
+            devname,baud_rate,opt_parity,opt_csize,opt_flow,opt_stop)));
+}
 
-    //This gives some work to the io_service before it is started
-    pimpl->io.post(boost::bind(&AsyncSerial::doRead, this));
+void AsyncSerial::open(boost::shared_ptr<SerialTransport> transport)
+{
+    if(isOpen()) close();
 
-    thread t(boost::bind(&asio::io_service::run, &pimpl->io));
-    pimpl->backgroundThread.swap(t);
+    setErrorStatus(true);//If an exception is thrown, error_ remains true
+    if(!transport || !transport->isOpen())
+        throw(boost::system::system_error(boost::system::error_code(),
+                "Transport not open"));
+    pimpl->transport=transport;
+    pimpl->strand.reset(new asio::io_service::strand(ioService()));
+    pimpl->readHandler=pimpl->strand->wrap(makeRecyclingHandler(
+            pimpl->readEndMemory,boost::bind(&AsyncSerial::readEnd,
+            this,
+            asio::placeholders::error,
+            asio::placeholders::bytes_transferred)));
+    pimpl->writeHandler=pimpl->strand->wrap(makeRecyclingHandler(
+            pimpl->writeEndMemory,boost::bind(&AsyncSerial::writeEnd,
+            this,
+            asio::placeholders::error)));
+    pimpl->writeTimer.reset(new asio::deadline_timer(ioService()));
     setErrorStatus(false);//If we get here, no error
-    pimpl->open=true; //Port is now open
+    {
+        lock_guard<mutex> l(pimpl->writeQueueMutex);
+        for(int i=0;i<writePriorities;i++) pimpl->lanes[i].clear();
+        pimpl->writeScheduled=false;
+        pimpl->writeTimerArmed=false;
+        pimpl->committedFrames=0;
+        memset(&pimpl->writeStatistics,0,sizeof(pimpl->writeStatistics));
+        pimpl->open=true; //Port is now open
+    }
+
+    //The read loop runs until the port is closed
+    pimpl->beginOperation();
+    pimpl->strand->post(boost::bind(&AsyncSerial::doRead, this));
+}
+
+void AsyncSerial::setReactor(boost::shared_ptr<SerialReactor> reactor)
+{
+    if(isOpen())
+        throw(boost::system::system_error(boost::system::error_code(),
+                "Can't change the reactor of an open port"));
+    pimpl->writeTimer.reset();
+    pimpl->strand.reset();
+    pimpl->transport.reset();
+    pimpl->reactor=reactor;
 }
 
 bool AsyncSerial::isOpen() const
@@ -110,6 +331,13 @@ bool AsyncSerial::isOpen() const
     return pimpl->open;
 }
 
+asio::io_service& AsyncSerial::ioService()
+{
+    //Without a shared reactor, the port has its own thread as before
+    if(!pimpl->reactor) pimpl->reactor.reset(new SerialReactor(1));
+    return pimpl->reactor->ioService();
+}
+
 bool AsyncSerial::errorStatus() const
 {
     lock_guard<mutex> l(pimpl->errorMutex);
@@ -120,10 +348,16 @@ void AsyncSerial::close()
 {
     if(!isOpen()) return;
 
-    pimpl->open=false;
-    pimpl->io.post(boost::bind(&AsyncSerial::doClose, this));
-    pimpl->backgroundThread.join();
-    pimpl->io.reset();
+    {
+        lock_guard<mutex> l(pimpl->writeQueueMutex);
+        pimpl->open=false; //From now on writers don't post doWrite
+    }
+    pimpl->beginOperation();
+    pimpl->strand->post(boost::bind(&AsyncSerial::closeEnd, this));
+    //The reactor may be shared, wait only for the handlers of this port
+    pimpl->waitOperations();
+    pimpl->transport.reset();
+    pimpl->writeQueueCond.notify_all(); //Wake up writers waiting for room
     if(errorStatus())
     {
         throw(boost::system::system_error(boost::system::error_code(),
@@ -131,32 +365,170 @@ void AsyncSerial::close()
     }
 }
 
-void AsyncSerial::write(const char *data, size_t size)
+void AsyncSerial::write(const char *data, size_t size,
+        write_priority_t priority)
 {
+    //Long writes are split, so that they always fit in the transmit queue
+    size_t maxChunk=std::max<size_t>(
+            writeLane(pimpl->lanes,priority).queue.byteLimit()/2,1);
+    while(size>0)
     {
-        lock_guard<mutex> l(pimpl->writeQueueMutex);
-        pimpl->writeQueue.insert(pimpl->writeQueue.end(),data,data+size);
+        size_t chunk=std::min<size_t>(size,maxChunk);
+        tx_slot_t slot=writeReserve(chunk,priority);
+        memcpy(slot.data,data,chunk);
+        writeCommit(slot);
+        data+=chunk;
+        size-=chunk;
     }
-    pimpl->io.post(boost::bind(&AsyncSerial::doWrite, this));
 }
 
 void AsyncSerial::write(const std::vector<char>& data)
 {
+    if(!data.empty()) write(&data[0],data.size());
+}
+
+void AsyncSerial::writeString(const std::string& s)
+{
+    write(s.data(),s.size());
+}
+
+tx_slot_t AsyncSerial::writeReserve(size_t size, write_priority_t priority)
+{
+    TxLane& lane=writeLane(pimpl->lanes,priority);
+    tx_slot_t slot;
+    slot.lane=priority;
+    if(size==0 || size>lane.queue.byteLimit())
+        throw(boost::system::system_error(boost::system::error_code(),
+                "Invalid write size"));
+    //Fast path, the writers don't lock anything while there is room
+    if(lane.queue.reserve(size,slot)) return slot;
+    unique_lock<mutex> l(pimpl->writeQueueMutex);
+    //Bytes dropped behind the write in progress, free when it ends
+    size_t dropping=0;
+    while(!lane.queue.reserve(size,slot))
     {
-        lock_guard<mutex> l(pimpl->writeQueueMutex);
-        pimpl->writeQueue.insert(pimpl->writeQueue.end(),data.begin(),
-                data.end());
+        if(pimpl->writePolicy==WRITE_FAIL)
+        {
+            pimpl->writeStatistics.rejected++;
+            throw(boost::system::system_error(boost::system::error_code(),
+                    "Transmit queue full"));
+        }
+        //Make room with the frames of the lane not yet being written, if
+        //any, but no more than the slot needs
+        if(pimpl->writePolicy==WRITE_DROP_OLDEST && dropping<size)
+        {
+            size_t oldest=uint32_t(lane.queue.claimedBegin()+
+                    lane.queue.claimedFrames());
+            bool deferred=lane.queue.claimedFrames()>0;
+            size_t dropped=lane.queue.dropOldest();
+            if(dropped>0)
+            {
+                if(deferred) dropping+=dropped;
+                lane.commitTimes[oldest % lane.commitTimes.size()]=
+                        TxLane::droppedFrame;
+                pimpl->writeStatistics.dropped++;
+                continue;
+            }
+        }
+        //Waiting from the reactor threads would never free room
+        if(!isOpen() || errorStatus() ||
+                pimpl->strand->running_in_this_thread() ||
+                pimpl->reactor->runningInThisThread())
+            throw(boost::system::system_error(boost::system::error_code(),
+                    "Transmit buffer full"));
+        pimpl->writeQueueCond.wait(l);
+        dropping=0;
     }
-    pimpl->io.post(boost::bind(&AsyncSerial::doWrite, this));
+    return slot;
 }
 
-void AsyncSerial::writeString(const std::string& s)
+void AsyncSerial::writeCommit(const tx_slot_t& slot)
+{
+    TxLane& lane=pimpl->lanes[slot.lane];
+    lane.commitTimes[slot.index % lane.commitTimes.size()]=
+            pimpl->timestamps ? monotonicTime() : 0;
+    lane.queue.commit(slot);
+    pimpl->committedFrames.fetch_add(1,boost::memory_order_relaxed);
+    //Pairs with the fence in doWrite: either the write loop sees this frame
+    //or this writer sees the write loop idle
+    boost::atomic_thread_fence(boost::memory_order_seq_cst);
+    //Post doWrite only when the write loop goes from idle to busy
+    if(pimpl->writeScheduled.load(boost::memory_order_relaxed)) return;
+    size_t coalesceBytes=pimpl->coalesceBytes;
+    if(slot.lane==WRITE_PRIORITY_EMERGENCY || coalesceBytes==0 ||
+            pimpl->readyBytes()>=coalesceBytes)
+    {
+        if(pimpl->writeScheduled.exchange(true)) return;
+        if(!pimpl->beginWriterOperation())
+        {
+            pimpl->writeScheduled=false;
+            return;
+        }
+        pimpl->strand->post(makeRecyclingHandler(pimpl->writePostMemory,
+                boost::bind(&AsyncSerial::doWrite, this)));
+    } else if(pimpl->coalesceTimed && !pimpl->writeTimerArmed.exchange(true)) {
+        //Wait for more writes, at most coalesceDelay
+        if(!pimpl->beginWriterOperation())
+        {
+            pimpl->writeTimerArmed=false;
+            return;
+        }
+        pimpl->strand->post(makeRecyclingHandler(pimpl->writeTimerMemory,
+                boost::bind(&AsyncSerial::doWriteTimer, this)));
+    }
+}
+
+void AsyncSerial::setWriteQueueLimit(size_t bytes, size_t frames,
+        write_policy_t policy)
 {
     {
         lock_guard<mutex> l(pimpl->writeQueueMutex);
-        pimpl->writeQueue.insert(pimpl->writeQueue.end(),s.begin(),s.end());
+        for(int i=0;i<writePriorities;i++)
+            pimpl->lanes[i].queue.setLimit(bytes,frames);
+        pimpl->writePolicy=policy;
     }
-    pimpl->io.post(boost::bind(&AsyncSerial::doWrite, this));
+    pimpl->writeQueueCond.notify_all(); //Waiting writers may now fail
+}
+
+void AsyncSerial::setWriteQuantum(size_t bytes)
+{
+    lock_guard<mutex> l(pimpl->writeQueueMutex);
+    pimpl->writeQuantum=bytes;
+}
+
+void AsyncSerial::setWriteCoalescing(size_t bytes,
+        const posix_time::time_duration& delay)
+{
+    lock_guard<mutex> l(pimpl->writeQueueMutex);
+    pimpl->coalesceDelay=delay;
+    pimpl->coalesceTimed=!delay.is_special();
+    pimpl->coalesceBytes=bytes;
+}
+
+void AsyncSerial::flush()
+{
+    if(!pimpl->ready() || pimpl->writeScheduled.exchange(true))
+        return;
+    if(!pimpl->beginWriterOperation())
+    {
+        pimpl->writeScheduled=false;
+        return;
+    }
+    pimpl->strand->post(makeRecyclingHandler(pimpl->writePostMemory,
+            boost::bind(&AsyncSerial::doWrite, this)));
+}
+
+write_statistics_t AsyncSerial::writeStatistics() const
+{
+    lock_guard<mutex> l(pimpl->writeQueueMutex);
+    write_statistics_t result=pimpl->writeStatistics;
+    result.frames=pimpl->committedFrames;
+    for(int i=0;i<writePriorities;i++)
+    {
+        result.queued_bytes+=pimpl->lanes[i].queue.queuedBytes();
+        result.queued_frames+=pimpl->lanes[i].queue.queuedFrames();
+    }
+    return result;
 }
 
 AsyncSerial::~AsyncSerial()
@@ -174,11 +546,8 @@ AsyncSerial::~AsyncSerial()
 
 void AsyncSerial::doRead()
 {
-    pimpl->port.async_read_some(asio::buffer(pimpl->readBuffer,readBufferSize),
-            boost::bind(&AsyncSerial::readEnd,
-            this,
-            asio::placeholders::error,
-            asio::placeholders::bytes_transferred));
+    pimpl->transport->asyncReadSome(pimpl->readBuffer,readBufferSize,
+            pimpl->readHandler);
 }
 
 void AsyncSerial::readEnd(const boost::system::error_code& error,
@@ -202,7 +571,9 @@ void AsyncSerial::readEnd(const boost::system::error_code& error,
             doClose();
             setErrorStatus(true);
         }
+        pimpl->endOperation(); //End of the read loop
     } else {
+        if(pimpl->timestamps) pimpl->readTime=monotonicTime();
         if(pimpl->callback) pimpl->callback(pimpl->readBuffer,
                 bytes_transferred);
         doRead();
@@ -211,54 +582,114 @@ void AsyncSerial::readEnd(const boost::system::error_code& error,
 
 void AsyncSerial::doWrite()
 {
-    //If a write operation is already in progress, do nothing
-    if(pimpl->writeBuffer==0)
+    for(;;)
     {
-        lock_guard<mutex> l(pimpl->writeQueueMutex);
-        pimpl->writeBufferSize=pimpl->writeQueue.size();
-        pimpl->writeBuffer.reset(new char[pimpl->writeQueue.size()]);
-        copy(pimpl->writeQueue.begin(),pimpl->writeQueue.end(),
-                pimpl->writeBuffer.get());
-        pimpl->writeQueue.clear();
-        async_write(pimpl->port,asio::buffer(pimpl->writeBuffer.get(),
-                pimpl->writeBufferSize),
-                boost::bind(&AsyncSerial::writeEnd, this, asio::placeholders::error));
+        {
+            lock_guard<mutex> l(pimpl->writeQueueMutex);
+            const size_t maxSpans=
+                    sizeof(pimpl->writeBuffer)/sizeof(pimpl->writeBuffer[0]);
+            //The emergency lane is never held back by the quantum
+            size_t budget=pimpl->writeQuantum>0 ? pimpl->writeQuantum :
+                    size_t(-1);
+            pimpl->writeBufferCount=0;
+            for(int i=0;i<writePriorities;i++)
+            {
+                size_t first=pimpl->writeBufferCount;
+                if(first==maxSpans || budget==0) break;
+                pimpl->writeBufferCount+=pimpl->lanes[i].queue.claim(
+                        pimpl->writeBuffer+first,maxSpans-first,
+                        i==WRITE_PRIORITY_EMERGENCY ? size_t(-1) : budget);
+                for(size_t j=first;j<pimpl->writeBufferCount;j++)
+                {
+                    size_t size=asio::buffer_size(pimpl->writeBuffer[j]);
+                    pimpl->writeStatistics.bytes+=size;
+                    if(i!=WRITE_PRIORITY_EMERGENCY)
+                        budget-=std::min(budget,size);
+                }
+            }
+            if(pimpl->writeBufferCount>0) pimpl->writeStatistics.writes++;
+        }
+        if(pimpl->writeBufferCount>0) break;
+        //Nothing left to write, the write loop ends. A writer that committed
+        //while it still looked busy did not post doWrite, so look again
+        pimpl->writeScheduled=false;
+        boost::atomic_thread_fence(boost::memory_order_seq_cst);
+        if(!pimpl->ready() || pimpl->writeScheduled.exchange(true))
+        {
+            pimpl->endOperation();
+            return;
+        }
     }
+    //Data are sent straight from the transmit buffer
+    pimpl->transport->asyncWrite(TxBufferSequence(pimpl->writeBuffer,
+            pimpl->writeBuffer+pimpl->writeBufferCount),
+            pimpl->writeHandler);
 }
 
 void AsyncSerial::writeEnd(const boost::system::error_code& error)
 {
-    if(!error)
+    uint64_t now=pimpl->timestamps ? monotonicTime() : 0;
     {
         lock_guard<mutex> l(pimpl->writeQueueMutex);
-        if(pimpl->writeQueue.empty())
+        for(int i=0;i<writePriorities;i++)
         {
-            pimpl->writeBuffer.reset();
-            pimpl->writeBufferSize=0;
-            
-            return;
+            if(now!=0) pimpl->lanes[i].recordWriteTimes(now);
+            pimpl->lanes[i].queue.release();
         }
-        pimpl->writeBufferSize=pimpl->writeQueue.size();
-        pimpl->writeBuffer.reset(new char[pimpl->writeQueue.size()]);
-        copy(pimpl->writeQueue.begin(),pimpl->writeQueue.end(),
-                pimpl->writeBuffer.get());
-        pimpl->writeQueue.clear();
-        async_write(pimpl->port,asio::buffer(pimpl->writeBuffer.get(),
-                pimpl->writeBufferSize),
-                boost::bind(&AsyncSerial::writeEnd, this, asio::placeholders::error));
+    }
+    pimpl->writeQueueCond.notify_all();
+    if(!error)
+    {
+        //If there is more data to write, restart
+        doWrite();
     } else {
+        pimpl->writeScheduled=false;
         setErrorStatus(true);
         doClose();
+        pimpl->endOperation(); //End of the write loop
+    }
+}
+
+void AsyncSerial::doWriteTimer()
+{
+    {
+        lock_guard<mutex> l(pimpl->writeQueueMutex);
+        pimpl->writeTimer->expires_from_now(pimpl->coalesceDelay);
+    }
+    pimpl->writeTimer->async_wait(makeRecyclingHandler(
+            pimpl->writeTimerMemory,pimpl->strand->wrap(boost::bind(
+            &AsyncSerial::writeTimerEnd, this, asio::placeholders::error))));
+}
+
+void AsyncSerial::writeTimerEnd(const boost::system::error_code& error)
+{
+    pimpl->writeTimerArmed=false;
+    boost::atomic_thread_fence(boost::memory_order_seq_cst);
+    //The write loop may have been started by the bytes threshold
+    if(!error && isOpen() && pimpl->ready() &&
+            !pimpl->writeScheduled.exchange(true))
+    {
+        pimpl->beginOperation();
+        doWrite();
     }
+    pimpl->endOperation(); //End of the timer
 }
 
 void AsyncSerial::doClose()
 {
     boost::system::error_code ec;
-    pimpl->port.cancel(ec);
+    pimpl->writeTimer->cancel(ec);
+    pimpl->transport->cancel(ec);
     if(ec) setErrorStatus(true);
-    pimpl->port.close(ec);
+    pimpl->transport->close(ec);
     if(ec) setErrorStatus(true);
+    pimpl->writeQueueCond.notify_all();
+}
+
+void AsyncSerial::closeEnd()
+{
+    doClose();
+    pimpl->endOperation();
 }
 
 void AsyncSerial::setErrorStatus(bool e)
@@ -288,7 +719,11 @@ void AsyncSerial::clearReadCallback()
 class AsyncSerialImpl: private boost::noncopyable
 {
 public:
-    AsyncSerialImpl(): backgroundThread(), open(false), error(false) {}
+    AsyncSerialImpl(): backgroundThread(), open(false), error(false),
+            timestamps(false), readTime(0)
+    {
+        memset(&writeStatistics,0,sizeof(writeStatistics));
+    }
 
     boost::thread backgroundThread; ///< Thread that runs read operations
     bool open; ///< True if port open
@@ -296,6 +731,15 @@ public:
     mutable boost::mutex errorMutex; ///< Mutex for access to error
 
     int fd; ///< File descriptor for serial port
+
+    /// Slots reserved with writeReserve
+    TxLane lanes[AsyncSerial::writePriorities];
+    boost::mutex writeQueueMutex; ///< Mutex for access to the lanes
+    write_statistics_t writeStatistics; ///< Transmit counters
+    bool timestamps; ///< True if timestamps are recorded
+    uint64_t readTime; ///< When the data in readBuffer were received
+
+    boost::asio::io_service io; ///< Only to build transports, not supported
     
     char readBuffer[AsyncSerial::readBufferSize]; ///< data being read
 
@@ -409,11 +853,28 @@ void AsyncSerial::open(const std::string& devname, unsigned int baud_rate,
     pimpl->backgroundThread.swap(t);
 }
 
+void AsyncSerial::open(boost::shared_ptr<SerialTransport> transport)
+{
+    throw(boost::system::system_error(boost::system::error_code(),
+            "Transports are not supported on this platform"));
+}
+
+void AsyncSerial::setReactor(boost::shared_ptr<SerialReactor> reactor)
+{
+    throw(boost::system::system_error(boost::system::error_code(),
+            "Reactors are not supported on this platform"));
+}
+
 bool AsyncSerial::isOpen() const
 {
     return pimpl->open;
 }
 
+asio::io_service& AsyncSerial::ioService()
+{
+    return pimpl->io;
+}
+
 bool AsyncSerial::errorStatus() const
 {
     lock_guard<mutex> l(pimpl->errorMutex);
@@ -436,8 +897,10 @@ void AsyncSerial::close()
     }
 }
 
-void AsyncSerial::write(const char *data, size_t size)
+void AsyncSerial::write(const char *data, size_t size,
+        write_priority_t priority)
 {
+    //Writes are synchronous, there is nothing to overtake
     if(::write(pimpl->fd,data,size)!=size) setErrorStatus(true);
 }
 
@@ -452,6 +915,86 @@ void AsyncSerial::writeString(const std::string& s)
     if(::write(pimpl->fd,&s[0],s.size())!=s.size()) setErrorStatus(true);
 }
 
+tx_slot_t AsyncSerial::writeReserve(size_t size, write_priority_t priority)
+{
+    TxLane& lane=writeLane(pimpl->lanes,priority);
+    tx_slot_t slot;
+    lock_guard<mutex> l(pimpl->writeQueueMutex);
+    if(!lane.queue.reserve(size,slot))
+        throw(boost::system::system_error(boost::system::error_code(),
+                "Transmit buffer full"));
+    slot.lane=priority;
+    return slot;
+}
+
+void AsyncSerial::writeCommit(const tx_slot_t& slot)
+{
+    //Writes are synchronous, send all the committed slots now, the higher
+    //lanes first
+    lock_guard<mutex> l(pimpl->writeQueueMutex);
+    TxLane& lane=pimpl->lanes[slot.lane];
+    lane.commitTimes[slot.index % lane.commitTimes.size()]=
+            pimpl->timestamps ? monotonicTime() : 0;
+    lane.queue.commit(slot);
+    pimpl->writeStatistics.frames++;
+    for(int j=0;j<writePriorities;j++)
+    {
+        asio::const_buffer spans[16];
+        size_t count;
+        while((count=pimpl->lanes[j].queue.claim(spans,16))>0)
+        {
+            for(size_t i=0;i<count;i++)
+            {
+                size_t size=asio::buffer_size(spans[i]);
+                if(::write(pimpl->fd,asio::buffer_cast<const char*>(spans[i]),
+                        size)!=size) setErrorStatus(true);
+                pimpl->writeStatistics.writes++;
+                pimpl->writeStatistics.bytes+=size;
+            }
+            if(pimpl->timestamps)
+                pimpl->lanes[j].recordWriteTimes(monotonicTime());
+            pimpl->lanes[j].queue.release();
+        }
+    }
+}
+
+void AsyncSerial::setWriteQueueLimit(size_t bytes, size_t frames,
+        write_policy_t policy)
+{
+    //Writes are synchronous, the queue never holds more than one write
+    lock_guard<mutex> l(pimpl->writeQueueMutex);
+    for(int i=0;i<writePriorities;i++)
+        pimpl->lanes[i].queue.setLimit(bytes,frames);
+}
+
+void AsyncSerial::setWriteQuantum(size_t bytes)
+{
+    //Writes are synchronous, a write never waits for another
+}
+
+void AsyncSerial::setWriteCoalescing(size_t bytes,
+        const posix_time::time_duration& delay)
+{
+    //Writes are synchronous, nothing to coalesce
+}
+
+void AsyncSerial::flush()
+{
+    //Writes are synchronous, nothing to flush
+}
+
+write_statistics_t AsyncSerial::writeStatistics() const
+{
+    lock_guard<mutex> l(pimpl->writeQueueMutex);
+    write_statistics_t result=pimpl->writeStatistics;
+    for(int i=0;i<writePriorities;i++)
+    {
+        result.queued_bytes+=pimpl->lanes[i].queue.queuedBytes();
+        result.queued_frames+=pimpl->lanes[i].queue.queuedFrames();
+    }
+    return result;
+}
+
 AsyncSerial::~AsyncSerial()
 {
     if(isOpen())
@@ -479,6 +1022,7 @@ void AsyncSerial::doRead()
                 continue;
             }
         }
+        if(pimpl->timestamps) pimpl->readTime=monotonicTime();
         if(pimpl->callback) pimpl->callback(pimpl->readBuffer, received);
     }
 }
@@ -504,6 +1048,21 @@ void AsyncSerial::doClose()
     //Not used
 }
 
+void AsyncSerial::closeEnd()
+{
+    //Not used
+}
+
+void AsyncSerial::doWriteTimer()
+{
+    //Not used
+}
+
+void AsyncSerial::writeTimerEnd(const boost::system::error_code& error)
+{
+    //Not used
+}
+
 void AsyncSerial::setErrorStatus(bool e)
 {
     lock_guard<mutex> l(pimpl->errorMutex);
@@ -523,6 +1082,50 @@ void AsyncSerial::clearReadCallback()
 
 #endif //__APPLE__
 
+void AsyncSerial::setTimestamps(bool enable)
+{
+    lock_guard<mutex> l(pimpl->writeQueueMutex);
+    pimpl->timestamps=enable;
+}
+
+uint64_t AsyncSerial::writeTimestamp(size_t sequence,
+        write_priority_t priority) const
+{
+    const TxLane& lane=writeLane(pimpl->lanes,priority);
+    lock_guard<mutex> l(pimpl->writeQueueMutex);
+    const std::pair<size_t, uint64_t>& entry=
+            lane.writeTimes[sequence % lane.writeTimes.size()];
+    return entry.first==sequence ? entry.second : 0;
+}
+
+write_lane_statistics_t AsyncSerial::writeLaneStatistics(
+        write_priority_t priority) const
+{
+    const TxLane& lane=writeLane(pimpl->lanes,priority);
+    lock_guard<mutex> l(pimpl->writeQueueMutex);
+    return lane.statistics;
+}
+
+uint64_t AsyncSerial::readTimestamp() const
+{
+    return pimpl->readTime;
+}
+
+uint64_t AsyncSerial::monotonicTime()
+{
+    #ifdef _WIN32
+    LARGE_INTEGER count, frequency;
+    QueryPerformanceCounter(&count);
+    QueryPerformanceFrequency(&frequency);
+    return count.QuadPart/frequency.QuadPart*1000000+
+            count.QuadPart%frequency.QuadPart*1000000/frequency.QuadPart;
+    #else //_WIN32
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC,&now);
+    return uint64_t(now.tv_sec)*1000000+now.tv_nsec/1000;
+    #endif //_WIN32
+}
+
 //
 //Class CallbackAsyncSerial
 //
@@ -0,0 +1,62 @@
+/*
+ * Copyright (C) 2014 Officine Robotiche
+ * Author: Raffaello Bonghi
+ * email:  raffaello.bonghi@officinerobotiche.it
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the GNU Lesser General Public License
+ * (LGPL) version 2.1 which accompanies this distribution, and is available at
+ * http://www.gnu.org/licenses/lgpl-2.1.html
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#include "serial_parser_packet/FragmentAssembler.h"
+#include <cstring>
+
+FragmentAssembler::FragmentAssembler() : buffer(FRAGMENT_MESSAGE), length(0), active(false),
+sequence(0), next(0), last(0) {
+}
+
+bool FragmentAssembler::add(const packet_t& fragment, unsigned int& lost) {
+    if (fragment.length < FRAGMENT_HEAD) {
+        if (reset())
+            lost++;
+        return false;
+    }
+    unsigned char fragment_sequence = fragment.buffer[0];
+    unsigned char index = fragment.buffer[1];
+    unsigned char fragment_last = fragment.buffer[2];
+    if (index == 0) {
+        //A new message, the previous one is lost if not complete
+        if (reset())
+            lost++;
+        active = true;
+        sequence = fragment_sequence;
+        last = fragment_last;
+        next = 0;
+        length = 0;
+    } else if (!active || fragment_sequence != sequence || fragment_last != last || index != next) {
+        //A fragment is missing: drop the message, and the rest of it
+        if (reset())
+            lost++;
+        return false;
+    }
+    size_t size = fragment.length - FRAGMENT_HEAD;
+    memcpy(&buffer[length], &fragment.buffer[FRAGMENT_HEAD], size);
+    length += size;
+    if (index == last) {
+        active = false;
+        return true;
+    }
+    next++;
+    return false;
+}
+
+bool FragmentAssembler::reset() {
+    bool was_active = active;
+    active = false;
+    return was_active;
+}
@@ -0,0 +1,326 @@
+/*
+ * Copyright (C) 2014 Officine Robotiche
+ * Author: Raffaello Bonghi
+ * email:  raffaello.bonghi@officinerobotiche.it
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the GNU Lesser General Public License
+ * (LGPL) version 2.1 which accompanies this distribution, and is available at
+ * http://www.gnu.org/licenses/lgpl-2.1.html
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#include "serial_parser_packet/FrameChecksum.h"
+
+#include <cstring>
+#include <algorithm>
+#include <boost/cstdint.hpp>
+#include <boost/thread/once.hpp>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define FRAME_CHECKSUM_X86
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+typedef unsigned char (*checksum_kernel_t)(const unsigned char*, size_t);
+
+/**
+ * Adds eight bytes at a time: the even and the odd bytes of a word are
+ * summed in four 16 bit lanes, that can't carry into each other for 128
+ * words.
+ */
+static unsigned char checksumPortable(const unsigned char* data, size_t size) {
+    const boost::uint64_t mask = 0x00FF00FF00FF00FFULL;
+    unsigned int sum = 0;
+    while (size >= 8) {
+        size_t words = std::min<size_t>(size / 8, 128);
+        boost::uint64_t lanes = 0;
+        for (size_t i = 0; i < words; ++i) {
+            boost::uint64_t word;
+            memcpy(&word, data, sizeof (word));
+            lanes += (word & mask) + ((word >> 8) & mask);
+            data += 8;
+        }
+        size -= words * 8;
+        sum += (unsigned int) ((lanes & 0xFFFF) + ((lanes >> 16) & 0xFFFF) +
+                ((lanes >> 32) & 0xFFFF) + (lanes >> 48));
+    }
+    while (size-- > 0)
+        sum += *data++;
+    return (unsigned char) sum;
+}
+
+#ifdef FRAME_CHECKSUM_X86
+
+/**
+ * PSADBW adds sixteen bytes into two 64 bit lanes
+ */
+__attribute__((target("sse2")))
+static unsigned char checksumSse2(const unsigned char* data, size_t size) {
+    const __m128i zero = _mm_setzero_si128();
+    __m128i lanes = zero;
+    for (; size >= 16; data += 16, size -= 16)
+        lanes = _mm_add_epi64(lanes, _mm_sad_epu8(_mm_loadu_si128((const __m128i*) data), zero));
+    unsigned int sum = _mm_cvtsi128_si32(lanes) + _mm_cvtsi128_si32(_mm_srli_si128(lanes, 8));
+    while (size-- > 0)
+        sum += *data++;
+    return (unsigned char) sum;
+}
+
+/**
+ * VPSADBW adds thirty-two bytes into four 64 bit lanes
+ */
+__attribute__((target("avx2")))
+static unsigned char checksumAvx2(const unsigned char* data, size_t size) {
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i lanes = zero;
+    for (; size >= 32; data += 32, size -= 32)
+        lanes = _mm256_add_epi64(lanes, _mm256_sad_epu8(_mm256_loadu_si256((const __m256i*) data), zero));
+    __m128i half = _mm_add_epi64(_mm256_castsi256_si128(lanes), _mm256_extracti128_si256(lanes, 1));
+    unsigned int sum = _mm_cvtsi128_si32(half) + _mm_cvtsi128_si32(_mm_srli_si128(half, 8));
+    //The compiler doesn't always clear the upper halves on return, the SSE
+    //code of the caller would pay a transition for each frame
+    _mm256_zeroupper();
+    if (size >= 16) {
+        half = _mm_sad_epu8(_mm_loadu_si128((const __m128i*) data), _mm_setzero_si128());
+        sum += _mm_cvtsi128_si32(half) + _mm_cvtsi128_si32(_mm_srli_si128(half, 8));
+        data += 16;
+        size -= 16;
+    }
+    while (size-- > 0)
+        sum += *data++;
+    return (unsigned char) sum;
+}
+
+#endif
+
+static const char* kernel_name = "portable";
+static checksum_kernel_t checksum_kernel = NULL;
+static boost::once_flag checksum_kernel_once = BOOST_ONCE_INIT;
+
+static void selectKernel() {
+    checksum_kernel = &checksumPortable;
+#ifdef FRAME_CHECKSUM_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        kernel_name = "avx2";
+        checksum_kernel = &checksumAvx2;
+    } else if (__builtin_cpu_supports("sse2")) {
+        kernel_name = "sse2";
+        checksum_kernel = &checksumSse2;
+    }
+#endif
+}
+
+/**
+ * Selected at the first call, a frame may be sealed by the static
+ * initializer of another unit, before the statics of this one. The once
+ * flag is initialized statically and, unlike a local static, call_once is
+ * thread safe with the C++03 compilers too.
+ */
+static checksum_kernel_t checksumKernel() {
+    boost::call_once(checksum_kernel_once, selectKernel);
+    return checksum_kernel;
+}
+
+unsigned char frameChecksum(const unsigned char* data, size_t size) {
+    return checksumKernel()(data, size);
+}
+
+const char* frameChecksumKernel() {
+    checksumKernel();
+    return kernel_name;
+}
+
+/**
+ * Tables of a reflected CRC for slicing-by-8: table[0] is the classic byte
+ * table, table[n] advances a byte through n more zero bytes. Without a
+ * constructor a static instance is zero-initialized before any code runs.
+ */
+template <class Crc>
+class CrcTables {
+public:
+
+    void build(Crc polynomial) {
+        for (unsigned int i = 0; i < 256; ++i) {
+            Crc crc = i;
+            for (int bit = 0; bit < 8; ++bit)
+                crc = (crc & 1) ? (crc >> 1) ^ polynomial : crc >> 1;
+            table[0][i] = crc;
+        }
+        for (unsigned int i = 0; i < 256; ++i) {
+            for (int n = 1; n < 8; ++n)
+                table[n][i] = (table[n - 1][i] >> 8) ^ table[0][table[n - 1][i] & 0xFF];
+        }
+    }
+
+    Crc update(const unsigned char* data, size_t size, Crc crc) const {
+        for (; size >= 8; data += 8, size -= 8) {
+            boost::uint32_t low = crc ^ (data[0] | (data[1] << 8) | (data[2] << 16) | ((boost::uint32_t) data[3] << 24));
+            boost::uint32_t high = data[4] | (data[5] << 8) | (data[6] << 16) | ((boost::uint32_t) data[7] << 24);
+            crc = table[7][low & 0xFF] ^ table[6][(low >> 8) & 0xFF] ^
+                    table[5][(low >> 16) & 0xFF] ^ table[4][low >> 24] ^
+                    table[3][high & 0xFF] ^ table[2][(high >> 8) & 0xFF] ^
+                    table[1][(high >> 16) & 0xFF] ^ table[0][high >> 24];
+        }
+        while (size-- > 0)
+            crc = table[0][(crc ^ *data++) & 0xFF] ^ (crc >> 8);
+        return crc;
+    }
+
+private:
+    Crc table[8][256];
+};
+
+static CrcTables<boost::uint16_t> crc16_tables;
+static CrcTables<boost::uint32_t> crc32c_tables;
+static boost::once_flag crc_tables_once = BOOST_ONCE_INIT;
+
+static void buildCrcTables() {
+    crc16_tables.build(0xA001);
+    crc32c_tables.build(0x82F63B78);
+}
+
+/**
+ * The tables are built at the first call, as the checksum kernel
+ */
+static const CrcTables<boost::uint16_t>& crc16Tables() {
+    boost::call_once(crc_tables_once, buildCrcTables);
+    return crc16_tables;
+}
+
+static const CrcTables<boost::uint32_t>& crc32cTables() {
+    boost::call_once(crc_tables_once, buildCrcTables);
+    return crc32c_tables;
+}
+
+typedef boost::uint16_t(*crc16_kernel_t)(const unsigned char*, size_t, boost::uint16_t);
+
+static boost::uint16_t crc16Slicing(const unsigned char* data, size_t size, boost::uint16_t crc) {
+    return crc16Tables().update(data, size, crc);
+}
+
+#ifdef FRAME_CHECKSUM_X86
+
+/**
+ * Folds sixteen bytes at a time with carry-less multiplications. A block X
+ * followed by the block Y is congruent to X.high * (x^192 mod P) +
+ * X.low * (x^128 mod P) + Y, products of less than 80 bits: the last block
+ * keeps the CRC of all the blocks and the tables finish it with the tail.
+ * The bytes are reflected, so each constant is x^(n-1) mod P reflected over
+ * 64 bits: the product comes out one degree short.
+ */
+__attribute__((target("pclmul,sse2")))
+static boost::uint16_t crc16Pclmul(const unsigned char* data, size_t size, boost::uint16_t crc) {
+    if (size < 32)
+        return crc16Slicing(data, size, crc);
+    // x^191 mod P for the high half, x^127 mod P for the low half
+    const __m128i constants = _mm_set_epi64x(0xC100000000000000LL, 0xCCD0000000000000LL);
+    // The register of a reflected CRC starts xored into the first bytes
+    __m128i block = _mm_xor_si128(_mm_loadu_si128((const __m128i*) data), _mm_cvtsi32_si128(crc));
+    for (data += 16, size -= 16; size >= 16; data += 16, size -= 16) {
+        __m128i high = _mm_clmulepi64_si128(block, constants, 0x00);
+        __m128i low = _mm_clmulepi64_si128(block, constants, 0x11);
+        block = _mm_xor_si128(_mm_xor_si128(high, low), _mm_loadu_si128((const __m128i*) data));
+    }
+    unsigned char last[16];
+    _mm_storeu_si128((__m128i*) last, block);
+    return crc16Slicing(data, size, crc16Slicing(last, sizeof (last), 0));
+}
+
+#endif
+
+static const char* crc16_kernel_name = "slicing-by-8";
+static crc16_kernel_t crc16_kernel = NULL;
+static boost::once_flag crc16_kernel_once = BOOST_ONCE_INIT;
+
+static void selectCrc16Kernel() {
+    crc16_kernel = &crc16Slicing;
+#ifdef FRAME_CHECKSUM_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("pclmul")) {
+        crc16_kernel_name = "pclmul";
+        crc16_kernel = &crc16Pclmul;
+    }
+#endif
+}
+
+static crc16_kernel_t crc16Kernel() {
+    boost::call_once(crc16_kernel_once, selectCrc16Kernel);
+    return crc16_kernel;
+}
+
+uint16_t frameCrc16(const unsigned char* data, size_t size, uint16_t crc) {
+    return crc16Kernel()(data, size, crc);
+}
+
+const char* frameCrc16Kernel() {
+    crc16Kernel();
+    return crc16_kernel_name;
+}
+
+typedef boost::uint32_t(*crc32c_kernel_t)(const unsigned char*, size_t, boost::uint32_t);
+
+static boost::uint32_t crc32cSlicing(const unsigned char* data, size_t size, boost::uint32_t crc) {
+    return ~crc32cTables().update(data, size, ~crc);
+}
+
+#ifdef FRAME_CHECKSUM_X86
+
+__attribute__((target("sse4.2")))
+static boost::uint32_t crc32cSse42(const unsigned char* data, size_t size, boost::uint32_t crc) {
+    crc = ~crc;
+#ifdef __x86_64__
+    boost::uint64_t crc64 = crc;
+    for (; size >= 8; data += 8, size -= 8) {
+        boost::uint64_t word;
+        memcpy(&word, data, sizeof (word));
+        crc64 = _mm_crc32_u64(crc64, word);
+    }
+    crc = (boost::uint32_t) crc64;
+#endif
+    for (; size >= 4; data += 4, size -= 4) {
+        boost::uint32_t word;
+        memcpy(&word, data, sizeof (word));
+        crc = _mm_crc32_u32(crc, word);
+    }
+    while (size-- > 0)
+        crc = _mm_crc32_u8(crc, *data++);
+    return ~crc;
+}
+
+#endif
+
+static const char* crc32c_kernel_name = "slicing-by-8";
+static crc32c_kernel_t crc32c_kernel = NULL;
+static boost::once_flag crc32c_kernel_once = BOOST_ONCE_INIT;
+
+static void selectCrc32cKernel() {
+    crc32c_kernel = &crc32cSlicing;
+#ifdef FRAME_CHECKSUM_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.2")) {
+        crc32c_kernel_name = "sse4.2";
+        crc32c_kernel = &crc32cSse42;
+    }
+#endif
+}
+
+static crc32c_kernel_t crc32cKernel() {
+    boost::call_once(crc32c_kernel_once, selectCrc32cKernel);
+    return crc32c_kernel;
+}
+
+uint32_t frameCrc32c(const unsigned char* data, size_t size, uint32_t crc) {
+    return crc32cKernel()(data, size, crc);
+}
+
+const char* frameCrc32cKernel() {
+    crc32cKernel();
+    return crc32c_kernel_name;
+}
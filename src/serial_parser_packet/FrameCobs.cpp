@@ -0,0 +1,87 @@
+/*
+ * Copyright (C) 2014 Officine Robotiche
+ * Author: Raffaello Bonghi
+ * email:  raffaello.bonghi@officinerobotiche.it
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the GNU Lesser General Public License
+ * (LGPL) version 2.1 which accompanies this distribution, and is available at
+ * http://www.gnu.org/licenses/lgpl-2.1.html
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#include "serial_parser_packet/FrameCobs.h"
+#include <algorithm>
+#include <cstring>
+
+size_t cobsEncode(const unsigned char* data, size_t size, unsigned char* out) {
+    //The code of a block is written when the block ends, in the byte kept
+    //for it before its data
+    unsigned char* code = out;
+    unsigned char* next = out + 1;
+    unsigned char distance = 1;
+    for (const unsigned char* end = data + size; data < end; ++data) {
+        if (*data == 0) {
+            *code = distance;
+            code = next++;
+            distance = 1;
+            continue;
+        }
+        *next++ = *data;
+        if (++distance == 0xFF) {
+            *code = distance;
+            code = next++;
+            distance = 1;
+        }
+    }
+    *code = distance;
+    return next - out;
+}
+
+const unsigned char* CobsDecoder::decode(const unsigned char* data, const unsigned char* end, bool& ended) {
+    ended = false;
+    while (data < end) {
+        if (remaining == 0) {
+            unsigned char code = *data++;
+            if (code == COBS_DELIMITER) {
+                ended = true;
+                return data;
+            }
+            if (zero) {
+                const unsigned char zero_byte = 0;
+                append(&zero_byte, 1);
+            }
+            started = true;
+            remaining = code - 1;
+            zero = (code != 0xFF);
+            continue;
+        }
+        //Copy the block as far as these bytes hold, a zero in it is the
+        //delimiter of a frame broken by noise
+        size_t span = std::min<size_t>(end - data, remaining);
+        const unsigned char* delimiter = static_cast<const unsigned char*> (memchr(data, COBS_DELIMITER, span));
+        if (delimiter != NULL)
+            span = delimiter - data;
+        append(data, span);
+        data += span;
+        remaining -= span;
+        if (delimiter != NULL) {
+            cut = true;
+            ended = true;
+            return data + 1;
+        }
+    }
+    return end;
+}
+
+void CobsDecoder::append(const unsigned char* data, size_t size) {
+    if (size > capacity - length) {
+        size = capacity - length;
+        overflow = true;
+    }
+    memcpy(&buffer[length], data, size);
+    length += size;
+}
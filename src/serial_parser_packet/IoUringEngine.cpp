@@ -0,0 +1,463 @@
+/*
+ * Copyright (C) 2014 Officine Robotiche
+ * Author: Raffaello Bonghi
+ * email:  raffaello.bonghi@officinerobotiche.it
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the GNU Lesser General Public License
+ * (LGPL) version 2.1 which accompanies this distribution, and is available at
+ * http://www.gnu.org/licenses/lgpl-2.1.html
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#ifdef __linux__
+
+#include "serial_parser_packet/IoUringEngine.h"
+
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+#include <boost/bind.hpp>
+
+using namespace std;
+using namespace boost;
+
+/// user_data of the entries without an operation
+#define USER_DATA_NONE 0
+/// user_data of the entry that wakes up the engine thread to stop it
+#define USER_DATA_STOP 1
+
+static void throwErrno(int error, const char* what) {
+    throw (boost::system::system_error(boost::system::error_code(error,
+            boost::system::system_category()), what));
+}
+
+/*
+ * The rings are shared with the kernel: the indexes written by the kernel
+ * are read with acquire, the indexes read by the kernel are written with
+ * release.
+ */
+static unsigned int loadAcquire(const unsigned int* p) {
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+static void storeRelease(unsigned int* p, unsigned int value) {
+    __atomic_store_n(p, value, __ATOMIC_RELEASE);
+}
+
+IoUringEngine::IoUringEngine(const io_uring_engine_options_t& engine_options) : options(engine_options),
+ring_fd(-1), sq_ring(MAP_FAILED), cq_ring(MAP_FAILED), sqes(MAP_FAILED), sq_local_tail(0), unsubmitted(0),
+waiting(false), stop(false), registered(false) {
+    memset(&stats, 0, sizeof (stats));
+
+    struct io_uring_params params;
+    memset(&params, 0, sizeof (params));
+    if (options.sqpoll) {
+        params.flags |= IORING_SETUP_SQPOLL;
+        params.sq_thread_idle = options.sqpoll_idle;
+    }
+    ring_fd = syscall(__NR_io_uring_setup, options.entries, &params);
+    if (ring_fd < 0)
+        throwErrno(errno, "Failed to create io_uring");
+
+    sq_ring_size = params.sq_off.array + params.sq_entries * sizeof (unsigned int);
+    cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof (struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+        sq_ring_size = cq_ring_size = std::max(sq_ring_size, cq_ring_size);
+    sqes_size = params.sq_entries * sizeof (struct io_uring_sqe);
+
+    sq_ring = mmap(NULL, sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+    if (sq_ring != MAP_FAILED) {
+        if (params.features & IORING_FEAT_SINGLE_MMAP)
+            cq_ring = sq_ring;
+        else
+            cq_ring = mmap(NULL, cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+    }
+    if (cq_ring != MAP_FAILED)
+        sqes = mmap(NULL, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) {
+        int error = errno;
+        if (cq_ring != MAP_FAILED && cq_ring != sq_ring)
+            munmap(cq_ring, cq_ring_size);
+        if (sq_ring != MAP_FAILED)
+            munmap(sq_ring, sq_ring_size);
+        ::close(ring_fd);
+        throwErrno(error, "Failed to map io_uring");
+    }
+
+    char* sq = static_cast<char*> (sq_ring);
+    sq_head = reinterpret_cast<unsigned int*> (sq + params.sq_off.head);
+    sq_tail = reinterpret_cast<unsigned int*> (sq + params.sq_off.tail);
+    sq_mask = reinterpret_cast<unsigned int*> (sq + params.sq_off.ring_mask);
+    sq_flags = reinterpret_cast<unsigned int*> (sq + params.sq_off.flags);
+    sq_array = reinterpret_cast<unsigned int*> (sq + params.sq_off.array);
+    sq_entries = params.sq_entries;
+    sq_local_tail = *sq_tail;
+    // The entries are always used in ring order
+    for (unsigned int i = 0; i < sq_entries; ++i)
+        sq_array[i] = i;
+
+    char* cq = static_cast<char*> (cq_ring);
+    cq_head = reinterpret_cast<unsigned int*> (cq + params.cq_off.head);
+    cq_tail = reinterpret_cast<unsigned int*> (cq + params.cq_off.tail);
+    cq_mask = reinterpret_cast<unsigned int*> (cq + params.cq_off.ring_mask);
+    cqes = cq + params.cq_off.cqes;
+
+    // Registered read buffers, without them reads still work
+    if (options.buffers > 0 && options.buffer_size > 0) {
+        buffer_memory.resize(options.buffers * options.buffer_size);
+        buffer_used.resize(options.buffers, false);
+        vector<struct iovec> iovecs(options.buffers);
+        for (unsigned int i = 0; i < options.buffers; ++i) {
+            iovecs[i].iov_base = &buffer_memory[i * options.buffer_size];
+            iovecs[i].iov_len = options.buffer_size;
+        }
+        registered = syscall(__NR_io_uring_register, ring_fd, IORING_REGISTER_BUFFERS,
+                &iovecs[0], options.buffers) == 0;
+    }
+    stats.registered_buffers = registered;
+
+    engine_thread.reset(new thread(boost::bind(&IoUringEngine::run, this)));
+}
+
+IoUringEngine::~IoUringEngine() {
+    {
+        unique_lock<mutex> l(ringMutex);
+        stop = true;
+        unsigned int index = reserveEntries(l, 1);
+        struct io_uring_sqe* sqe = static_cast<struct io_uring_sqe*> (entry(index));
+        sqe->opcode = IORING_OP_NOP;
+        sqe->user_data = USER_DATA_STOP;
+        publishEntries(1);
+    }
+    engine_thread->join();
+    munmap(sqes, sqes_size);
+    if (cq_ring != sq_ring)
+        munmap(cq_ring, cq_ring_size);
+    munmap(sq_ring, sq_ring_size);
+    ::close(ring_fd);
+}
+
+int IoUringEngine::acquireBuffer(char*& data) {
+    lock_guard<mutex> l(ringMutex);
+    if (!registered) {
+        data = NULL;
+        return -1;
+    }
+    vector<bool>::iterator it = std::find(buffer_used.begin(), buffer_used.end(), false);
+    if (it == buffer_used.end())
+        throw (boost::system::system_error(boost::system::error_code(), "No io_uring buffer available"));
+    *it = true;
+    int index = it - buffer_used.begin();
+    data = &buffer_memory[index * options.buffer_size];
+    return index;
+}
+
+void IoUringEngine::releaseBuffer(int index) {
+    lock_guard<mutex> l(ringMutex);
+    if (index >= 0)
+        buffer_used[index] = false;
+}
+
+void IoUringEngine::read(IoUringOperation* op, int fd, char* data, size_t size, int index) {
+    unique_lock<mutex> l(ringMutex);
+    struct io_uring_sqe* sqe = static_cast<struct io_uring_sqe*> (entry(reserveEntries(l, 1)));
+    sqe->opcode = index >= 0 ? IORING_OP_READ_FIXED : IORING_OP_READ;
+    sqe->fd = fd;
+    sqe->off = (__u64) - 1; // Current position, the devices are not seekable
+    sqe->addr = reinterpret_cast<__u64> (data);
+    sqe->len = size;
+    sqe->buf_index = index >= 0 ? index : 0;
+    sqe->user_data = reinterpret_cast<__u64> (op);
+    publishEntries(1);
+}
+
+void IoUringEngine::write(IoUringOperation* op, int fd, const asio::const_buffer* buffers, size_t count) {
+    // A chain must be submitted all together, it would never fit otherwise
+    if (count > sq_entries)
+        throw (boost::system::system_error(boost::system::error_code(), "io_uring write chain too long"));
+    unique_lock<mutex> l(ringMutex);
+    if (count == 0) {
+        // Nothing to write, complete with 0 bytes from the engine thread
+        struct io_uring_sqe* sqe = static_cast<struct io_uring_sqe*> (entry(reserveEntries(l, 1)));
+        sqe->opcode = IORING_OP_NOP;
+        sqe->fd = -1;
+        sqe->user_data = reinterpret_cast<__u64> (op);
+        publishEntries(1);
+        return;
+    }
+    unsigned int index = reserveEntries(l, count);
+    for (size_t i = 0; i < count; ++i) {
+        struct io_uring_sqe* sqe = static_cast<struct io_uring_sqe*> (entry(index + i));
+        sqe->opcode = IORING_OP_WRITE;
+        sqe->fd = fd;
+        sqe->off = (__u64) - 1;
+        sqe->addr = reinterpret_cast<__u64> (asio::buffer_cast<const char*>(buffers[i]));
+        sqe->len = asio::buffer_size(buffers[i]);
+        if (i + 1 < count)
+            sqe->flags = IOSQE_IO_LINK;
+        sqe->user_data = reinterpret_cast<__u64> (op);
+    }
+    publishEntries(count);
+}
+
+void IoUringEngine::cancel(IoUringOperation* op) {
+    unique_lock<mutex> l(ringMutex);
+    struct io_uring_sqe* sqe = static_cast<struct io_uring_sqe*> (entry(reserveEntries(l, 1)));
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = reinterpret_cast<__u64> (op);
+#ifdef IORING_ASYNC_CANCEL_ALL
+    sqe->cancel_flags = IORING_ASYNC_CANCEL_ALL;
+#endif
+    sqe->user_data = USER_DATA_NONE;
+    publishEntries(1);
+}
+
+io_uring_statistics_t IoUringEngine::statistics() const {
+    lock_guard<mutex> l(ringMutex);
+    return stats;
+}
+
+io_uring_engine_options_t IoUringEngine::defaultOptions() {
+    io_uring_engine_options_t options;
+    options.entries = 256;
+    options.buffers = 16;
+    options.buffer_size = 512;
+    options.sqpoll = false;
+    options.sqpoll_idle = 1000;
+    return options;
+}
+
+void IoUringEngine::run() {
+    unique_lock<mutex> l(ringMutex);
+    while (!stop) {
+        // The entries published while the completions were handled go with the wait
+        unsigned int to_submit = options.sqpoll ? 0 : unsubmitted;
+        unsubmitted = 0;
+        if (to_submit > 0)
+            stats.submit_calls++;
+        stats.wait_calls++;
+        waiting = true;
+        l.unlock();
+        enter(to_submit, 1, IORING_ENTER_GETEVENTS);
+        l.lock();
+        waiting = false;
+        l.unlock();
+
+        unsigned int head = *cq_head;
+        unsigned int tail = loadAcquire(cq_tail);
+        unsigned int completed = tail - head;
+        for (; head != tail; ++head) {
+            const struct io_uring_cqe& cqe = static_cast<struct io_uring_cqe*> (cqes)[head & *cq_mask];
+            if (cqe.user_data > USER_DATA_STOP)
+                reinterpret_cast<IoUringOperation*> (cqe.user_data)->complete(cqe.res);
+        }
+        storeRelease(cq_head, head);
+
+        l.lock();
+        stats.completed += completed;
+    }
+}
+
+unsigned int IoUringEngine::reserveEntries(unique_lock<mutex>& l, unsigned int count) {
+    while (sq_local_tail + count - loadAcquire(sq_head) > sq_entries) {
+        if (options.sqpoll || unsubmitted == 0) {
+            // The kernel is consuming the entries
+            l.unlock();
+            this_thread::yield();
+            l.lock();
+        } else {
+            flush();
+        }
+    }
+    unsigned int index = sq_local_tail;
+    for (unsigned int i = 0; i < count; ++i)
+        memset(entry(index + i), 0, sizeof (struct io_uring_sqe));
+    sq_local_tail += count;
+    return index;
+}
+
+void* IoUringEngine::entry(unsigned int index) {
+    return &static_cast<struct io_uring_sqe*> (sqes)[index & *sq_mask];
+}
+
+void IoUringEngine::publishEntries(unsigned int count) {
+    storeRelease(sq_tail, sq_local_tail);
+    stats.submitted += count;
+    if (options.sqpoll) {
+        // The polling thread submits, it only needs a wake up when sleeping
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (loadAcquire(sq_flags) & IORING_SQ_NEED_WAKEUP) {
+            stats.submit_calls++;
+            enter(0, 0, IORING_ENTER_SQ_WAKEUP);
+        }
+        return;
+    }
+    unsubmitted += count;
+    // Otherwise the engine thread submits them with its next wait
+    if (waiting)
+        flush();
+}
+
+void IoUringEngine::flush() {
+    if (unsubmitted == 0)
+        return;
+    stats.submit_calls++;
+    enter(unsubmitted, 0, 0);
+    unsubmitted = 0;
+}
+
+int IoUringEngine::enter(unsigned int to_submit, unsigned int min_complete, unsigned int flags) {
+    int result;
+    do {
+        result = syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, flags, NULL, 0);
+    } while (result < 0 && errno == EINTR && min_complete > 0);
+    return result < 0 ? -errno : result;
+}
+
+IoUringTransport::IoUringTransport(boost::shared_ptr<IoUringEngine> uring, int file) : engine(uring), fd(file) {
+    init();
+}
+
+IoUringTransport::IoUringTransport(boost::shared_ptr<IoUringEngine> uring, const std::string& devname,
+        const linux_serial_options_t& options) : engine(uring), fd(-1) {
+    fd = linuxSerialOpen(devname, options, serial_status);
+    init();
+}
+
+IoUringTransport::~IoUringTransport() {
+    boost::system::error_code ec;
+    close(ec);
+    engine->releaseBuffer(buffer_index);
+}
+
+void IoUringTransport::init() {
+    // io_uring polls the descriptor itself, a non blocking one would fail with EAGAIN
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags != -1)
+        fcntl(fd, F_SETFL, flags & ~O_NONBLOCK);
+    memset(&serial_status, 0, sizeof (serial_status));
+    try {
+        buffer_index = engine->acquireBuffer(buffer);
+    } catch (...) {
+        ::close(fd);
+        throw;
+    }
+    read_op.transport = this;
+    write_op.transport = this;
+    write_op.buffers.reserve(16);
+}
+
+void IoUringTransport::asyncReadSome(char* data, size_t size, const handler_t& handler) {
+    read_op.data = data;
+    read_op.size = size;
+    read_op.handler = &handler;
+    if (buffer_index >= 0)
+        engine->read(&read_op, fd, buffer, std::min(size, engine->bufferSize()), buffer_index);
+    else
+        engine->read(&read_op, fd, data, size, -1);
+}
+
+void IoUringTransport::asyncWrite(const TxBufferSequence& buffers, const handler_t& handler) {
+    write_op.buffers.assign(buffers.begin(), buffers.end());
+    write_op.done = 0;
+    write_op.error = 0;
+    {
+        lock_guard<mutex> l(write_op.cancelMutex);
+        write_op.canceled = false;
+    }
+    write_op.handler = &handler;
+    write_op.submit();
+}
+
+void IoUringTransport::cancel(boost::system::error_code& ec) {
+    {
+        lock_guard<mutex> l(write_op.cancelMutex);
+        write_op.canceled = true;
+    }
+    engine->cancel(&read_op);
+    engine->cancel(&write_op);
+    ec = boost::system::error_code();
+}
+
+void IoUringTransport::close(boost::system::error_code& ec) {
+    ec = boost::system::error_code();
+    if (fd < 0)
+        return;
+    // The operations in progress keep their own reference to the file
+    if (::close(fd) < 0)
+        ec = boost::system::error_code(errno, boost::system::system_category());
+    fd = -1;
+}
+
+void IoUringTransport::ReadOperation::complete(int result) {
+    // The handler may start the next read, that reuses this operation
+    const handler_t& callback = *handler;
+    if (result < 0) {
+        callback(boost::system::error_code(-result, boost::system::system_category()), 0);
+    } else if (result == 0) {
+        callback(asio::error::eof, 0);
+    } else {
+        if (transport->buffer_index >= 0)
+            memcpy(data, transport->buffer, result);
+        callback(boost::system::error_code(), result);
+    }
+}
+
+void IoUringTransport::WriteOperation::submit() {
+    size_t count = std::min<size_t>(buffers.size(), transport->engine->chainLimit());
+    chain_done = 0;
+    chain_size = 0;
+    for (size_t i = 0; i < count; ++i)
+        chain_size += asio::buffer_size(buffers[i]);
+    // An empty write completes once
+    pending = std::max<size_t>(count, 1);
+    transport->engine->write(this, transport->fd, buffers.empty() ? NULL : &buffers[0], count);
+}
+
+void IoUringTransport::WriteOperation::complete(int result) {
+    if (result >= 0)
+        chain_done += result;
+    else if (result != -ECANCELED && error == 0)
+        error = -result;
+    if (--pending > 0)
+        return;
+
+    done += chain_done;
+    bool aborted;
+    {
+        lock_guard<mutex> l(cancelMutex);
+        aborted = canceled;
+    }
+    if (error == 0) {
+        // Drop the data written, the chain was cut by a short write or by
+        // the chain limit
+        size_t skip = chain_done;
+        while (!buffers.empty() && skip >= asio::buffer_size(buffers.front())) {
+            skip -= asio::buffer_size(buffers.front());
+            buffers.erase(buffers.begin());
+        }
+        if (!buffers.empty()) {
+            if (!aborted) {
+                // Send the rest
+                buffers.front() = buffers.front() + skip;
+                submit();
+                return;
+            }
+            error = ECANCELED;
+        }
+    }
+    (*handler)(boost::system::error_code(error, boost::system::system_category()), done);
+}
+
+#endif
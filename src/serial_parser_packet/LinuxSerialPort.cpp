@@ -0,0 +1,153 @@
+/*
+ * Copyright (C) 2014 Officine Robotiche
+ * Author: Raffaello Bonghi
+ * email:  raffaello.bonghi@officinerobotiche.it
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the GNU Lesser General Public License
+ * (LGPL) version 2.1 which accompanies this distribution, and is available at
+ * http://www.gnu.org/licenses/lgpl-2.1.html
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#ifdef __linux__
+
+#include "serial_parser_packet/LinuxSerialPort.h"
+
+#include <cerrno>
+#include <asm/termbits.h>
+#include <sys/ioctl.h>
+#include <linux/serial.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <boost/system/system_error.hpp>
+
+using namespace std;
+
+static void throwErrno(int fd, const char* what) {
+    int error = errno;
+    if (fd >= 0)
+        ::close(fd);
+    throw (boost::system::system_error(boost::system::error_code(error,
+            boost::system::system_category()), what));
+}
+
+/**
+ * @return the Bxxx constant of a standard rate, zero if it does not exist
+ */
+static speed_t standardBaud(unsigned int baud_rate) {
+    switch (baud_rate) {
+        case 1200: return B1200;
+        case 2400: return B2400;
+        case 4800: return B4800;
+        case 9600: return B9600;
+        case 19200: return B19200;
+        case 38400: return B38400;
+        case 57600: return B57600;
+        case 115200: return B115200;
+        case 230400: return B230400;
+        case 460800: return B460800;
+        case 500000: return B500000;
+        case 576000: return B576000;
+        case 921600: return B921600;
+        case 1000000: return B1000000;
+        case 1152000: return B1152000;
+        case 1500000: return B1500000;
+        case 2000000: return B2000000;
+        case 2500000: return B2500000;
+        case 3000000: return B3000000;
+        case 3500000: return B3500000;
+        case 4000000: return B4000000;
+        default: return 0;
+    }
+}
+
+linux_serial_options_t linuxSerialDefaultOptions(unsigned int baud_rate) {
+    linux_serial_options_t options;
+    options.baud_rate = baud_rate;
+    options.parity = 'N';
+    options.character_size = 8;
+    options.stop_bits = 1;
+    options.rtscts = false;
+    options.low_latency = true;
+    options.vmin = 1;
+    options.vtime = 0;
+    return options;
+}
+
+int linuxSerialOpen(const std::string& devname, const linux_serial_options_t& options, linux_serial_status_t& status) {
+    int fd = ::open(devname.c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if (fd < 0)
+        throwErrno(-1, "Failed to open port");
+
+    struct termios2 attributes;
+    if (ioctl(fd, TCGETS2, &attributes) < 0)
+        throwErrno(fd, "Device is not a tty");
+
+    // Raw mode, as cfmakeraw
+    attributes.c_iflag &= ~(IGNBRK | BRKINT | PARMRK | ISTRIP | INLCR | IGNCR | ICRNL | IXON | IXOFF | IXANY);
+    attributes.c_oflag &= ~OPOST;
+    attributes.c_lflag &= ~(ECHO | ECHONL | ICANON | ISIG | IEXTEN);
+    attributes.c_cflag &= ~(CSIZE | PARENB | PARODD | CSTOPB | CRTSCTS | CBAUD | (CBAUD << IBSHIFT));
+    attributes.c_cflag |= CREAD | CLOCAL;
+
+    switch (options.character_size) {
+        case 5: attributes.c_cflag |= CS5; break;
+        case 6: attributes.c_cflag |= CS6; break;
+        case 7: attributes.c_cflag |= CS7; break;
+        default: attributes.c_cflag |= CS8; break;
+    }
+    if (options.parity == 'E')
+        attributes.c_cflag |= PARENB;
+    else if (options.parity == 'O')
+        attributes.c_cflag |= PARENB | PARODD;
+    if (options.stop_bits == 2)
+        attributes.c_cflag |= CSTOPB;
+    if (options.rtscts)
+        attributes.c_cflag |= CRTSCTS;
+
+    attributes.c_cc[VMIN] = options.vmin;
+    attributes.c_cc[VTIME] = options.vtime;
+
+    // Standard rates keep the Bxxx constant, all the others use BOTHER
+    speed_t speed = standardBaud(options.baud_rate);
+    status.custom_baud = (speed == 0);
+    if (status.custom_baud)
+        speed = BOTHER;
+    attributes.c_cflag |= speed | (speed << IBSHIFT);
+    attributes.c_ispeed = options.baud_rate;
+    attributes.c_ospeed = options.baud_rate;
+
+    if (ioctl(fd, TCSETS2, &attributes) < 0)
+        throwErrno(fd, "Can't set port attributes");
+
+    // Read back the rate the driver really uses
+    if (ioctl(fd, TCGETS2, &attributes) < 0)
+        throwErrno(fd, "Can't get port attributes");
+    status.baud_rate = attributes.c_ospeed;
+
+    status.low_latency = false;
+    status.low_latency_error = 0;
+    if (options.low_latency) {
+        // Not all the drivers support it (pseudo terminals do not), it is
+        // reported in status and it is not an error
+        struct serial_struct serial;
+        if (ioctl(fd, TIOCGSERIAL, &serial) < 0) {
+            status.low_latency_error = errno;
+        } else {
+            serial.flags |= ASYNC_LOW_LATENCY;
+            if (ioctl(fd, TIOCSSERIAL, &serial) < 0)
+                status.low_latency_error = errno;
+            else
+                status.low_latency = true;
+        }
+    }
+
+    ioctl(fd, TCFLSH, TCIOFLUSH);
+    return fd;
+}
+
+#endif
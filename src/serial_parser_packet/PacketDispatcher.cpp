@@ -0,0 +1,305 @@
+/*
+ * Copyright (C) 2014 Officine Robotiche
+ * Author: Raffaello Bonghi
+ * email:  raffaello.bonghi@officinerobotiche.it
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the GNU Lesser General Public License
+ * (LGPL) version 2.1 which accompanies this distribution, and is available at
+ * http://www.gnu.org/licenses/lgpl-2.1.html
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#include "serial_parser_packet/PacketDispatcher.h"
+#include "serial_parser_packet/AsyncSerial.h"
+#include "serial_parser_packet/LinkStatistics.h"
+#include "serial_parser_packet/RxRing.h"
+#include <deque>
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
+using namespace std;
+using namespace boost;
+
+/**
+ * Message queued with the number of packets queued before it
+ */
+struct PacketDispatcher::Message {
+    uint64_t after;
+    vector<unsigned char> data;
+};
+
+/**
+ * Dispatch thread with its queue. The I/O thread is the only producer of
+ * the queue and the thread its only consumer.
+ */
+struct PacketDispatcher::Worker {
+
+    Worker(size_t queue) : ring(queue), capacity(queue), queued(false), pushed(0), popped(0),
+    messages_queued(0), sleeping(false), queue_max(0), thread(NULL) {
+    }
+
+    RxRing ring;
+    size_t capacity;
+    /// Packets queued since the last wake, I/O thread only
+    bool queued;
+    /// Packets queued ever, I/O thread only
+    uint64_t pushed;
+    /// Packets taken ever, dispatch thread only
+    uint64_t popped;
+    /// Messages in the order received, with message_mutex locked
+    deque<Message> messages;
+    boost::mutex message_mutex;
+    /// Size of messages, read without the lock to find it empty
+    boost::atomic<size_t> messages_queued;
+    /// Callbacks of the thread, changed and run with run_mutex locked
+    vector<unsigned int> subscribers;
+    vector<unsigned int> message_subscribers;
+    boost::mutex run_mutex;
+    /// The thread waits for packets on wake, sleeping tells the producer
+    boost::mutex wait_mutex;
+    boost::condition_variable wake;
+    boost::atomic<bool> sleeping;
+    /// Written by the I/O thread only
+    boost::atomic<size_t> queue_max;
+    LinkCounter dropped;
+    boost::thread* thread;
+};
+
+/**
+ * Callback with its activity, written by its dispatch thread only
+ */
+struct PacketDispatcher::Subscriber {
+
+    Subscriber() : calls(0), time_total(0), time_max(0) {
+    }
+
+    callback_t callback;
+    boost::atomic<uint64_t> calls;
+    boost::atomic<uint64_t> time_total;
+    boost::atomic<uint64_t> time_max;
+};
+
+PacketDispatcher::PacketDispatcher(unsigned int threads, size_t queue) :
+subscribers(new Subscriber[DISPATCH_CALLBACKS]), message_subscribers(new message_callback_t[DISPATCH_CALLBACKS]),
+count(0), message_count(0), running(true) {
+    if (threads == 0)
+        threads = 1;
+    for (unsigned int i = 0; i < threads; ++i)
+        workers.push_back(new Worker(queue));
+    for (vector<Worker*>::iterator it = workers.begin(); it != workers.end(); ++it)
+        (*it)->thread = new boost::thread(boost::bind(&PacketDispatcher::run, this, *it));
+}
+
+PacketDispatcher::~PacketDispatcher() {
+    running.store(false, memory_order_release);
+    for (vector<Worker*>::iterator it = workers.begin(); it != workers.end(); ++it) {
+        {
+            //The lock orders the stop with a thread going to wait
+            lock_guard<boost::mutex> l((*it)->wait_mutex);
+        }
+        (*it)->wake.notify_one();
+    }
+    for (vector<Worker*>::iterator it = workers.begin(); it != workers.end(); ++it) {
+        (*it)->thread->join();
+        delete (*it)->thread;
+        delete (*it);
+    }
+}
+
+bool PacketDispatcher::addCallback(const callback_t& callback) {
+    unsigned int index = count.load(memory_order_relaxed);
+    if (index == DISPATCH_CALLBACKS)
+        return false;
+    Worker* worker = workers[index % workers.size()];
+    {
+        lock_guard<boost::mutex> l(worker->run_mutex);
+        Subscriber& subscriber = subscribers[index];
+        subscriber.callback = callback;
+        subscriber.calls.store(0, memory_order_relaxed);
+        subscriber.time_total.store(0, memory_order_relaxed);
+        subscriber.time_max.store(0, memory_order_relaxed);
+        worker->subscribers.push_back(index);
+    }
+    count.store(index + 1, memory_order_release);
+    return true;
+}
+
+bool PacketDispatcher::addMessageCallback(const message_callback_t& callback) {
+    unsigned int index = message_count.load(memory_order_relaxed);
+    if (index == DISPATCH_CALLBACKS)
+        return false;
+    Worker* worker = workers[index % workers.size()];
+    {
+        lock_guard<boost::mutex> l(worker->run_mutex);
+        message_subscribers[index] = callback;
+        worker->message_subscribers.push_back(index);
+    }
+    message_count.store(index + 1, memory_order_release);
+    return true;
+}
+
+void PacketDispatcher::clearCallbacks() {
+    for (vector<Worker*>::iterator it = workers.begin(); it != workers.end(); ++it) {
+        //Wait for the callback running, if any
+        lock_guard<boost::mutex> l((*it)->run_mutex);
+        for (vector<unsigned int>::iterator index = (*it)->subscribers.begin(); index != (*it)->subscribers.end(); ++index)
+            subscribers[*index].callback.clear();
+        (*it)->subscribers.clear();
+        for (vector<unsigned int>::iterator index = (*it)->message_subscribers.begin(); index != (*it)->message_subscribers.end(); ++index)
+            message_subscribers[*index].clear();
+        (*it)->message_subscribers.clear();
+    }
+    count.store(0, memory_order_release);
+    message_count.store(0, memory_order_release);
+}
+
+size_t PacketDispatcher::dispatch(const packet_t& packet) {
+    size_t dropped = 0;
+    unsigned int callbacks = count.load(memory_order_acquire);
+    //Only the threads with a callback get the packet
+    for (size_t i = 0; i < workers.size() && i < callbacks; ++i) {
+        Worker* worker = workers[i];
+        if (!worker->ring.push(packet)) {
+            worker->dropped.add(1);
+            dropped++;
+            continue;
+        }
+        worker->pushed++;
+        size_t depth = worker->ring.size();
+        if (depth > worker->queue_max.load(memory_order_relaxed))
+            worker->queue_max.store(depth, memory_order_relaxed);
+        worker->queued = true;
+        //Don't wait for the end of a long read to start the thread
+        if (depth >= worker->capacity / 2)
+            wake(worker);
+    }
+    return dropped;
+}
+
+size_t PacketDispatcher::dispatchMessage(const unsigned char* message, size_t length) {
+    size_t dropped = 0;
+    unsigned int callbacks = message_count.load(memory_order_acquire);
+    for (size_t i = 0; i < workers.size() && i < callbacks; ++i) {
+        Worker* worker = workers[i];
+        size_t depth;
+        {
+            lock_guard<boost::mutex> l(worker->message_mutex);
+            if (worker->messages.size() == worker->capacity) {
+                worker->dropped.add(1);
+                dropped++;
+                continue;
+            }
+            worker->messages.push_back(Message());
+            worker->messages.back().after = worker->pushed;
+            worker->messages.back().data.assign(message, message + length);
+            depth = worker->messages.size();
+            worker->messages_queued.store(depth, memory_order_relaxed);
+        }
+        worker->queued = true;
+        if (depth >= worker->capacity / 2)
+            wake(worker);
+    }
+    return dropped;
+}
+
+void PacketDispatcher::wake() {
+    for (vector<Worker*>::iterator it = workers.begin(); it != workers.end(); ++it) {
+        if ((*it)->queued)
+            wake(*it);
+    }
+}
+
+void PacketDispatcher::wake(Worker* worker) {
+    worker->queued = false;
+    //Pairs with the fence of a thread going to sleep: either it sees the
+    //packets or the producer sees it sleeping
+    atomic_thread_fence(memory_order_seq_cst);
+    if (worker->sleeping.load(memory_order_relaxed)) {
+        {
+            lock_guard<boost::mutex> l(worker->wait_mutex);
+        }
+        worker->wake.notify_one();
+    }
+}
+
+void PacketDispatcher::run(Worker* worker) {
+    packet_t packet;
+    vector<unsigned char> message;
+    while (running.load(memory_order_acquire)) {
+        if (popMessage(worker, message)) {
+            deliverMessage(worker, message);
+            continue;
+        }
+        if (worker->ring.pop(packet)) {
+            worker->popped++;
+            deliver(worker, packet);
+            continue;
+        }
+        unique_lock<boost::mutex> l(worker->wait_mutex);
+        worker->sleeping.store(true, memory_order_relaxed);
+        atomic_thread_fence(memory_order_seq_cst);
+        if (worker->ring.empty() && worker->messages_queued.load(memory_order_relaxed) == 0
+                && running.load(memory_order_acquire))
+            worker->wake.wait(l);
+        worker->sleeping.store(false, memory_order_relaxed);
+    }
+}
+
+void PacketDispatcher::deliver(Worker* worker, const packet_t& packet) {
+    lock_guard<boost::mutex> l(worker->run_mutex);
+    for (vector<unsigned int>::const_iterator index = worker->subscribers.begin(); index != worker->subscribers.end(); ++index) {
+        Subscriber& subscriber = subscribers[*index];
+        if (!subscriber.callback)
+            continue;
+        uint64_t start = AsyncSerial::monotonicTime();
+        subscriber.callback(&packet);
+        uint64_t time = AsyncSerial::monotonicTime() - start;
+        subscriber.calls.store(subscriber.calls.load(memory_order_relaxed) + 1, memory_order_relaxed);
+        subscriber.time_total.store(subscriber.time_total.load(memory_order_relaxed) + time, memory_order_relaxed);
+        if (time > subscriber.time_max.load(memory_order_relaxed))
+            subscriber.time_max.store(time, memory_order_relaxed);
+    }
+}
+
+bool PacketDispatcher::popMessage(Worker* worker, std::vector<unsigned char>& message) {
+    if (worker->messages_queued.load(memory_order_relaxed) == 0)
+        return false;
+    lock_guard<boost::mutex> l(worker->message_mutex);
+    //The packets received before the message go first
+    if (worker->messages.empty() || worker->messages.front().after > worker->popped)
+        return false;
+    message.swap(worker->messages.front().data);
+    worker->messages.pop_front();
+    worker->messages_queued.store(worker->messages.size(), memory_order_relaxed);
+    return true;
+}
+
+void PacketDispatcher::deliverMessage(Worker* worker, const std::vector<unsigned char>& message) {
+    lock_guard<boost::mutex> l(worker->run_mutex);
+    for (vector<unsigned int>::const_iterator index = worker->message_subscribers.begin(); index != worker->message_subscribers.end(); ++index) {
+        const message_callback_t& callback = message_subscribers[*index];
+        if (callback)
+            callback(message.empty() ? NULL : &message[0], message.size());
+    }
+}
+
+std::vector<dispatch_statistics_t> PacketDispatcher::statistics() const {
+    unsigned int callbacks = count.load(memory_order_acquire);
+    vector<dispatch_statistics_t> list(callbacks);
+    for (unsigned int i = 0; i < callbacks; ++i) {
+        const Subscriber& subscriber = subscribers[i];
+        const Worker* worker = workers[i % workers.size()];
+        list[i].calls = subscriber.calls.load(memory_order_relaxed);
+        list[i].time_total = subscriber.time_total.load(memory_order_relaxed);
+        list[i].time_max = subscriber.time_max.load(memory_order_relaxed);
+        list[i].thread = i % workers.size();
+        list[i].queue = worker->ring.size();
+        list[i].queue_max = worker->queue_max.load(memory_order_relaxed);
+        list[i].dropped = worker->dropped.load();
+    }
+    return list;
+}
@@ -16,10 +16,12 @@
 #include "serial_parser_packet/PacketSerial.h"
 
 #include <string>
+#include <cstring>
 #include <algorithm>
 #include <iostream>
 #include <boost/bind.hpp>
 #include <boost/array.hpp>
+#include <boost/scoped_ptr.hpp>
 
 using namespace std;
 using namespace boost;
@@ -27,14 +29,24 @@ using namespace boost;
 class AsyncPacketImpl {
 public:
 
-    AsyncPacketImpl() : count(0) {
+    AsyncPacketImpl() : count(0), batch_count(0), batch_size(0), message_count(0) {
+        //Frames of a read, the shortest frame is 3 bytes
+        batch.resize(AsyncSerial::readBufferSize / 3 + 1);
     }
 
-    void sendAsyncPacket(const packet_t* packet) {
+    /**
+     * @return number of dispatch threads that dropped the packet
+     */
+    size_t sendAsyncPacket(const packet_t* packet) {
+        if (batch_count != 0)
+            addBatch(packet);
+        if (dispatcher)
+            return dispatcher->dispatch(*packet);
         for (unsigned int i = 0; i < count; ++i) {
-            callback_t callback = async_functions[i];
+            const callback_t& callback = async_functions[i];
             if (callback) callback(packet);
         }
+        return 0;
     }
 
     void addAsyncCallback(const boost::function<void (const packet_t*) >& callback) {
@@ -42,31 +54,252 @@ public:
             throw (packet_exception(ERROR_MAX_ASYNC_CALLBACK_STRING));
         else
             async_functions[count++] = callback;
+        if (dispatcher)
+            dispatcher->addCallback(callback);
     }
 
-    void clearAllAsyncCallback() {
-        for (unsigned int i = 0; i < count; ++i) {
-            callback_t callback = async_functions[i];
-            callback.clear();
+    void addBatchCallback(const boost::function<void (const packet_t*, size_t) >& callback) {
+        if (batch_count == 10)
+            throw (packet_exception(ERROR_MAX_ASYNC_CALLBACK_STRING));
+        else
+            batch_functions[batch_count++] = callback;
+    }
+
+    void addMessageCallback(const boost::function<void (const unsigned char*, size_t) >& callback) {
+        if (message_count == 10)
+            throw (packet_exception(ERROR_MAX_ASYNC_CALLBACK_STRING));
+        else
+            message_functions[message_count++] = callback;
+        if (dispatcher)
+            dispatcher->addMessageCallback(callback);
+    }
+
+    /**
+     * @return number of dispatch threads that dropped the message
+     */
+    size_t sendMessage(const unsigned char* message, size_t length) {
+        if (dispatcher)
+            return dispatcher->dispatchMessage(message, length);
+        for (unsigned int i = 0; i < message_count; ++i) {
+            const message_callback_t& callback = message_functions[i];
+            if (callback) callback(message, length);
         }
+        return 0;
+    }
+
+    void clearAllAsyncCallback() {
+        //Returns once the dispatch threads don't run them anymore
+        if (dispatcher)
+            dispatcher->clearCallbacks();
+        for (unsigned int i = 0; i < count; ++i)
+            async_functions[i].clear();
         count = 0;
+        for (unsigned int i = 0; i < batch_count; ++i)
+            batch_functions[i].clear();
+        batch_count = 0;
+        batch_size = 0;
+        for (unsigned int i = 0; i < message_count; ++i)
+            message_functions[i].clear();
+        message_count = 0;
+    }
+
+    /**
+     * Start the dispatch of the packets of a read and send them to the
+     * batch callbacks
+     */
+    void flush() {
+        if (dispatcher)
+            dispatcher->wake();
+        if (batch_size == 0)
+            return;
+        for (unsigned int i = 0; i < batch_count; ++i) {
+            const batch_callback_t& callback = batch_functions[i];
+            if (callback) callback(&batch[0], batch_size);
+        }
+        batch_size = 0;
+    }
+
+    void setDispatchThreads(unsigned int threads, size_t queue) {
+        dispatcher.reset();
+        if (threads != 0) {
+            dispatcher.reset(new PacketDispatcher(threads, queue));
+            for (unsigned int i = 0; i < count; ++i)
+                dispatcher->addCallback(async_functions[i]);
+            for (unsigned int i = 0; i < message_count; ++i)
+                dispatcher->addMessageCallback(message_functions[i]);
+        }
+    }
+
+    std::vector<dispatch_statistics_t> dispatchStatistics() const {
+        if (dispatcher)
+            return dispatcher->statistics();
+        return std::vector<dispatch_statistics_t>();
     }
 
 private:
+
+    /**
+     * Copy the used part of a packet at the end of the batch
+     */
+    void addBatch(const packet_t* packet) {
+        if (batch_size == batch.size())
+            batch.resize(2 * batch.size());
+        packet_t& last = batch[batch_size++];
+        last.length = packet->length;
+        memcpy(last.buffer, packet->buffer, packet->length);
+        last.time = packet->time;
+        last.time_sent = packet->time_sent;
+    }
+
     /// Read complete callback - Array of callback
     typedef boost::function<void (const packet_t*) > callback_t;
+    typedef boost::function<void (const packet_t*, size_t) > batch_callback_t;
     unsigned int count;
     boost::array<callback_t, 10 > async_functions;
+    unsigned int batch_count;
+    boost::array<batch_callback_t, 10 > batch_functions;
+    /// Async packets of the read being parsed, for the batch callbacks
+    std::vector<packet_t> batch;
+    size_t batch_size;
+    typedef boost::function<void (const unsigned char*, size_t) > message_callback_t;
+    unsigned int message_count;
+    boost::array<message_callback_t, 10 > message_functions;
+    /// Runs the callbacks out of the I/O thread, if set
+    boost::scoped_ptr<PacketDispatcher> dispatcher;
 };
 
-PacketSerial::PacketSerial() : AsyncSerial(), async(false), data_ready(false), pkgimpl(new AsyncPacketImpl) {
-    pkg_parse = &PacketSerial::pkg_header;
-    setReadCallback(boost::bind(&PacketSerial::readCallback, this, _1, _2));
-    initMapError();
+/**
+ * Table of the sync requests waiting for their reply, indexed by id
+ */
+class SyncRequestImpl {
+public:
 
-    BufferTxSize = 64;
-    BufferTx = new unsigned char[BufferTxSize];
+    SyncRequestImpl() : window(1), pending(0), next_id(0) {
+        for (int i = 0; i < SYNC_IDS; ++i)
+            requests[i].state = REQUEST_FREE;
+    }
+
+    /**
+     * Take the next free id, waiting for a place in the window
+     * @return false on timeout
+     */
+    bool begin(const boost::system_time& timeout, unsigned char& id) {
+        unique_lock<boost::mutex> l(mutex);
+        while (pending >= window) {
+            if (!window_cond.timed_wait(l, timeout))
+                return false;
+        }
+        //Ids go round, so a late reply finds its id free for a long time
+        while (requests[next_id].state != REQUEST_FREE)
+            ++next_id;
+        id = next_id++;
+        requests[id].state = REQUEST_WAITING;
+        ++pending;
+        return true;
+    }
 
+    void sent(unsigned char id, size_t sequence, write_priority_t priority) {
+        lock_guard<boost::mutex> l(mutex);
+        requests[id].sequence = sequence;
+        requests[id].priority = priority;
+    }
+
+    /**
+     * Store the reply of a request, from a HEADER_SYNC_ID frame
+     * @return false if no request waits for it
+     */
+    bool reply(const packet_t& frame) {
+        unsigned char id = frame.buffer[0];
+        {
+            lock_guard<boost::mutex> l(mutex);
+            request_t& request = requests[id];
+            if (request.state != REQUEST_WAITING)
+                return false;
+            request.reply.length = frame.length - 1;
+            memcpy(request.reply.buffer, &frame.buffer[1], request.reply.length);
+            request.reply.time = frame.time;
+            request.state = REQUEST_REPLIED;
+        }
+        reply_cond.notify_all();
+        return true;
+    }
+
+    /**
+     * Wait for the reply and end the request
+     * @return false on timeout
+     */
+    bool wait(unsigned char id, const boost::system_time& timeout, packet_t& reply,
+            size_t& sequence, write_priority_t& priority) {
+        unique_lock<boost::mutex> l(mutex);
+        request_t& request = requests[id];
+        while (request.state == REQUEST_WAITING) {
+            if (!reply_cond.timed_wait(l, timeout))
+                break;
+        }
+        bool replied = (request.state == REQUEST_REPLIED);
+        if (replied) {
+            reply = request.reply;
+            sequence = request.sequence;
+            priority = request.priority;
+        }
+        end(request);
+        return replied;
+    }
+
+    void cancel(unsigned char id) {
+        lock_guard<boost::mutex> l(mutex);
+        end(requests[id]);
+    }
+
+    void setWindow(size_t requests) {
+        {
+            lock_guard<boost::mutex> l(mutex);
+            window = std::max<size_t>(1, std::min<size_t>(requests, SYNC_IDS / 2));
+        }
+        window_cond.notify_all();
+    }
+
+    size_t getWindow() {
+        lock_guard<boost::mutex> l(mutex);
+        return window;
+    }
+
+private:
+
+    typedef enum _request_state {
+        REQUEST_FREE,
+        REQUEST_WAITING,
+        REQUEST_REPLIED
+    } request_state_t;
+
+    typedef struct _request {
+        request_state_t state;
+        size_t sequence; ///< Sequence of the request in its lane
+        write_priority_t priority;
+        packet_t reply;
+    } request_t;
+
+    void end(request_t& request) {
+        if (request.state == REQUEST_FREE)
+            return;
+        request.state = REQUEST_FREE;
+        --pending;
+        window_cond.notify_one();
+    }
+
+    boost::mutex mutex;
+    boost::condition_variable reply_cond, window_cond;
+    size_t window, pending;
+    unsigned char next_id;
+    request_t requests[SYNC_IDS];
+};
+
+PacketSerial::PacketSerial() : AsyncSerial(), parse_format(FRAME_FORMAT_HEADER), parse_check(FRAME_CHECK_SUM),
+frame_format(FRAME_FORMAT_HEADER), frame_check(FRAME_CHECK_SUM), sync_queue(SYNC_QUEUE), message_sequence(0), pkgimpl(new AsyncPacketImpl),
+requestimpl(new SyncRequestImpl) {
+    memset(&parse_counts, 0, sizeof (parse_counts));
+    parser.reset(createParser(parse_format, parse_check));
+    setReadCallback(boost::bind(&PacketSerial::readCallback, this, _1, _2));
 }
 
 PacketSerial::PacketSerial(const std::string& devname,
@@ -75,16 +308,76 @@ PacketSerial::PacketSerial(const std::string& devname,
         asio::serial_port_base::character_size opt_csize,
         asio::serial_port_base::flow_control opt_flow,
         asio::serial_port_base::stop_bits opt_stop)
-: AsyncSerial(devname, baud_rate, opt_parity, opt_csize, opt_flow, opt_stop), async(false), data_ready(false), pkgimpl(new AsyncPacketImpl) {
-    pkg_parse = &PacketSerial::pkg_header;
+: AsyncSerial(devname, baud_rate, opt_parity, opt_csize, opt_flow, opt_stop), parse_format(FRAME_FORMAT_HEADER), parse_check(FRAME_CHECK_SUM),
+frame_format(FRAME_FORMAT_HEADER), frame_check(FRAME_CHECK_SUM), sync_queue(SYNC_QUEUE), message_sequence(0), pkgimpl(new AsyncPacketImpl),
+requestimpl(new SyncRequestImpl) {
+    memset(&parse_counts, 0, sizeof (parse_counts));
+    parser.reset(createParser(parse_format, parse_check));
     setReadCallback(boost::bind(&PacketSerial::readCallback, this, _1, _2));
-    initMapError();
+}
+
+/**
+ * Handler of the frames parsed by the FramingCore of a PacketSerial
+ */
+class PacketFrameHandler {
+public:
+
+    explicit PacketFrameHandler(PacketSerial& serial) : serial(serial) {
+    }
+
+    void frame(unsigned char header, packet_t& packet) {
+        serial.parse_counts.frames++;
+        serial.deliverFrame(header, packet);
+    }
+
+    void headerErrors(size_t count) {
+        serial.parse_counts.header += count;
+    }
 
-    BufferTxSize = 64;
-    BufferTx = new unsigned char[BufferTxSize];
+    void lengthError() {
+        serial.parse_counts.length++;
+    }
+
+    void checkError() {
+        serial.parse_counts.checksum++;
+    }
+
+    void framingError() {
+        serial.parse_counts.framing++;
+    }
+
+private:
+    PacketSerial& serial;
+};
+
+/**
+ * @return the parser of a framing for a check
+ */
+template <class Framing>
+static FrameParser* createFramingCore(frame_check_t check, PacketSerial& serial) {
+    PacketFrameHandler handler(serial);
+    switch (check) {
+        case FRAME_CHECK_CRC16:
+            return new FramingCore<Framing, Crc16Check, PacketFrameHandler>(handler);
+        case FRAME_CHECK_CRC32:
+            return new FramingCore<Framing, Crc32Check, PacketFrameHandler>(handler);
+        default:
+            return new FramingCore<Framing, SumCheck, PacketFrameHandler>(handler);
+    }
 }
 
-void PacketSerial::writePacket(packet_t packet, unsigned char header) {
+FrameParser* PacketSerial::createParser(frame_format_t format, frame_check_t check) {
+    if (format == FRAME_FORMAT_COBS)
+        return createFramingCore<CobsFraming>(check, *this);
+    return createFramingCore<HeaderFraming>(check, *this);
+}
+
+size_t PacketSerial::writePacket(const packet_t& packet, unsigned char header, write_priority_t priority) {
+    return writePacket(packet.buffer, packet.length, header, priority);
+}
+
+size_t PacketSerial::writePacket(const unsigned char* data, size_t length, unsigned char header,
+        write_priority_t priority) {
     /* on packet:
      * ------- -----------------
      * | CMD | |   DATA         |
@@ -92,152 +385,282 @@ void PacketSerial::writePacket(packet_t packet, unsigned char header) {
      *    1        1 -> n
      */
 
-    size_t size = HEAD_PKG + packet.length + 1;
-    if( size > BufferTxSize )
-    {
-        BufferTxSize = size;
-        delete [] BufferTx;
-        BufferTx = new unsigned char[BufferTxSize];
+    if (length > MAX_BUFF_RX)
+        throw (packet_exception(ERROR_CREATE_PKG_STRING));
+    return writeFrame(header, NULL, 0, data, length, priority);
+}
+
+size_t PacketSerial::writeFrame(unsigned char header, const unsigned char* prefix, size_t prefix_length,
+        const unsigned char* data, size_t length, write_priority_t priority) {
+    //Encode the frame directly in the transmit buffer
+    frame_check_t check = frameCheck();
+    bool cobs = (frameFormat() == FRAME_FORMAT_COBS);
+    size_t size = prefix_length + length;
+    size_t frame_size = HEAD_PKG + size + frameCheckSize(check);
+    //A frame is shorter than 254 bytes: COBS adds one byte, plus a delimiter
+    //before and after it. The first one ends the noise received since the
+    //last frame, otherwise it would break this frame.
+    tx_slot_t slot = writeReserve(frame_size + (cobs ? 3 : 0), priority);
+    unsigned char* frame = reinterpret_cast<unsigned char*> (slot.data) + (cobs ? 2 : 0);
+
+    frame[0] = header;
+    frame[1] = size;
+    if (prefix_length != 0)
+        memcpy(&frame[HEAD_PKG], prefix, prefix_length);
+    memcpy(&frame[HEAD_PKG + prefix_length], data, length);
+    sealFrame(frame, HEAD_PKG + size, check);
+    if (cobs) {
+        //In place, over the byte kept before the frame
+        size_t encoded = cobsEncode(frame, frame_size, frame - 1);
+        frame[-2] = COBS_DELIMITER;
+        frame[encoded - 1] = COBS_DELIMITER;
     }
 
-    BufferTx[0] = header;
-    BufferTx[1] = packet.length;
+    writeCommit(slot);
+    link_statistics.sent(slot.size, 1);
+    return slot.index;
+}
 
-    for (unsigned i = 0; i < packet.length; i++) {
-        BufferTx[i + HEAD_PKG] = packet.buffer[i];
+size_t PacketSerial::writePrepared(PreparedCommand& command) {
+    frame_check_t check = frameCheck();
+    if (command.check() != check)
+        command.seal(check);
+    bool cobs = (frameFormat() == FRAME_FORMAT_COBS);
+    size_t size = command.size();
+    tx_slot_t slot = writeReserve(size + (cobs ? 3 : 0), command.priority());
+    unsigned char* frame = reinterpret_cast<unsigned char*> (slot.data);
+    if (cobs) {
+        //Encoded as in writeFrame(), one byte longer than the frame
+        frame[0] = COBS_DELIMITER;
+        cobsEncode(command.frame(), size, &frame[1]);
+        frame[size + 2] = COBS_DELIMITER;
+    } else {
+        memcpy(frame, command.frame(), size);
     }
+    writeCommit(slot);
+    link_statistics.sent(slot.size, 1);
+    return slot.index;
+}
 
-    BufferTx[packet.length + HEAD_PKG] = pkg_checksum(BufferTx, HEAD_PKG, packet.length + HEAD_PKG);
-
-    string data(reinterpret_cast<const char*> (BufferTx), size);
-    writeString(data);
+size_t PacketSerial::writeMessage(const unsigned char* data, size_t length, write_priority_t priority) {
+    if (length > FRAGMENT_MESSAGE)
+        throw (packet_exception(ERROR_CREATE_PKG_STRING));
+    size_t fragments = (length == 0 ? 1 : (length + FRAGMENT_DATA - 1) / FRAGMENT_DATA);
+    //The fragments of two messages must not interleave
+    lock_guard<boost::mutex> l(writeMessageMutex);
+    unsigned char head[FRAGMENT_HEAD] = {message_sequence++, 0, (unsigned char) (fragments - 1)};
+    for (size_t i = 0; i < fragments; ++i) {
+        size_t offset = i * FRAGMENT_DATA;
+        head[1] = i;
+        writeFrame(HEADER_FRAGMENT, head, FRAGMENT_HEAD, data + offset,
+                std::min<size_t>(FRAGMENT_DATA, length - offset), priority);
+    }
+    return fragments;
 }
 
 void PacketSerial::readCallback(const char *data, size_t len) {
-    //0 - Read Header
-    //1 - Read Length if true is correct length packet
-    //2 - Read Data if n+1 is checksum return true
-    for (unsigned int i = 0; i < len; ++i) {
-        try {
-            if (decode_pkgs(data[i])) {
-                if (async) {
-                    //Send callback
-                    pkgimpl->sendAsyncPacket(&receive_pkg);
-                } else {
-                    {
-                        //Notify sync
-                        lock_guard<boost::mutex> l(readQueueMutex);
-                        data_ready = true;
-                    }
-                    readPacketCond.notify_one();
-                }
-            }
-        } catch (packet_exception& e) {
-            map_error[e.what()] = map_error[e.what()] + 1;
-            //Restart to find header
-            pkg_parse = &PacketSerial::pkg_header;
-        }
+    const unsigned char* begin = reinterpret_cast<const unsigned char*> (data);
+    frame_format_t format = frameFormat();
+    frame_check_t check = frameCheck();
+    if (format != parse_format || check != parse_check) {
+        //The frame being parsed is dropped with the parser
+        parse_format = format;
+        parse_check = check;
+        parser.reset(createParser(format, check));
     }
+    parser->parse(begin, begin + len);
+    if (parse_counts.frames != 0)
+        pkgimpl->flush();
+    //Count the whole read at once
+    link_statistics.received(len, parse_counts.frames);
+    if (parse_counts.framing != 0)
+        link_statistics.error(ERROR_FRAMMING, parse_counts.framing);
+    if (parse_counts.header != 0)
+        link_statistics.error(ERROR_HEADER, parse_counts.header);
+    if (parse_counts.length != 0)
+        link_statistics.error(ERROR_LENGTH, parse_counts.length);
+    if (parse_counts.checksum != 0)
+        link_statistics.error(ERROR_CKS, parse_counts.checksum);
+    memset(&parse_counts, 0, sizeof (parse_counts));
 }
 
-void PacketSerial::initMapError() {
-    map_error[ERROR_FRAMMING_STRING] = 0;
-    map_error[ERROR_OVERRUN_STRING] = 0;
-    map_error[ERROR_HEADER_STRING] = 0;
-    map_error[ERROR_LENGTH_STRING] = 0;
-    map_error[ERROR_DATA_STRING] = 0;
-    map_error[ERROR_CKS_STRING] = 0;
-    map_error[ERROR_CMD_STRING] = 0;
-    map_error[ERROR_NACK_STRING] = 0;
-    map_error[ERROR_OPTION_STRING] = 0;
-    map_error[ERROR_PKG_STRING] = 0;
-    map_error[ERROR_CREATE_PKG_STRING] = 0;
-    map_error[ERROR_TIMEOUT_SYNC_PACKET_STRING] = 0;
-    map_error[ERROR_MAX_ASYNC_CALLBACK_STRING] = 0;
+void PacketSerial::deliverFrame(unsigned char header, packet_t& packet) {
+    //Time of the read that completed the frame
+    packet.time = readTimestamp();
+    packet.time_sent = 0;
+    if (header == HEADER_ASYNC) {
+        //Send callback
+        size_t dropped = pkgimpl->sendAsyncPacket(&packet);
+        if (dropped != 0)
+            link_statistics.error(ERROR_DISPATCH_QUEUE_FULL, dropped);
+    } else if (header == HEADER_SYNC_ID) {
+        //Reply of a pipelined request, the first byte is its id
+        if (packet.length == 0)
+            link_statistics.error(ERROR_PKG);
+        else if (!requestimpl->reply(packet))
+            link_statistics.error(ERROR_STALE_PACKET);
+    } else if (header == HEADER_FRAGMENT) {
+        unsigned int lost = 0;
+        if (assembler.add(packet, lost)) {
+            size_t dropped = pkgimpl->sendMessage(assembler.message(), assembler.size());
+            if (dropped != 0)
+                link_statistics.error(ERROR_DISPATCH_QUEUE_FULL, dropped);
+        }
+        if (lost != 0)
+            link_statistics.error(ERROR_FRAGMENT, lost);
+    } else if (sync_queue.push(packet)) {
+        {
+            //Notify sync, the lock orders it with a reader going to wait
+            lock_guard<boost::mutex> l(readQueueMutex);
+        }
+        readPacketCond.notify_one();
+    } else {
+        link_statistics.error(ERROR_SYNC_QUEUE_FULL);
+    }
 }
 
 packet_t PacketSerial::readPacket(const boost::posix_time::millisec& wait_duration) {
+    packet_t packet;
+    readPacket(packet, wait_duration);
+    return packet;
+}
+
+void PacketSerial::readPacket(packet_t& packet, const boost::posix_time::millisec& wait_duration) {
     unique_lock<boost::mutex> l(readQueueMutex);
     const boost::system_time timeout = boost::get_system_time() + wait_duration;
-    while (!data_ready) {
+    while (!sync_queue.pop(packet)) {
         if (!readPacketCond.timed_wait(l, timeout))
             throw (packet_exception(ERROR_TIMEOUT_SYNC_PACKET_STRING));
     }
-    data_ready = false;
-    return receive_pkg;
+}
+
+size_t PacketSerial::discardPackets() {
+    lock_guard<boost::mutex> l(readQueueMutex);
+    size_t dropped = sync_queue.clear();
+    if (dropped != 0)
+        link_statistics.error(ERROR_STALE_PACKET, dropped);
+    return dropped;
+}
+
+unsigned char PacketSerial::requestPacket(const packet_t& packet, write_priority_t priority,
+        const boost::posix_time::millisec& wait_duration) {
+    return requestPacket(packet.buffer, packet.length, priority, wait_duration);
+}
+
+unsigned char PacketSerial::requestPacket(const unsigned char* data, size_t length,
+        write_priority_t priority, const boost::posix_time::millisec& wait_duration) {
+    if (length > MAX_BUFF_RX - 1)
+        throw (packet_exception(ERROR_CREATE_PKG_STRING));
+    unsigned char id;
+    if (!requestimpl->begin(boost::get_system_time() + wait_duration, id))
+        throw (packet_exception(ERROR_TIMEOUT_SYNC_PACKET_STRING));
+    try {
+        //The id is the first byte of the data
+        size_t sequence = writeFrame(HEADER_SYNC_ID, &id, 1, data, length, priority);
+        requestimpl->sent(id, sequence, priority);
+    } catch (...) {
+        requestimpl->cancel(id);
+        throw;
+    }
+    return id;
+}
+
+packet_t PacketSerial::waitReply(unsigned char id, const boost::posix_time::millisec& wait_duration) {
+    packet_t reply;
+    waitReply(id, reply, wait_duration);
+    return reply;
+}
+
+void PacketSerial::waitReply(unsigned char id, packet_t& reply, const boost::posix_time::millisec& wait_duration) {
+    size_t sequence;
+    write_priority_t priority;
+    if (!requestimpl->wait(id, boost::get_system_time() + wait_duration, reply, sequence, priority))
+        throw (packet_exception(ERROR_TIMEOUT_SYNC_PACKET_STRING));
+    reply.time_sent = writeTimestamp(sequence, priority);
+}
+
+void PacketSerial::cancelRequest(unsigned char id) {
+    requestimpl->cancel(id);
+}
+
+void PacketSerial::setDispatchThreads(unsigned int threads, size_t queue) {
+    pkgimpl->setDispatchThreads(threads, queue);
+}
+
+std::vector<dispatch_statistics_t> PacketSerial::getDispatchStatistics() const {
+    return pkgimpl->dispatchStatistics();
+}
+
+void PacketSerial::setFrameCheck(frame_check_t check) {
+    frame_check.store(check, memory_order_relaxed);
+}
+
+frame_check_t PacketSerial::frameCheck() const {
+    return (frame_check_t) frame_check.load(memory_order_relaxed);
+}
+
+void PacketSerial::setFrameFormat(frame_format_t format) {
+    frame_format.store(format, memory_order_relaxed);
+}
+
+frame_format_t PacketSerial::frameFormat() const {
+    return (frame_format_t) frame_format.load(memory_order_relaxed);
+}
+
+void PacketSerial::setSyncWindow(size_t requests) {
+    requestimpl->setWindow(requests);
+}
+
+size_t PacketSerial::syncWindow() const {
+    return requestimpl->getWindow();
 }
 
 void PacketSerial::setAsyncPacketCallback(const boost::function<void (const packet_t*) >& callback) {
     pkgimpl->addAsyncCallback(callback);
 }
 
-void PacketSerial::clearAsyncPacketCallback() {
-    pkgimpl->clearAllAsyncCallback();
+void PacketSerial::setAsyncBatchCallback(const boost::function<void (const packet_t*, size_t) >& callback) {
+    pkgimpl->addBatchCallback(callback);
 }
 
-std::map<std::string, int> PacketSerial::getMapError() {
-    return map_error;
+void PacketSerial::setMessageCallback(const boost::function<void (const unsigned char*, size_t) >& callback) {
+    pkgimpl->addMessageCallback(callback);
 }
 
-bool PacketSerial::decode_pkgs(unsigned char rxchar) {
-    return ((*this).*pkg_parse)(rxchar);
+void PacketSerial::clearAsyncPacketCallback() {
+    pkgimpl->clearAllAsyncCallback();
 }
 
-bool PacketSerial::pkg_header(unsigned char rxchar) {
-    if (rxchar == HEADER_SYNC) {
-        async = false;
-        pkg_parse = &PacketSerial::pkg_length;
-        return false;
-    } else if (rxchar == HEADER_ASYNC) {
-        async = true;
-        pkg_parse = &PacketSerial::pkg_length;
-        return false;
-    } else {
-        throw (packet_exception(ERROR_HEADER_STRING));
+std::map<std::string, int> PacketSerial::getMapError() const {
+    static const char* names[LINK_ERRORS] = {NULL,
+        ERROR_FRAMMING_STRING, ERROR_OVERRUN_STRING, ERROR_HEADER_STRING,
+        ERROR_LENGTH_STRING, ERROR_DATA_STRING, ERROR_CKS_STRING,
+        ERROR_CMD_STRING, ERROR_NACK_STRING, ERROR_OPTION_STRING,
+        ERROR_PKG_STRING, ERROR_CREATE_PKG_STRING,
+        ERROR_TIMEOUT_SYNC_PACKET_STRING, ERROR_SYNC_QUEUE_FULL_STRING,
+        ERROR_STALE_PACKET_STRING,
+        ERROR_MAX_ASYNC_CALLBACK_STRING, ERROR_DISPATCH_QUEUE_FULL_STRING,
+        ERROR_FRAGMENT_STRING};
+    link_statistics_t statistics = link_statistics.snapshot();
+    std::map<std::string, int> map_error;
+    for (int i = 0; i < LINK_ERRORS; ++i) {
+        if (names[i] != NULL)
+            map_error[names[i]] = (int) statistics.errors[i];
     }
+    return map_error;
 }
 
-bool PacketSerial::pkg_length(unsigned char rxchar) {
-    if (rxchar > MAX_BUFF_RX) {
-        throw (packet_exception(ERROR_LENGTH_STRING));
-    } else {
-        pkg_parse = &PacketSerial::pkg_data;
-        index_data = 0;
-        receive_pkg.length = rxchar;
-        return false;
-    }
-}
-
-bool PacketSerial::pkg_data(unsigned char rxchar) {
-    unsigned char cks_clc;
-    if ((index_data + 1) == (receive_pkg.length + 1)) {
-        pkg_parse = &PacketSerial::pkg_header; //Restart parse serial packet
-        if ((cks_clc = pkg_checksum(receive_pkg.buffer, 0, index_data)) == rxchar) {
-            //checksum data
-            index_data = 0; //flush index array data buffer
-            return true;
-        } else {
-            //      std::cerr << "CKS ric: " << rxchar << " - " << "calc: " << cks_clc << std::endl;
-            throw (packet_exception(ERROR_CKS_STRING));
-        }
-    } else {
-        receive_pkg.buffer[index_data] = rxchar;
-        index_data++;
-        return false;
-    }
+link_statistics_t PacketSerial::getLinkStatistics() const {
+    return link_statistics.snapshot();
 }
 
-unsigned char PacketSerial::pkg_checksum(volatile unsigned char* Buffer, int FirstIndx, int LastIndx) {
-    unsigned char ChkSum = 0;
-    int ChkCnt;
-    for (ChkCnt = FirstIndx; ChkCnt < LastIndx; ChkCnt++) {
-        ChkSum += Buffer[ChkCnt];
-    }
-    return ChkSum;
+link_statistics_t PacketSerial::getLinkStatistics(link_statistics_t& previous) const {
+    link_statistics_t now = link_statistics.snapshot();
+    link_statistics_t delta = LinkStatistics::delta(now, previous);
+    previous = now;
+    return delta;
 }
 
 PacketSerial::~PacketSerial() {
     clearReadCallback();
-
-    delete [] BufferTx;
 }
@@ -24,18 +24,21 @@ using namespace boost;
 class ParserPacketImpl {
 public:
 
-    ParserPacketImpl() : counter_default(0), counter_error(0) {
+    ParserPacketImpl() : counter_default(0), counter_error(0), counter_batch(0) {
     }
 
-    void sendPacket(std::vector<packet_information_t> list_packet) {
-        for (vector<packet_information_t>::iterator list_iter = list_packet.begin(); list_iter != list_packet.end(); ++list_iter) {
-            packet_information_t packet = (*list_iter);
-            switch (packet.option) {
+    void sendPacket(const unsigned char* buffer, size_t size) {
+        //The messages are read in place, nothing is allocated
+        MessageIterator messages(buffer, size);
+        MessageView view;
+        message_abstract_u aligned;
+        while (messages.next(view)) {
+            switch (view.option()) {
                 case PACKET_NACK:
-                    sendDataCallBack(counter_error, packet.command, &packet.message, data_error_packet_functions);
+                    sendDataCallBack(counter_error, view.command(), view.message(aligned), data_error_packet_functions);
                     break;
                 case PACKET_DATA:
-                    sendToCallback(&packet);
+                    sendToCallback(view.type(), view.command(), view.message(aligned));
                     break;
             }
         }
@@ -65,10 +68,36 @@ public:
         clearCallback(&counter_error, data_error_packet_functions);
     }
 
+    void addBatchCallback(const boost::function<void (const std::vector<packet_information_t>&) >& callback) {
+        if (counter_batch == NUMBER_CALLBACK)
+            throw (parser_exception("Max callback packet Batch"));
+        data_batch_functions[counter_batch++] = callback;
+    }
+
+    void clearBatchCallback() {
+        for (unsigned int i = 0; i < counter_batch; ++i)
+            data_batch_functions[i].clear();
+        counter_batch = 0;
+    }
+
+    bool hasBatchCallback() const {
+        return counter_batch != 0;
+    }
+
+    void sendBatch(const std::vector<packet_information_t>& list_packet) {
+        for (unsigned int i = 0; i < counter_batch; ++i) {
+            const callback_batch_t& callback = data_batch_functions[i];
+            if (callback)
+                callback(list_packet);
+        }
+    }
+
 private:
 
     /// Read complete callback - Array of callback
     typedef boost::function<void (const unsigned char&, const message_abstract_u*) > callback_data_packet_t;
+    /// Messages of a read - Array of callback
+    typedef boost::function<void (const std::vector<packet_information_t>&) > callback_batch_t;
 
     void clearCallback(unsigned int* counter, boost::array<callback_data_packet_t, NUMBER_CALLBACK >& array) {
         for (unsigned int i = 0; i < (*counter); ++i) {
@@ -86,16 +115,16 @@ private:
         }
     }
 
-    void sendToCallback(packet_information_t* packet) {
-        if (packet->type == HASHMAP_SYSTEM) {
-            sendDataCallBack(counter_default, packet->command, &packet->message, data_default_packet_functions);
-        } else if (packet->type == type)
-            if (data_other_packet_callback) data_other_packet_callback(packet->command, &packet->message);
+    void sendToCallback(unsigned char packet_type, unsigned char command, const message_abstract_u* packet) {
+        if (packet_type == HASHMAP_SYSTEM) {
+            sendDataCallBack(counter_default, command, packet, data_default_packet_functions);
+        } else if (packet_type == type)
+            if (data_other_packet_callback) data_other_packet_callback(command, packet);
     }
 
-    void sendDataCallBack(unsigned int counter, unsigned char& command, message_abstract_u* packet, boost::array<callback_data_packet_t, NUMBER_CALLBACK > array) {
+    void sendDataCallBack(unsigned int counter, const unsigned char& command, const message_abstract_u* packet, const boost::array<callback_data_packet_t, NUMBER_CALLBACK >& array) {
         for (unsigned int i = 0; i < counter; ++i) {
-            callback_data_packet_t callback = array[i];
+            const callback_data_packet_t& callback = array[i];
             if (callback)
                 callback(command, packet);
         }
@@ -105,14 +134,29 @@ private:
     callback_data_packet_t data_other_packet_callback;
     boost::array<callback_data_packet_t, NUMBER_CALLBACK > data_default_packet_functions;
     boost::array<callback_data_packet_t, NUMBER_CALLBACK > data_error_packet_functions;
+    unsigned int counter_batch;
+    boost::array<callback_batch_t, NUMBER_CALLBACK > data_batch_functions;
 };
 
-ParserPacket::ParserPacket() : PacketSerial(), parser_impl(new ParserPacketImpl) {
+/**
+ * Append the messages of a buffer to a list
+ */
+static void appendMessages(const unsigned char* buffer, size_t size, vector<packet_information_t>& list_data) {
+    MessageIterator messages(buffer, size);
+    MessageView view;
+    while (messages.next(view)) {
+        list_data.resize(list_data.size() + 1);
+        memcpy(&list_data.back(), view.data(), view.size());
+    }
+}
+
+ParserPacket::ParserPacket() : PacketSerial(), sync_ids(false), batch_registered(false), parser_impl(new ParserPacketImpl) {
     HASHMAP_SYSTEM_INITIALIZE
     HASHMAP_MOTION_INITIALIZE
     HASHMAP_MOTOR_INITIALIZE
     HASHMAP_NAVIGATION_INITIALIZE
     setAsyncPacketCallback(&ParserPacket::actionAsync, this);
+    setMessageCallback(&ParserPacket::actionMessage, this);
 }
 
 ParserPacket::ParserPacket(const std::string& devname,
@@ -121,101 +165,293 @@ ParserPacket::ParserPacket(const std::string& devname,
         asio::serial_port_base::character_size opt_csize,
         asio::serial_port_base::flow_control opt_flow,
         asio::serial_port_base::stop_bits opt_stop)
-: PacketSerial(devname, baud_rate, opt_parity, opt_csize, opt_flow, opt_stop), parser_impl(new ParserPacketImpl) {
+: PacketSerial(devname, baud_rate, opt_parity, opt_csize, opt_flow, opt_stop), sync_ids(false), batch_registered(false), parser_impl(new ParserPacketImpl) {
     HASHMAP_SYSTEM_INITIALIZE
     HASHMAP_MOTION_INITIALIZE
     HASHMAP_MOTOR_INITIALIZE
     HASHMAP_NAVIGATION_INITIALIZE
     setAsyncPacketCallback(&ParserPacket::actionAsync, this);
+    setMessageCallback(&ParserPacket::actionMessage, this);
 }
 
-void ParserPacket::sendAsyncPacket(packet_t packet) {
+void ParserPacket::sendAsyncPacket(const packet_t& packet) {
     if (packet.length != 0)
-        writePacket(packet, HEADER_ASYNC);
+        writePacket(packet, HEADER_ASYNC, packetPriority(packet));
+}
+
+packet_t ParserPacket::sendSyncPacket(const packet_t& packet, const unsigned int repeat, const boost::posix_time::millisec& wait_duration) {
+    packet_t reply;
+    sendSyncPacket(packet, reply, repeat, wait_duration);
+    return reply;
 }
 
-packet_t ParserPacket::sendSyncPacket(packet_t packet, const unsigned int repeat, const boost::posix_time::millisec& wait_duration) {
+void ParserPacket::sendSyncPacket(const packet_t& packet, packet_t& reply, const unsigned int repeat, const boost::posix_time::millisec& wait_duration) {
+    write_priority_t priority = packetPriority(packet);
+    if (sync_ids.load(memory_order_relaxed)) {
+        //The reply is matched by id, the other requests don't wait
+        unsigned char id = requestPacket(packet, priority, wait_duration);
+        flush();
+        waitSyncReply(id, reply, repeat, wait_duration);
+        return;
+    }
     lock_guard<boost::mutex> l(readPacketMutex);
-    writePacket(packet);
+    //A reply already queued belongs to an older request
+    discardPackets();
+    size_t sequence = writePacket(packet, HEADER_SYNC, priority);
+    flush(); //Don't wait for the coalescing delay, the reply is awaited
+    readSyncReply(sequence, priority, reply, repeat, wait_duration);
+}
+
+void ParserPacket::sendAsyncPacket(PreparedCommand& command) {
+    if (command.header() != HEADER_ASYNC)
+        throw (packet_exception(ERROR_PKG_STRING));
+    writePrepared(command);
+}
+
+void ParserPacket::sendSyncPacket(PreparedCommand& command, packet_t& reply, const unsigned int repeat, const boost::posix_time::millisec& wait_duration) {
+    if (command.header() != HEADER_SYNC)
+        throw (packet_exception(ERROR_PKG_STRING));
+    if (sync_ids.load(memory_order_relaxed)) {
+        unsigned char id = requestPacket(command.data(), command.length(), command.priority(), wait_duration);
+        flush();
+        waitSyncReply(id, reply, repeat, wait_duration);
+        return;
+    }
+    lock_guard<boost::mutex> l(readPacketMutex);
+    discardPackets();
+    size_t sequence = writePrepared(command);
+    flush();
+    readSyncReply(sequence, command.priority(), reply, repeat, wait_duration);
+}
+
+void ParserPacket::waitSyncReply(unsigned char id, packet_t& reply, const unsigned int repeat, const boost::posix_time::millisec& wait_duration) {
+    try {
+        waitReply(id, reply, posix_time::millisec(wait_duration.total_milliseconds() * (repeat + 1)));
+    } catch (packet_exception&) {
+        syncTimeout(repeat);
+    }
+}
+
+void ParserPacket::readSyncReply(size_t sequence, write_priority_t priority, packet_t& reply, const unsigned int repeat, const boost::posix_time::millisec& wait_duration) {
     for (int i = 0; i <= repeat; ++i) {
         try {
-            return readPacket(wait_duration);
+            readPacket(reply, wait_duration);
+            reply.time_sent = writeTimestamp(sequence, priority);
+            return;
         } catch (...) {
             //Repeat message
         }
     }
-    map_error[ERROR_TIMEOUT_SYNC_PACKET_STRING] = map_error[ERROR_TIMEOUT_SYNC_PACKET_STRING] + 1;
+    syncTimeout(repeat);
+}
+
+vector<packet_t> ParserPacket::sendSyncPackets(const vector<packet_t>& packets, const unsigned int repeat, const boost::posix_time::millisec& wait_duration) {
+    vector<packet_t> replies(packets.size());
+    if (!sync_ids.load(memory_order_relaxed)) {
+        for (size_t i = 0; i < packets.size(); ++i)
+            sendSyncPacket(packets[i], replies[i], repeat, wait_duration);
+        return replies;
+    }
+    const posix_time::millisec reply_duration(wait_duration.total_milliseconds() * (repeat + 1));
+    vector<unsigned char> ids(packets.size());
+    size_t sent = 0, received = 0;
+    try {
+        while (received < packets.size()) {
+            //Fill the window, then wait for the oldest reply
+            size_t window = syncWindow();
+            if (sent < packets.size() && sent - received < window) {
+                while (sent < packets.size() && sent - received < window) {
+                    ids[sent] = requestPacket(packets[sent], packetPriority(packets[sent]), wait_duration);
+                    ++sent;
+                }
+                flush();
+            }
+            waitReply(ids[received], replies[received], reply_duration);
+            ++received;
+        }
+    } catch (packet_exception&) {
+        //End the requests still in flight, their replies will be stale
+        for (size_t i = received; i < sent; ++i)
+            cancelRequest(ids[i]);
+        syncTimeout(repeat);
+    }
+    return replies;
+}
+
+void ParserPacket::setSyncIds(bool enable) {
+    sync_ids.store(enable, memory_order_relaxed);
+}
+
+void ParserPacket::syncTimeout(const unsigned int repeat) {
+    link_statistics.error(ERROR_TIMEOUT_SYNC_PACKET);
     ostringstream convert; // stream used for the conversion
     convert << repeat; // insert the textual representation of 'repeat' in the characters in the stream
     throw (parser_exception("Timeout sync packet n: " + convert.str()));
 }
 
 void ParserPacket::actionAsync(const packet_t* packet) {
-    parser_impl->sendPacket(parsing(*packet));
+    //Called by one thread only, the I/O thread or a dispatch thread
+    parser_impl->sendPacket(packet->buffer, packet->length);
+}
+
+void ParserPacket::actionBatch(const packet_t* packets, size_t count) {
+    if (!parser_impl->hasBatchCallback())
+        return;
+    batch_list.clear();
+    for (size_t i = 0; i < count; ++i)
+        appendMessages(packets[i].buffer, packets[i].length, batch_list);
+    parser_impl->sendBatch(batch_list);
 }
 
-void ParserPacket::parserSendPacket(vector<packet_information_t> list_send, const unsigned int repeat, const boost::posix_time::millisec& wait_duration) {
+void ParserPacket::actionMessage(const unsigned char* message, size_t length) {
+    //Called by the thread of actionAsync, both are the first callbacks
+    parser_impl->sendPacket(message, length);
+}
+
+size_t ParserPacket::sendMessages(const packet_information_t *list_send, size_t len, write_priority_t priority) {
+    lock_guard<boost::mutex> l(sendMessagesMutex);
+    encoder(list_send, len, send_buffer);
+    if (send_buffer.empty())
+        return 0;
+    if (send_buffer.size() <= MAX_BUFF_RX) {
+        writePacket(&send_buffer[0], send_buffer.size(), HEADER_ASYNC, priority);
+        return 1;
+    }
+    return writeMessage(&send_buffer[0], send_buffer.size(), priority);
+}
+
+size_t ParserPacket::sendMessages(const vector<packet_information_t>& list_send, write_priority_t priority) {
+    return sendMessages(list_send.empty() ? NULL : &list_send[0], list_send.size(), priority);
+}
+
+void ParserPacket::parserSendPacket(const vector<packet_information_t>& list_send, const unsigned int repeat, const boost::posix_time::millisec& wait_duration) {
     if (!list_send.empty()) {
-        packet_t packet = encoder(list_send);
-        packet_t receive = sendSyncPacket(packet, repeat, wait_duration);
-        parser_impl->sendPacket(parsing(receive));
+        packet_t packet, receive;
+        encoder(&list_send[0], list_send.size(), packet);
+        sendSyncPacket(packet, receive, repeat, wait_duration);
+        parser_impl->sendPacket(receive.buffer, receive.length);
     }
 }
 
-void ParserPacket::parserSendPacket(packet_information_t send, const unsigned int repeat, const boost::posix_time::millisec& wait_duration) {
+void ParserPacket::parserSendPacket(const packet_information_t& send, const unsigned int repeat, const boost::posix_time::millisec& wait_duration) {
     if (send.length != 0) {
-        packet_t packet = encoder(send);
-        packet_t receive = sendSyncPacket(packet, repeat, wait_duration);
-        parser_impl->sendPacket(parsing(receive));
+        packet_t packet, receive;
+        encoder(&send, 1, packet);
+        sendSyncPacket(packet, receive, repeat, wait_duration);
+        parser_impl->sendPacket(receive.buffer, receive.length);
     }
 }
 
-vector<packet_information_t> ParserPacket::parsing(packet_t packet_receive) {
-    int i;
+void ParserPacket::parserSendPacket(PreparedCommand& command, const unsigned int repeat, const boost::posix_time::millisec& wait_duration) {
+    packet_t receive;
+    sendSyncPacket(command, receive, repeat, wait_duration);
+    parser_impl->sendPacket(receive.buffer, receive.length);
+}
+
+vector<packet_information_t> ParserPacket::parsing(const packet_t& packet_receive) {
     vector<packet_information_t> list_data;
-    for (i = 0; i < packet_receive.length;) {
-        packet_buffer_u buffer_packet;
-        memcpy(&buffer_packet.buffer, &packet_receive.buffer[i], packet_receive.buffer[i]);
-        list_data.push_back(buffer_packet.packet_information);
-        i += packet_receive.buffer[i];
-    }
+    parsing(packet_receive, list_data);
     return list_data;
 }
 
-packet_t ParserPacket::encoder(vector<packet_information_t> list_send) {
+void ParserPacket::parsing(const packet_t& packet_receive, vector<packet_information_t>& list_data) {
+    list_data.clear();
+    appendMessages(packet_receive.buffer, packet_receive.length, list_data);
+}
+
+packet_t ParserPacket::encoder(const vector<packet_information_t>& list_send) {
     packet_t packet_send;
-    packet_send.length = 0;
-    for (vector<packet_information_t>::iterator list_iter = list_send.begin(); list_iter != list_send.end(); ++list_iter) {
-        packet_buffer_u buffer_packet;
-        buffer_packet.packet_information = (*list_iter);
-        memcpy(&packet_send.buffer[packet_send.length], &buffer_packet.buffer, buffer_packet.packet_information.length);
+    encoder(list_send.empty() ? NULL : &list_send[0], list_send.size(), packet_send);
+    return packet_send;
+}
 
-        packet_send.length += buffer_packet.packet_information.length;
-    }
+packet_t ParserPacket::encoder(const packet_information_t *list_send, size_t len) {
+    packet_t packet_send;
+    encoder(list_send, len, packet_send);
     return packet_send;
 }
 
-packet_t ParserPacket::encoder(packet_information_t *list_send, size_t len) {
+packet_t ParserPacket::encoder(const packet_information_t& send) {
     packet_t packet_send;
+    encoder(&send, 1, packet_send);
+    return packet_send;
+}
+
+void ParserPacket::encoder(const packet_information_t *list_send, size_t len, packet_t& packet_send) {
     packet_send.length = 0;
-    for (int i = 0; i < len; ++i) {
-        packet_buffer_u buffer_packet;
-        buffer_packet.packet_information = list_send[i];
+    for (size_t i = 0; i < len; ++i) {
+        // The message is laid out as packet_buffer_u, its length first
+        size_t length = list_send[i].length;
+        if (packet_send.length + length > MAX_BUFF_RX)
+            throw (packet_exception(ERROR_CREATE_PKG_STRING));
+        memcpy(&packet_send.buffer[packet_send.length], &list_send[i], length);
+        packet_send.length += length;
+    }
+}
 
-        memcpy(&packet_send.buffer[packet_send.length], &buffer_packet.buffer, buffer_packet.packet_information.length);
+void ParserPacket::encoder(const packet_information_t *list_send, size_t len, vector<unsigned char>& message) {
+    message.clear();
+    for (size_t i = 0; i < len; ++i) {
+        const unsigned char* bytes = reinterpret_cast<const unsigned char*> (&list_send[i]);
+        message.insert(message.end(), bytes, bytes + list_send[i].length);
+    }
+}
 
-        packet_send.length += buffer_packet.packet_information.length;
+write_priority_t ParserPacket::packetPriority(const packet_t& packet) {
+    write_priority_t priority = WRITE_PRIORITY_BULK;
+    // Read the heads of the messages in place, as laid out by encoder()
+    for (unsigned int i = 0; i + LNG_HEAD_INFORMATION_PACKET <= packet.length && packet.buffer[i] != 0; i += packet.buffer[i]) {
+        unsigned char option = packet.buffer[i + 1];
+        unsigned char type = packet.buffer[i + 2];
+        unsigned char command = packet.buffer[i + 3];
+        if (option != PACKET_DATA)
+            continue;
+        if (type == HASHMAP_MOTOR) {
+            motor_command_map_t command_motor;
+            command_motor.command_message = command;
+            switch (command_motor.bitset.command) {
+                case MOTOR_STATE:
+                    if (i + LNG_HEAD_INFORMATION_PACKET < packet.length &&
+                            (motor_state_t) packet.buffer[i + LNG_HEAD_INFORMATION_PACKET] == STATE_CONTROL_EMERGENCY)
+                        return WRITE_PRIORITY_EMERGENCY;
+                    priority = WRITE_PRIORITY_CONTROL;
+                    break;
+                case MOTOR_REFERENCE:
+                case MOTOR_POS_REF:
+                case MOTOR_VEL_REF:
+                case MOTOR_CURRENT_REF:
+                    priority = WRITE_PRIORITY_CONTROL;
+                    break;
+            }
+        } else if (type == HASHMAP_MOTION) {
+            if (command == MOTION_STATE || command == MOTION_VEL_REF)
+                priority = WRITE_PRIORITY_CONTROL;
+        }
     }
-    return packet_send;
+    return priority;
 }
 
-packet_t ParserPacket::encoder(packet_information_t send) {
-    packet_t packet_send;
-    packet_send.length = send.length;
-    packet_buffer_u buffer_packet;
-    buffer_packet.packet_information = send;
-    memcpy(&packet_send.buffer, &buffer_packet.buffer, buffer_packet.packet_information.length);
-    return packet_send;
+PreparedCommand ParserPacket::prepareCommand(const vector<packet_information_t>& list_send, unsigned char header) {
+    packet_t packet;
+    encoder(list_send.empty() ? NULL : &list_send[0], list_send.size(), packet);
+    return PreparedCommand(header, packet.buffer, packet.length, frameCheck(), packetPriority(packet));
+}
+
+PreparedCommand ParserPacket::prepareCommand(const packet_information_t& send, unsigned char header) {
+    packet_t packet;
+    encoder(&send, 1, packet);
+    return PreparedCommand(header, packet.buffer, packet.length, frameCheck(), packetPriority(packet));
+}
+
+void ParserPacket::setCommandMessage(PreparedCommand& command, size_t message, const message_abstract_u* packet) {
+    //Walk the messages as laid out by encoder(), their length first
+    const unsigned char* data = command.data();
+    size_t offset = 0;
+    for (size_t i = 0; i < message && offset < command.length(); ++i)
+        offset += data[offset];
+    if (offset >= command.length() || data[offset] < LNG_HEAD_INFORMATION_PACKET)
+        throw (packet_exception(ERROR_CREATE_PKG_STRING));
+    command.set(offset + LNG_HEAD_INFORMATION_PACKET, packet, data[offset] - LNG_HEAD_INFORMATION_PACKET);
 }
 
 packet_information_t ParserPacket::createPacket(unsigned char command, unsigned char option, unsigned char type, message_abstract_u * packet) {
@@ -272,6 +508,18 @@ void ParserPacket::clearErrorCallback() {
     parser_impl->clearErrorCallback();
 }
 
+void ParserPacket::addBatchCallback(const boost::function<void (const std::vector<packet_information_t>&) >& callback) {
+    parser_impl->addBatchCallback(callback);
+    if (!batch_registered) {
+        setAsyncBatchCallback(&ParserPacket::actionBatch, this);
+        batch_registered = true;
+    }
+}
+
+void ParserPacket::clearBatchCallback() {
+    parser_impl->clearBatchCallback();
+}
+
 ParserPacket::~ParserPacket() {
     clearAsyncPacketCallback();
 }
@@ -0,0 +1,46 @@
+/*
+ * Copyright (C) 2014 Officine Robotiche
+ * Author: Raffaello Bonghi
+ * email:  raffaello.bonghi@officinerobotiche.it
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the GNU Lesser General Public License
+ * (LGPL) version 2.1 which accompanies this distribution, and is available at
+ * http://www.gnu.org/licenses/lgpl-2.1.html
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#include "serial_parser_packet/PreparedCommand.h"
+#include "serial_parser_packet/PacketSerial.h"
+#include <cstring>
+
+PreparedCommand::PreparedCommand() : frame_check(FRAME_CHECK_SUM), write_priority(WRITE_PRIORITY_CONTROL) {
+    frame_data[0] = HEADER_SYNC;
+    frame_data[1] = 0;
+    sealFrame(frame_data, HEAD_PKG, frame_check);
+}
+
+PreparedCommand::PreparedCommand(unsigned char header, const unsigned char* data, size_t length,
+        frame_check_t check, write_priority_t priority) : frame_check(check), write_priority(priority) {
+    if (length > MAX_BUFF_RX)
+        throw (packet_exception(ERROR_CREATE_PKG_STRING));
+    frame_data[0] = header;
+    frame_data[1] = length;
+    memcpy(&frame_data[HEAD_PKG], data, length);
+    sealFrame(frame_data, HEAD_PKG + length, frame_check);
+}
+
+void PreparedCommand::set(size_t offset, const void* data, size_t size) {
+    if (offset + size > length())
+        throw (packet_exception(ERROR_CREATE_PKG_STRING));
+    patchFrame(frame_data, HEAD_PKG + length(), HEAD_PKG + offset,
+            static_cast<const unsigned char*> (data), size, frame_check);
+}
+
+void PreparedCommand::seal(frame_check_t check) {
+    frame_check = check;
+    sealFrame(frame_data, HEAD_PKG + length(), frame_check);
+}
@@ -0,0 +1,48 @@
+/*
+ * Copyright (C) 2014 Officine Robotiche
+ * Author: Raffaello Bonghi
+ * email:  raffaello.bonghi@officinerobotiche.it
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the GNU Lesser General Public License
+ * (LGPL) version 2.1 which accompanies this distribution, and is available at
+ * http://www.gnu.org/licenses/lgpl-2.1.html
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#include "serial_parser_packet/RxRing.h"
+
+using namespace boost;
+
+RxRing::RxRing(size_t packets) : packets(new packet_t[packets]), capacity(packets), head(0), tail(0) {
+}
+
+bool RxRing::push(const packet_t& packet) {
+    size_t position = tail.load(memory_order_relaxed);
+    if (position - head.load(memory_order_acquire) >= capacity)
+        return false;
+    packets[position % capacity] = packet;
+    // The packet is visible to the consumer with the new tail
+    tail.store(position + 1, memory_order_release);
+    return true;
+}
+
+bool RxRing::pop(packet_t& packet) {
+    size_t position = head.load(memory_order_relaxed);
+    if (position == tail.load(memory_order_acquire))
+        return false;
+    packet = packets[position % capacity];
+    // The slot is free for the producer with the new head
+    head.store(position + 1, memory_order_release);
+    return true;
+}
+
+size_t RxRing::clear() {
+    size_t position = head.load(memory_order_relaxed);
+    size_t end = tail.load(memory_order_acquire);
+    head.store(end, memory_order_release);
+    return end - position;
+}
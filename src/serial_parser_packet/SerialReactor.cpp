@@ -0,0 +1,158 @@
+/*
+ * Copyright (C) 2014 Officine Robotiche
+ * Author: Raffaello Bonghi
+ * email:  raffaello.bonghi@officinerobotiche.it
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the GNU Lesser General Public License
+ * (LGPL) version 2.1 which accompanies this distribution, and is available at
+ * http://www.gnu.org/licenses/lgpl-2.1.html
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#include "serial_parser_packet/SerialReactor.h"
+
+#include <cerrno>
+#include <boost/bind.hpp>
+#include <boost/version.hpp>
+
+#ifdef __linux__
+#include <alloca.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#endif
+
+using namespace std;
+using namespace boost;
+
+SerialReactor::SerialReactor(unsigned int threads) : own_io(new asio::io_service(threads)), io(*own_io),
+work(new asio::io_service::work(io)), options(defaultThreadOptions()), started(0) {
+    start(threads);
+}
+
+SerialReactor::SerialReactor(unsigned int threads, const reactor_thread_options_t& thread_options) :
+own_io(new asio::io_service(threads)), io(*own_io), work(new asio::io_service::work(io)), options(thread_options), started(0) {
+    start(threads);
+}
+
+SerialReactor::SerialReactor(asio::io_service& app_io) : own_io(), io(app_io), work(),
+options(defaultThreadOptions()), started(0) {
+}
+
+SerialReactor::~SerialReactor() {
+    work.reset();
+    if (own_io)
+        io.stop();
+    for (vector<thread*>::iterator it = workers.begin(); it != workers.end(); ++it) {
+        (*it)->join();
+        delete (*it);
+    }
+}
+
+std::vector<reactor_thread_status_t> SerialReactor::threadStatus() const {
+    lock_guard<mutex> l(statusMutex);
+    return status;
+}
+
+reactor_thread_options_t SerialReactor::defaultThreadOptions() {
+    reactor_thread_options_t options;
+    options.priority = 0;
+    options.lock_memory = false;
+    options.prefault_stack = 0;
+    return options;
+}
+
+void SerialReactor::start(unsigned int threads) {
+    if (threads == 0)
+        threads = 1;
+    status.resize(threads);
+    for (unsigned int i = 0; i < threads; ++i) {
+        workers.push_back(new thread(boost::bind(&SerialReactor::worker, this, i)));
+    }
+    // The status is complete when the constructor returns
+    unique_lock<mutex> l(statusMutex);
+    while (started < threads)
+        startedCond.wait(l);
+}
+
+void SerialReactor::worker(unsigned int index) {
+    reactor_thread_status_t thread_status = applyOptions(index);
+    {
+        lock_guard<mutex> l(statusMutex);
+        status[index] = thread_status;
+        started++;
+    }
+    startedCond.notify_all();
+    io.run();
+}
+
+reactor_thread_status_t SerialReactor::applyOptions(unsigned int index) {
+    reactor_thread_status_t thread_status;
+    thread_status.cpu = -1;
+    thread_status.policy = 0;
+    thread_status.priority = 0;
+    thread_status.memory_locked = false;
+    thread_status.affinity_error = 0;
+    thread_status.priority_error = 0;
+    thread_status.lock_error = 0;
+
+#ifdef __linux__
+    thread_status.policy = SCHED_OTHER;
+    pthread_t self = pthread_self();
+    if (!options.cpus.empty()) {
+        int cpu = options.cpus[index % options.cpus.size()];
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        thread_status.affinity_error = pthread_setaffinity_np(self, sizeof (set), &set);
+        if (thread_status.affinity_error == 0)
+            thread_status.cpu = cpu;
+    }
+    if (options.lock_memory) {
+        if (mlockall(MCL_CURRENT | MCL_FUTURE) == 0)
+            thread_status.memory_locked = true;
+        else
+            thread_status.lock_error = errno;
+    }
+    if (options.prefault_stack > 0) {
+        // Touch the stack now, so its pages are mapped (and locked)
+        volatile char* stack = static_cast<volatile char*> (alloca(options.prefault_stack));
+        for (size_t i = 0; i < options.prefault_stack; i += 1024)
+            stack[i] = 0;
+    }
+    if (options.priority > 0) {
+        struct sched_param param;
+        param.sched_priority = options.priority;
+        thread_status.priority_error = pthread_setschedparam(self, SCHED_FIFO, &param);
+    }
+    struct sched_param param;
+    if (pthread_getschedparam(self, &thread_status.policy, &param) == 0)
+        thread_status.priority = param.sched_priority;
+#else
+    if (!options.cpus.empty())
+        thread_status.affinity_error = ENOSYS;
+    if (options.lock_memory)
+        thread_status.lock_error = ENOSYS;
+    if (options.priority > 0)
+        thread_status.priority_error = ENOSYS;
+#endif
+    return thread_status;
+}
+
+bool SerialReactor::runningInThisThread() const {
+#if BOOST_VERSION >= 106600
+    // Also the threads of the application running an io_service it owns
+    if (io.get_executor().running_in_this_thread())
+        return true;
+#endif
+    thread::id id = this_thread::get_id();
+    for (vector<thread*>::const_iterator it = workers.begin(); it != workers.end(); ++it) {
+        if ((*it)->get_id() == id)
+            return true;
+    }
+    return false;
+}
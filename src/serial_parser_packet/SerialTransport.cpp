@@ -0,0 +1,127 @@
+/*
+ * Copyright (C) 2014 Officine Robotiche
+ * Author: Raffaello Bonghi
+ * email:  raffaello.bonghi@officinerobotiche.it
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the GNU Lesser General Public License
+ * (LGPL) version 2.1 which accompanies this distribution, and is available at
+ * http://www.gnu.org/licenses/lgpl-2.1.html
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#include "serial_parser_packet/SerialTransport.h"
+
+#include <cerrno>
+
+#ifdef BOOST_ASIO_HAS_POSIX_STREAM_DESCRIPTOR
+#include <fcntl.h>
+#include <stdlib.h>
+#include <termios.h>
+#include <unistd.h>
+#endif
+
+#ifdef BOOST_ASIO_HAS_LOCAL_SOCKETS
+#include <sys/socket.h>
+#endif
+
+using namespace std;
+using namespace boost;
+
+static void throwErrno(const char* what) {
+    throw (boost::system::system_error(boost::system::error_code(errno,
+            boost::system::system_category()), what));
+}
+
+SerialPortTransport::SerialPortTransport(asio::io_service& io, const std::string& devname,
+        unsigned int baud_rate,
+        asio::serial_port_base::parity opt_parity,
+        asio::serial_port_base::character_size opt_csize,
+        asio::serial_port_base::flow_control opt_flow,
+        asio::serial_port_base::stop_bits opt_stop)
+: StreamTransport<asio::serial_port>(io) {
+    stream.open(devname);
+    stream.set_option(asio::serial_port_base::baud_rate(baud_rate));
+    stream.set_option(opt_parity);
+    stream.set_option(opt_csize);
+    stream.set_option(opt_flow);
+    stream.set_option(opt_stop);
+}
+
+#ifdef BOOST_ASIO_HAS_POSIX_STREAM_DESCRIPTOR
+
+PtyTransport::PtyTransport(asio::io_service& io)
+: StreamTransport<asio::posix::stream_descriptor>(io), slave(-1) {
+    int master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (master < 0)
+        throwErrno("Failed to open pseudo terminal");
+    char name[128];
+    if (grantpt(master) < 0 || unlockpt(master) < 0 || ptsname_r(master, name, sizeof (name)) != 0) {
+        ::close(master);
+        throwErrno("Failed to unlock pseudo terminal");
+    }
+    slave = ::open(name, O_RDWR | O_NOCTTY);
+    if (slave < 0) {
+        ::close(master);
+        throwErrno("Failed to open pseudo terminal slave");
+    }
+    // No echo and no line discipline, bytes go through unchanged
+    struct termios attributes;
+    if (tcgetattr(slave, &attributes) == 0) {
+        cfmakeraw(&attributes);
+        tcsetattr(slave, TCSANOW, &attributes);
+    }
+    slave_name = name;
+    stream.assign(master);
+}
+
+PtyTransport::~PtyTransport() {
+    if (slave >= 0)
+        ::close(slave);
+}
+
+#endif
+
+#ifdef __linux__
+
+LinuxSerialTransport::LinuxSerialTransport(asio::io_service& io, const std::string& devname,
+        const linux_serial_options_t& options)
+: StreamTransport<asio::posix::stream_descriptor>(io) {
+    stream.assign(linuxSerialOpen(devname, options, serial_status));
+}
+
+#endif
+
+#ifdef BOOST_ASIO_HAS_LOCAL_SOCKETS
+
+SocketPairTransport::SocketPairTransport(asio::io_service& io)
+: StreamTransport<asio::local::stream_protocol::socket>(io), peer(-1) {
+    int fds[2];
+    if (::socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0)
+        throwErrno("Failed to create socketpair");
+    stream.assign(asio::local::stream_protocol(), fds[0]);
+    peer = fds[1];
+}
+
+SocketPairTransport::~SocketPairTransport() {
+    if (peer >= 0)
+        ::close(peer);
+}
+
+int SocketPairTransport::releasePeer() {
+    int fd = peer;
+    peer = -1;
+    return fd;
+}
+
+#endif
+
+TcpTransport::TcpTransport(asio::io_service& io, const std::string& host, const std::string& port)
+: StreamTransport<asio::ip::tcp::socket>(io) {
+    asio::ip::tcp::resolver resolver(io);
+    asio::connect(stream, resolver.resolve(asio::ip::tcp::resolver::query(host, port)));
+    stream.set_option(asio::ip::tcp::no_delay(true));
+}
@@ -0,0 +1,160 @@
+/*
+ * Copyright (C) 2014 Officine Robotiche
+ * Author: Raffaello Bonghi
+ * email:  raffaello.bonghi@officinerobotiche.it
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the GNU Lesser General Public License
+ * (LGPL) version 2.1 which accompanies this distribution, and is available at
+ * http://www.gnu.org/licenses/lgpl-2.1.html
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#include "serial_parser_packet/TxRing.h"
+
+using namespace std;
+using namespace boost;
+
+TxRing::TxRing(size_t size, size_t frames) : buffer(roundPowerOfTwo(size)), frames(new tx_frame_t[roundPowerOfTwo(frames)]),
+frame_count(roundPowerOfTwo(frames)) {
+    byte_mask = buffer.size() - 1;
+    frame_mask = frame_count - 1;
+    setLimit(0, 0);
+    clear();
+}
+
+bool TxRing::reserve(size_t size, tx_slot_t& slot) {
+    if (size == 0 || size > byteLimit())
+        return false;
+    uint64_t old_head = head.load(memory_order_acquire);
+    position_t begin, frame_head;
+    for (;;) {
+        frame_head = frameHead(old_head);
+        begin = byteHead(old_head);
+        position_t offset = begin & byte_mask;
+        // A slot is always contiguous: skip the end of the buffer if it is too short
+        if (offset + size > buffer.size())
+            begin += buffer.size() - offset;
+        position_t tail = byte_tail.load(memory_order_acquire);
+        position_t used = position_t(begin + size - tail);
+        // The skipped end is free when the ring is empty: counting it, a
+        // limit below twice the slot would refuse the slot forever
+        if (tail == byteHead(old_head))
+            used = size;
+        if (position_t(frame_head - frame_tail.load(memory_order_acquire)) >= frame_limit.load(memory_order_relaxed) ||
+                used > byte_limit.load(memory_order_relaxed)) {
+            // Full, unless another writer moved the head in the meantime
+            uint64_t new_head = head.load(memory_order_acquire);
+            if (new_head == old_head)
+                return false;
+            old_head = new_head;
+            continue;
+        }
+        if (head.compare_exchange_weak(old_head, makeHead(frame_head + 1, begin + size), memory_order_acq_rel))
+            break;
+    }
+
+    // The frame is invisible to the consumer until it is committed
+    tx_frame_t& frame = frames[frame_head & frame_mask];
+    frame.begin = begin;
+    frame.end = begin + size;
+
+    slot.data = &buffer[begin & byte_mask];
+    slot.size = size;
+    slot.index = frame_head;
+    return true;
+}
+
+void TxRing::commit(const tx_slot_t& slot) {
+    ready_bytes.fetch_add(slot.size, memory_order_relaxed);
+    frames[slot.index & frame_mask].committed.store(position_t(slot.index), memory_order_release);
+}
+
+size_t TxRing::claim(asio::const_buffer* spans, size_t max_spans, size_t max_bytes) {
+    size_t count = 0;
+    const char* span_begin = NULL;
+    size_t span_size = 0;
+    size_t claimed = 0;
+    position_t claim = frame_claim.load(memory_order_relaxed);
+    for (;; claim++) {
+        const tx_frame_t& frame = frames[claim & frame_mask];
+        if (frame.committed.load(memory_order_acquire) != claim)
+            break;
+        const char* data = &buffer[frame.begin & byte_mask];
+        size_t size = position_t(frame.end - frame.begin);
+        if (claimed > 0 && (claimed >= max_bytes || size > max_bytes - claimed))
+            break;
+        claimed += size;
+        if (span_begin != NULL && span_begin + span_size == data) {
+            // Adjacent to the previous frame, extend the span
+            span_size += size;
+        } else {
+            if (span_begin != NULL)
+                spans[count++] = asio::const_buffer(span_begin, span_size);
+            if (count == max_spans) {
+                span_begin = NULL;
+                break;
+            }
+            span_begin = data;
+            span_size = size;
+        }
+        ready_bytes.fetch_sub(size, memory_order_relaxed);
+    }
+    frame_claim.store(claim, memory_order_release);
+    if (span_begin != NULL)
+        spans[count++] = asio::const_buffer(span_begin, span_size);
+    return count;
+}
+
+void TxRing::release() {
+    position_t claim = frame_claim.load(memory_order_relaxed);
+    if (claim != frame_tail.load(memory_order_relaxed))
+        byte_tail.store(frames[(claim - 1) & frame_mask].end, memory_order_release);
+    frame_tail.store(claim, memory_order_release);
+}
+
+size_t TxRing::dropOldest() {
+    if (!ready())
+        return 0;
+    position_t claim = frame_claim.load(memory_order_relaxed);
+    const tx_frame_t& frame = frames[claim & frame_mask];
+    size_t size = position_t(frame.end - frame.begin);
+    ready_bytes.fetch_sub(size, memory_order_relaxed);
+    frame_claim.store(claim + 1, memory_order_release);
+    if (claim == frame_tail.load(memory_order_relaxed)) {
+        // Nothing in flight before it, free the room now
+        release();
+    }
+    return size;
+}
+
+void TxRing::clear() {
+    head.store(makeHead(0, 0));
+    byte_tail.store(0);
+    frame_claim.store(0);
+    frame_tail.store(0);
+    ready_bytes.store(0);
+    // Each frame looks committed one lap ago
+    for (size_t i = 0; i < frame_count; ++i)
+        frames[i].committed.store(position_t(i - frame_count));
+}
+
+void TxRing::setLimit(size_t bytes, size_t frames) {
+    byte_limit.store((bytes == 0 || bytes > buffer.size()) ? buffer.size() : bytes);
+    frame_limit.store((frames == 0 || frames > frame_count) ? frame_count : frames);
+}
+
+bool TxRing::ready() const {
+    position_t claim = frame_claim.load(memory_order_acquire);
+    return frames[claim & frame_mask].committed.load(memory_order_acquire) == claim;
+}
+
+size_t TxRing::roundPowerOfTwo(size_t value) {
+    size_t power = 1;
+    while (power < value)
+        power <<= 1;
+    return power;
+}
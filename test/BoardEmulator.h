@@ -0,0 +1,177 @@
+/*
+ * Copyright (C) 2014 Officine Robotiche
+ * Author: Raffaello Bonghi
+ * email:  raffaello.bonghi@officinerobotiche.it
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the GNU Lesser General Public License
+ * (LGPL) version 2.1 which accompanies this distribution, and is available at
+ * http://www.gnu.org/licenses/lgpl-2.1.html
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ */
+
+
+#ifndef BOARDEMULATOR_H
+#define	BOARDEMULATOR_H
+
+#include <pty.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+#include <cstdlib>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <boost/atomic.hpp>
+#include <boost/thread.hpp>
+#include <boost/utility.hpp>
+#include "serial_parser_packet/AsyncSerial.h"
+#include "serial_parser_packet/FramingCore.h"
+
+/**
+ * Board on the master side of a pseudo terminal: it echoes every sync frame
+ * ('#' and '$', the id included) after a delay and ignores the async ones.
+ * Some replies can be reordered, duplicated or sent late, to exercise the
+ * request ids of PacketSerial.
+ */
+class BoardEmulator : private boost::noncopyable {
+public:
+
+    /**
+     * Open the pseudo terminal and start the board
+     * @param delay_us delay of each reply
+     * @param reorder_pct percent of the replies held for one more delay, the
+     * following replies overtake them
+     * @param duplicate_pct percent of the replies sent twice
+     * @param late_pct percent of the replies sent after late_us
+     * @param late_us delay of the late replies
+     */
+    BoardEmulator(unsigned int delay_us, int reorder_pct = 0, int duplicate_pct = 0,
+            int late_pct = 0, unsigned int late_us = 0) :
+    delay_us(delay_us), reorder_pct(reorder_pct), duplicate_pct(duplicate_pct),
+    late_pct(late_pct), late_us(late_us), running(true), duplicates(0), lates(0) {
+        char name[64];
+        if (openpty(&master, &slave, name, NULL, NULL) != 0)
+            throw std::runtime_error("openpty failed");
+        struct termios options;
+        tcgetattr(master, &options);
+        cfmakeraw(&options);
+        tcsetattr(master, TCSANOW, &options);
+        port_name = name;
+        srand(42);
+        thread = boost::thread(&BoardEmulator::run, this);
+    }
+
+    ~BoardEmulator() {
+        running.store(false);
+        thread.join();
+        ::close(master);
+        ::close(slave);
+    }
+
+    /**
+     * @return device of the board, to open at any baud rate
+     */
+    const std::string& port() const {
+        return port_name;
+    }
+
+    /**
+     * @return replies sent twice so far
+     */
+    long duplicated() const {
+        return duplicates.load();
+    }
+
+    /**
+     * @return replies sent late so far
+     */
+    long late() const {
+        return lates.load();
+    }
+
+private:
+
+    typedef struct _reply {
+        uint64_t due;
+        std::vector<unsigned char> frame;
+    } reply_t;
+
+    void run() {
+        std::vector<unsigned char> input;
+        std::vector<reply_t> replies;
+        while (running.load()) {
+            struct pollfd event = {master, POLLIN, 0};
+            if (poll(&event, 1, 1) > 0 && (event.revents & POLLIN)) {
+                unsigned char buffer[4096];
+                ssize_t n = read(master, buffer, sizeof (buffer));
+                if (n > 0)
+                    input.insert(input.end(), buffer, buffer + n);
+            }
+            parse(input, replies);
+
+            // Send the replies due, in order
+            uint64_t now = AsyncSerial::monotonicTime();
+            std::vector<unsigned char> output;
+            for (size_t i = 0; i < replies.size();) {
+                if (replies[i].due <= now) {
+                    output.insert(output.end(), replies[i].frame.begin(), replies[i].frame.end());
+                    replies.erase(replies.begin() + i);
+                } else {
+                    ++i;
+                }
+            }
+            if (!output.empty() && write(master, &output[0], output.size()) != (ssize_t) output.size())
+                break;
+        }
+    }
+
+    /**
+     * Queue a reply for each complete sync frame of the input
+     */
+    void parse(std::vector<unsigned char>& input, std::vector<reply_t>& replies) {
+        size_t i = 0;
+        while (input.size() - i >= HEAD_PKG + 1) {
+            unsigned char header = input[i];
+            if (header != HEADER_SYNC && header != HEADER_SYNC_ID && header != HEADER_ASYNC) {
+                i++;
+                continue;
+            }
+            size_t size = HEAD_PKG + input[i + 1] + 1;
+            if (input.size() - i < size)
+                break;
+            if (header != HEADER_ASYNC) {
+                reply_t reply;
+                reply.due = AsyncSerial::monotonicTime() + delay_us;
+                reply.frame.assign(input.begin() + i, input.begin() + i + size);
+                if (rand() % 100 < late_pct) {
+                    reply.due += late_us;
+                    lates++;
+                } else if (rand() % 100 < reorder_pct) {
+                    reply.due += delay_us;
+                }
+                replies.push_back(reply);
+                if (rand() % 100 < duplicate_pct) {
+                    replies.push_back(reply);
+                    duplicates++;
+                }
+            }
+            i += size;
+        }
+        input.erase(input.begin(), input.begin() + i);
+    }
+
+    unsigned int delay_us;
+    int reorder_pct, duplicate_pct, late_pct;
+    unsigned int late_us;
+    int master, slave;
+    std::string port_name;
+    boost::atomic<bool> running;
+    boost::atomic<long> duplicates, lates;
+    boost::thread thread;
+};
+
+#endif	/* BOARDEMULATOR_H */
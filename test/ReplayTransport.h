@@ -0,0 +1,109 @@
+/*
+ * Copyright (C) 2014 Officine Robotiche
+ * Author: Raffaello Bonghi
+ * email:  raffaello.bonghi@officinerobotiche.it
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the GNU Lesser General Public License
+ * (LGPL) version 2.1 which accompanies this distribution, and is available at
+ * http://www.gnu.org/licenses/lgpl-2.1.html
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#ifndef REPLAYTRANSPORT_H
+#define	REPLAYTRANSPORT_H
+
+#include <cstring>
+#include <algorithm>
+#include <vector>
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+#include "serial_parser_packet/SerialTransport.h"
+
+/**
+ * Replays a stream a number of times, then holds the last read until cancel().
+ * The reads complete in place, in a loop, so that the parser and not the
+ * io_service is measured.
+ */
+class ReplayTransport : public SerialTransport {
+public:
+
+    ReplayTransport(boost::asio::io_service& io, const std::vector<unsigned char>& stream, size_t chunk, int repetitions) :
+    io(io), stream(stream), chunk(chunk), left(repetitions), offset(0), next(NULL), pending(NULL), running(false), open(true) {
+    }
+
+    void asyncReadSome(char* data, size_t size, const handler_t& handler) {
+        read_data = data;
+        read_size = size;
+        next = &handler;
+        if (running)
+            return;
+        running = true;
+        while (next != NULL) {
+            const handler_t* current = next;
+            next = NULL;
+            if (offset == stream.size()) {
+                offset = 0;
+                if (--left == 0) {
+                    boost::lock_guard<boost::mutex> l(mutex);
+                    pending = current;
+                    cond.notify_all();
+                    break;
+                }
+            }
+            size_t n = std::min(std::min(chunk, read_size), stream.size() - offset);
+            memcpy(read_data, &stream[offset], n);
+            offset += n;
+            (*current)(boost::system::error_code(), n);
+        }
+        running = false;
+    }
+
+    void asyncWrite(const TxBufferSequence& buffers, const handler_t& handler) {
+        io.post(boost::bind(handler, boost::system::error_code(), boost::asio::buffer_size(buffers)));
+    }
+
+    void cancel(boost::system::error_code& /*ec*/) {
+        boost::lock_guard<boost::mutex> l(mutex);
+        if (pending != NULL)
+            io.post(boost::bind(*pending, boost::asio::error::operation_aborted, 0));
+        pending = NULL;
+    }
+
+    void close(boost::system::error_code& ec) {
+        cancel(ec);
+        open = false;
+    }
+
+    bool isOpen() const {
+        return open;
+    }
+
+    /**
+     * Wait the end of the last repetition
+     */
+    void wait() {
+        boost::unique_lock<boost::mutex> l(mutex);
+        while (pending == NULL)
+            cond.wait(l);
+    }
+
+private:
+    boost::asio::io_service& io;
+    const std::vector<unsigned char>& stream;
+    size_t chunk;
+    int left;
+    size_t offset;
+    char* read_data;
+    size_t read_size;
+    const handler_t* next;
+    const handler_t* pending;
+    bool running, open;
+    boost::mutex mutex;
+    boost::condition_variable cond;
+};
+
+#endif	/* REPLAYTRANSPORT_H */
@@ -0,0 +1,181 @@
+/*
+ * Copyright (C) 2014 Officine Robotiche
+ * Author: Raffaello Bonghi
+ * email:  raffaello.bonghi@officinerobotiche.it
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the GNU Lesser General Public License
+ * (LGPL) version 2.1 which accompanies this distribution, and is available at
+ * http://www.gnu.org/licenses/lgpl-2.1.html
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ */
+
+
+/*
+ * Cost and strength of the frame checks:
+ * * ns per call of the sum, CRC-16 and CRC-32C kernels
+ * * receive throughput of PacketSerial with each check, on a clean line and
+ *   with noise between the frames
+ * * frames with two swapped or offsetting data bytes accepted by each check
+ *
+ * Usage: bench_frame_check [repetitions]
+ */
+
+#include "serial_parser_packet/PacketSerial.h"
+#include "serial_parser_packet/FrameChecksum.h"
+#include "ReplayTransport.h"
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+using namespace std;
+
+static const char* check_names[] = {"sum", "crc16", "crc32c"};
+
+static void measureKernels() {
+    unsigned char data[256];
+    for (size_t i = 0; i < sizeof (data); ++i)
+        data[i] = rand();
+    cout << "kernels: sum " << frameChecksumKernel() << ", crc16 " << frameCrc16Kernel()
+            << ", crc32c " << frameCrc32cKernel() << endl;
+    size_t sizes[] = {8, 64, 200};
+    for (int k = 0; k < 3; ++k) {
+        size_t size = sizes[k];
+        long calls = 20000000 / (size / 8 + 1);
+        volatile unsigned int sink = 0;
+        uint64_t start = AsyncSerial::monotonicTime();
+        for (long i = 0; i < calls; ++i)
+            sink += frameChecksum(data, size);
+        uint64_t sum = AsyncSerial::monotonicTime() - start;
+        start = AsyncSerial::monotonicTime();
+        for (long i = 0; i < calls; ++i)
+            sink += frameCrc16(data, size);
+        uint64_t crc16 = AsyncSerial::monotonicTime() - start;
+        start = AsyncSerial::monotonicTime();
+        for (long i = 0; i < calls; ++i)
+            sink += frameCrc32c(data, size);
+        uint64_t crc32c = AsyncSerial::monotonicTime() - start;
+        cout << size << " bytes, ns per call: sum " << sum * 1000.0 / calls << ", crc16 "
+                << crc16 * 1000.0 / calls << ", crc32c " << crc32c * 1000.0 / calls << endl;
+    }
+}
+
+/**
+ * Append an asynchronous frame, its data starts with "OK"
+ */
+static void appendFrame(vector<unsigned char>& stream, size_t length, frame_check_t check) {
+    size_t begin = stream.size();
+    stream.push_back(HEADER_ASYNC);
+    stream.push_back(length);
+    for (size_t i = 0; i < length; ++i)
+        stream.push_back(i == 0 ? 'O' : i == 1 ? 'K' : rand() % 256);
+    stream.resize(stream.size() + frameCheckSize(check));
+    sealFrame(&stream[begin], HEAD_PKG + length, check);
+}
+
+static long frames, good;
+
+static void countPacket(const packet_t* packet) {
+    frames++;
+    if (packet->length >= 4 && packet->buffer[0] == 'O' && packet->buffer[1] == 'K')
+        good++;
+}
+
+static void measureParser(frame_check_t check, bool noisy, int repetitions) {
+    srand(7);
+    vector<unsigned char> stream;
+    long sent = 0;
+    while (stream.size() < (1 << 20)) {
+        if (noisy) {
+            int n = rand() % 40;
+            for (int i = 0; i < n; ++i)
+                stream.push_back(rand() % 256);
+        }
+        appendFrame(stream, 4 + rand() % 60, check);
+        sent++;
+    }
+    frames = good = 0;
+    PacketSerial serial;
+    serial.setFrameCheck(check);
+    serial.setAsyncPacketCallback(countPacket);
+    boost::shared_ptr<ReplayTransport> transport(new ReplayTransport(serial.ioService(), stream, 61, repetitions));
+    uint64_t start = AsyncSerial::monotonicTime();
+    serial.open(transport);
+    transport->wait();
+    uint64_t time = AsyncSerial::monotonicTime() - start;
+    serial.close();
+    cout << check_names[check] << (noisy ? ", noisy: " : ", clean: ") << stream.size() * repetitions / (double) time
+            << " MB/s, sent " << sent * repetitions << " good " << good << " delivered " << frames << endl;
+}
+
+/**
+ * Counts the frames accepted
+ */
+class CountingHandler {
+public:
+
+    explicit CountingHandler(long& frames) : frames(frames) {
+    }
+
+    void frame(unsigned char /*header*/, packet_t& /*packet*/) {
+        frames++;
+    }
+
+    void headerErrors(size_t /*count*/) {
+    }
+
+    void lengthError() {
+    }
+
+    void checkError() {
+    }
+
+    void framingError() {
+    }
+
+private:
+    long& frames;
+};
+
+template <class Check>
+static void measureDetection(frame_check_t check) {
+    const long trials = 100000;
+    const size_t length = 16;
+    long accepted = 0;
+    FramingCore<HeaderFraming, Check, CountingHandler> parser((CountingHandler(accepted)));
+    srand(3);
+    for (long t = 0; t < trials; ++t) {
+        vector<unsigned char> frame;
+        appendFrame(frame, length, check);
+        size_t i = HEAD_PKG + rand() % length, j;
+        do {
+            j = HEAD_PKG + rand() % length;
+        } while (j == i || frame[i] == frame[j]);
+        if (t & 1) {
+            swap(frame[i], frame[j]);
+        } else {
+            unsigned char offset = 1 + rand() % 255;
+            frame[i] += offset;
+            frame[j] -= offset;
+        }
+        parser.parse(&frame[0], &frame[0] + frame.size());
+    }
+    cout << check_names[check] << ": " << accepted << " of " << trials
+            << " frames with swapped or offsetting bytes accepted" << endl;
+}
+
+int main(int argc, char** argv) {
+    int repetitions = argc > 1 ? atoi(argv[1]) : 10;
+    measureKernels();
+    for (int check = FRAME_CHECK_SUM; check <= FRAME_CHECK_CRC32; ++check) {
+        measureParser((frame_check_t) check, false, repetitions);
+        measureParser((frame_check_t) check, true, repetitions);
+    }
+    measureDetection<SumCheck>(FRAME_CHECK_SUM);
+    measureDetection<Crc16Check>(FRAME_CHECK_CRC16);
+    measureDetection<Crc32Check>(FRAME_CHECK_CRC32);
+    return 0;
+}
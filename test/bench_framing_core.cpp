@@ -0,0 +1,156 @@
+/*
+ * Copyright (C) 2014 Officine Robotiche
+ * Author: Raffaello Bonghi
+ * email:  raffaello.bonghi@officinerobotiche.it
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the GNU Lesser General Public License
+ * (LGPL) version 2.1 which accompanies this distribution, and is available at
+ * http://www.gnu.org/licenses/lgpl-2.1.html
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ */
+
+
+/*
+ * ns per frame of FramingCore alone, with a handler that counts the frames,
+ * and of PacketSerial, that instantiates it, with an async callback. 1 MiB
+ * of asynchronous frames parsed 5 times in reads of a given size, median
+ * of 9 runs.
+ *
+ * Usage: bench_framing_core
+ */
+
+#include "serial_parser_packet/PacketSerial.h"
+#include "serial_parser_packet/FrameChecksum.h"
+#include "serial_parser_packet/FrameCobs.h"
+#include "ReplayTransport.h"
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+using namespace std;
+
+static const int runs = 9;
+static const int repetitions = 5;
+
+static vector<unsigned char> makeStream(size_t min_length, size_t lengths, frame_check_t check, frame_format_t format) {
+    srand(5);
+    vector<unsigned char> stream, frame, encoded(2 * (HEAD_PKG + MAX_BUFF_RX + FRAME_CHECK_MAX));
+    while (stream.size() < (1 << 20)) {
+        size_t length = min_length + rand() % lengths;
+        frame.clear();
+        frame.push_back(HEADER_ASYNC);
+        frame.push_back(length);
+        for (size_t i = 0; i < length; ++i)
+            frame.push_back(rand() % 256);
+        frame.resize(frame.size() + frameCheckSize(check));
+        sealFrame(&frame[0], HEAD_PKG + length, check);
+        if (format == FRAME_FORMAT_COBS) {
+            size_t size = cobsEncode(&frame[0], frame.size(), &encoded[0]);
+            stream.push_back(COBS_DELIMITER);
+            stream.insert(stream.end(), encoded.begin(), encoded.begin() + size);
+            stream.push_back(COBS_DELIMITER);
+        } else {
+            stream.insert(stream.end(), frame.begin(), frame.end());
+        }
+    }
+    return stream;
+}
+
+static double median(vector<double> values) {
+    sort(values.begin(), values.end());
+    return values[values.size() / 2];
+}
+
+/**
+ * Counts the frames delivered
+ */
+class CountingHandler {
+public:
+
+    explicit CountingHandler(long& frames) : frames(frames) {
+    }
+
+    void frame(unsigned char /*header*/, packet_t& /*packet*/) {
+        frames++;
+    }
+
+    void headerErrors(size_t /*count*/) {
+    }
+
+    void lengthError() {
+    }
+
+    void checkError() {
+    }
+
+    void framingError() {
+    }
+
+private:
+    long& frames;
+};
+
+template <class Framing, class Check>
+static double measureCore(const vector<unsigned char>& stream, size_t chunk) {
+    long frames = 0;
+    FramingCore<Framing, Check, CountingHandler> core((CountingHandler(frames)));
+    vector<double> times;
+    for (int run = 0; run < runs; ++run) {
+        frames = 0;
+        uint64_t start = AsyncSerial::monotonicTime();
+        for (int r = 0; r < repetitions; ++r) {
+            for (size_t offset = 0; offset < stream.size(); offset += chunk)
+                core.parse(&stream[offset], &stream[offset] + min(chunk, stream.size() - offset));
+        }
+        times.push_back((AsyncSerial::monotonicTime() - start) * 1000.0 / frames);
+    }
+    return median(times);
+}
+
+static long frames;
+
+static void countPacket(const packet_t* /*packet*/) {
+    frames++;
+}
+
+static double measureSerial(const vector<unsigned char>& stream, size_t chunk, frame_check_t check, frame_format_t format) {
+    vector<double> times;
+    for (int run = 0; run < runs; ++run) {
+        frames = 0;
+        PacketSerial serial;
+        serial.setFrameCheck(check);
+        serial.setFrameFormat(format);
+        serial.setAsyncPacketCallback(countPacket);
+        boost::shared_ptr<ReplayTransport> transport(new ReplayTransport(serial.ioService(), stream, chunk, repetitions));
+        uint64_t start = AsyncSerial::monotonicTime();
+        serial.open(transport);
+        transport->wait();
+        times.push_back((AsyncSerial::monotonicTime() - start) * 1000.0 / frames);
+        serial.close();
+    }
+    return median(times);
+}
+
+template <class Framing, class Check>
+static void measure(const char* name, frame_format_t format, frame_check_t check,
+        size_t min_length, size_t lengths, size_t chunk) {
+    vector<unsigned char> stream = makeStream(min_length, lengths, check, format);
+    double serial = measureSerial(stream, chunk, check, format);
+    double core = measureCore<Framing, Check>(stream, chunk);
+    cout << name << ", " << chunk << " B reads: PacketSerial " << serial << " ns/frame, core alone " << core << endl;
+}
+
+int main() {
+    measure<HeaderFraming, SumCheck>("header sum   4-63 B", FRAME_FORMAT_HEADER, FRAME_CHECK_SUM, 4, 60, 64);
+    measure<HeaderFraming, SumCheck>("header sum   4-63 B", FRAME_FORMAT_HEADER, FRAME_CHECK_SUM, 4, 60, 512);
+    measure<HeaderFraming, Crc16Check>("header crc16 4-63 B", FRAME_FORMAT_HEADER, FRAME_CHECK_CRC16, 4, 60, 64);
+    measure<HeaderFraming, SumCheck>("header sum   200 B ", FRAME_FORMAT_HEADER, FRAME_CHECK_SUM, 200, 1, 512);
+    measure<CobsFraming, SumCheck>("cobs   sum   4-63 B", FRAME_FORMAT_COBS, FRAME_CHECK_SUM, 4, 60, 64);
+    measure<CobsFraming, Crc16Check>("cobs   crc16 4-63 B", FRAME_FORMAT_COBS, FRAME_CHECK_CRC16, 4, 60, 512);
+    return 0;
+}
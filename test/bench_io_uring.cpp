@@ -0,0 +1,137 @@
+/*
+ * Copyright (C) 2014 Officine Robotiche
+ * Author: Raffaello Bonghi
+ * email:  raffaello.bonghi@officinerobotiche.it
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the GNU Lesser General Public License
+ * (LGPL) version 2.1 which accompanies this distribution, and is available at
+ * http://www.gnu.org/licenses/lgpl-2.1.html
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ */
+
+/*
+ * Throughput of the asio and io_uring transports: many ports on one reactor
+ * thread, each on a socketpair whose other end drains the frames of the
+ * port and then sends as many back.
+ *
+ * Usage: bench_io_uring [ports] [frames]
+ */
+
+#include "serial_parser_packet/PacketSerial.h"
+#include "serial_parser_packet/IoUringEngine.h"
+#include "serial_parser_packet/FrameChecksum.h"
+#include <sys/socket.h>
+#include <unistd.h>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+using namespace std;
+
+static boost::atomic<long> received(0);
+
+static void countPacket(const packet_t* /*packet*/) {
+    received.fetch_add(1, boost::memory_order_release);
+}
+
+static const size_t frame_size = HEAD_PKG + 8 + 1;
+
+static void peer(int fd, int frames) {
+    unsigned char frame[frame_size] = {HEADER_ASYNC, 8, 1, 1, 1, 1, 1, 1, 1, 1, 8};
+    char buffer[4096];
+    long total = 0;
+    while (total < (long) (frames * frame_size)) {
+        ssize_t n = read(fd, buffer, sizeof (buffer));
+        if (n <= 0)
+            break;
+        total += n;
+    }
+    for (int i = 0; i < frames; ++i) {
+        if (write(fd, frame, frame_size) != (ssize_t) frame_size)
+            break;
+    }
+}
+
+typedef enum _mode {
+    MODE_ASIO, MODE_URING, MODE_SQPOLL
+} bench_mode_t;
+
+static void measure(bench_mode_t mode, int ports, int frames) {
+    boost::shared_ptr<IoUringEngine> engine;
+    if (mode != MODE_ASIO) {
+        io_uring_engine_options_t options = IoUringEngine::defaultOptions();
+        options.sqpoll = mode == MODE_SQPOLL;
+        engine.reset(new IoUringEngine(options));
+    }
+    boost::shared_ptr<SerialReactor> reactor(new SerialReactor(1));
+    vector<PacketSerial*> serials;
+    vector<int> peers;
+    for (int i = 0; i < ports; ++i) {
+        int fds[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+            cerr << "socketpair failed" << endl;
+            exit(1);
+        }
+        PacketSerial* serial = new PacketSerial();
+        serial->setReactor(reactor);
+        serial->setAsyncPacketCallback(countPacket);
+        if (engine) {
+            serial->open(boost::shared_ptr<SerialTransport>(new IoUringTransport(engine, fds[0])));
+        } else {
+            typedef StreamTransport<boost::asio::local::stream_protocol::socket> SocketTransport;
+            boost::shared_ptr<SocketTransport> transport(new SocketTransport(serial->ioService()));
+            transport->native().assign(boost::asio::local::stream_protocol(), fds[0]);
+            serial->open(transport);
+        }
+        serials.push_back(serial);
+        peers.push_back(fds[1]);
+    }
+
+    received.store(0);
+    uint64_t start = AsyncSerial::monotonicTime();
+    boost::thread_group threads;
+    for (int i = 0; i < ports; ++i)
+        threads.create_thread(boost::bind(peer, peers[i], frames));
+    packet_t packet;
+    packet.length = 8;
+    memset(packet.buffer, 1, packet.length);
+    for (int k = 0; k < frames; ++k) {
+        for (int i = 0; i < ports; ++i)
+            serials[i]->writePacket(packet, HEADER_ASYNC);
+    }
+    threads.join_all();
+    while (received.load(boost::memory_order_acquire) < (long) ports * frames)
+        usleep(100);
+    uint64_t time = AsyncSerial::monotonicTime() - start;
+
+    unsigned long writes = 0;
+    for (int i = 0; i < ports; ++i)
+        writes += serials[i]->writeStatistics().writes;
+    const char* names[] = {"asio", "io_uring", "io_uring sqpoll"};
+    cout << names[mode] << ": " << time / 1000 << " ms, writes " << writes;
+    if (engine) {
+        io_uring_statistics_t statistics = engine->statistics();
+        cout << ", enter submit " << statistics.submit_calls << " wait " << statistics.wait_calls
+                << ", entries " << statistics.submitted;
+    }
+    cout << endl;
+    for (int i = 0; i < ports; ++i) {
+        serials[i]->close();
+        delete serials[i];
+        close(peers[i]);
+    }
+}
+
+int main(int argc, char** argv) {
+    int ports = argc > 1 ? atoi(argv[1]) : 8;
+    int frames = argc > 2 ? atoi(argv[2]) : 20000;
+    cout << ports << " ports, " << frames << " frames of " << frame_size << " bytes each way" << endl;
+    measure(MODE_ASIO, ports, frames);
+    measure(MODE_URING, ports, frames);
+    measure(MODE_SQPOLL, ports, frames);
+    return 0;
+}
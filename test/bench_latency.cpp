@@ -0,0 +1,107 @@
+/*
+ * Copyright (C) 2014 Officine Robotiche
+ * Author: Raffaello Bonghi
+ * email:  raffaello.bonghi@officinerobotiche.it
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the GNU Lesser General Public License
+ * (LGPL) version 2.1 which accompanies this distribution, and is available at
+ * http://www.gnu.org/licenses/lgpl-2.1.html
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ */
+
+/*
+ * Receive latency of the serial transports on a pseudo terminal: each frame
+ * carries the time it is written on the master and is timed again at the
+ * async callback of PacketSerial.
+ *
+ * Usage: bench_latency [frames]
+ */
+
+#include "serial_parser_packet/PacketSerial.h"
+#include "serial_parser_packet/FrameChecksum.h"
+#include <pty.h>
+#include <termios.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+using namespace std;
+
+class LatencySink {
+public:
+
+    LatencySink() : received(0) {
+    }
+
+    void packet(const packet_t* packet) {
+        uint64_t sent;
+        memcpy(&sent, packet->buffer, sizeof (sent));
+        latency.push_back(AsyncSerial::monotonicTime() - sent);
+        received.store(latency.size(), boost::memory_order_release);
+    }
+
+    vector<uint64_t> latency;
+    boost::atomic<size_t> received;
+};
+
+static void measure(const char* name, bool linux_transport, int frames) {
+    int master, slave;
+    char slave_name[64];
+    if (openpty(&master, &slave, slave_name, NULL, NULL) != 0) {
+        cerr << "openpty failed" << endl;
+        exit(1);
+    }
+    struct termios raw;
+    tcgetattr(master, &raw);
+    cfmakeraw(&raw);
+    tcsetattr(master, TCSANOW, &raw);
+
+    PacketSerial serial;
+    LatencySink sink;
+    sink.latency.reserve(frames);
+    serial.setAsyncPacketCallback(&LatencySink::packet, &sink);
+    if (linux_transport) {
+        serial.open(boost::shared_ptr<SerialTransport>(new LinuxSerialTransport(serial.ioService(),
+                slave_name, linuxSerialDefaultOptions(115200))));
+    } else {
+        serial.open(slave_name, 115200);
+    }
+
+    unsigned char frame[HEAD_PKG + sizeof (uint64_t) + 1];
+    frame[0] = HEADER_ASYNC;
+    frame[1] = sizeof (uint64_t);
+    for (int i = 0; i < frames; ++i) {
+        uint64_t now = AsyncSerial::monotonicTime();
+        memcpy(&frame[HEAD_PKG], &now, sizeof (now));
+        frame[sizeof (frame) - 1] = frameChecksum(&frame[HEAD_PKG], sizeof (now));
+        if (write(master, frame, sizeof (frame)) != (ssize_t) sizeof (frame))
+            break;
+        // One frame at a time, the next is written when this one arrived
+        while (sink.received.load(boost::memory_order_acquire) < size_t(i + 1))
+            usleep(10);
+        usleep(100);
+    }
+    serial.close();
+    close(master);
+    close(slave);
+
+    vector<uint64_t>& latency = sink.latency;
+    sort(latency.begin(), latency.end());
+    cout << name << ": frames " << latency.size()
+            << " median " << latency[latency.size() / 2]
+            << " us p99 " << latency[latency.size() * 99 / 100]
+            << " us max " << latency.back() << " us" << endl;
+}
+
+int main(int argc, char** argv) {
+    int frames = argc > 1 ? atoi(argv[1]) : 3000;
+    measure("asio serial_port    ", false, frames);
+    measure("LinuxSerialTransport", true, frames);
+    return 0;
+}
@@ -0,0 +1,109 @@
+/*
+ * Copyright (C) 2014 Officine Robotiche
+ * Author: Raffaello Bonghi
+ * email:  raffaello.bonghi@officinerobotiche.it
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the GNU Lesser General Public License
+ * (LGPL) version 2.1 which accompanies this distribution, and is available at
+ * http://www.gnu.org/licenses/lgpl-2.1.html
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ */
+
+
+/*
+ * Receive throughput of PacketSerial: a transport replays a 1 MiB stream of
+ * asynchronous frames in reads of a given size, the callback hashes each
+ * payload so that two builds can be compared frame by frame.
+ *
+ * Streams: random lengths 0..MAX_BUFF_RX, 8 byte payloads, and random
+ * lengths mixed with noise, wrong lengths and wrong checksums.
+ *
+ * Usage: bench_parser [repetitions]
+ */
+
+#include "serial_parser_packet/PacketSerial.h"
+#include "serial_parser_packet/FrameChecksum.h"
+#include "ReplayTransport.h"
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+using namespace std;
+
+static unsigned long long hash_value;
+static long frames;
+
+static void hashPacket(const packet_t* packet) {
+    frames++;
+    for (unsigned int i = 0; i < packet->length; ++i) {
+        hash_value ^= packet->buffer[i];
+        hash_value *= 1099511628211ULL;
+    }
+    hash_value ^= packet->length;
+}
+
+typedef enum _stream {
+    STREAM_RANDOM, STREAM_SHORT, STREAM_NOISE
+} stream_t;
+
+static vector<unsigned char> makeStream(stream_t type) {
+    srand(42);
+    vector<unsigned char> stream;
+    while (stream.size() < (1 << 20)) {
+        if (type == STREAM_NOISE && rand() % 4 == 0) {
+            int n = rand() % 30;
+            for (int i = 0; i < n; ++i)
+                stream.push_back(rand() % 256);
+        }
+        int length = type == STREAM_SHORT ? 8 : rand() % (MAX_BUFF_RX + 1);
+        if (type == STREAM_NOISE && rand() % 20 == 0)
+            length = MAX_BUFF_RX + 1 + rand() % 50;
+        stream.push_back(HEADER_ASYNC);
+        stream.push_back(length);
+        unsigned char check = 0;
+        for (int i = 0; i < length; ++i) {
+            unsigned char byte = rand() % 256;
+            stream.push_back(byte);
+            check += byte;
+        }
+        if (type == STREAM_NOISE && rand() % 10 == 0)
+            check++;
+        stream.push_back(check);
+    }
+    return stream;
+}
+
+static void measure(stream_t type, size_t chunk, int repetitions) {
+    vector<unsigned char> stream = makeStream(type);
+    hash_value = 1469598103934665603ULL;
+    frames = 0;
+    PacketSerial serial;
+    serial.setAsyncPacketCallback(hashPacket);
+    boost::shared_ptr<ReplayTransport> transport(new ReplayTransport(serial.ioService(), stream, chunk, repetitions));
+    uint64_t start = AsyncSerial::monotonicTime();
+    serial.open(transport);
+    transport->wait();
+    uint64_t time = AsyncSerial::monotonicTime() - start;
+    serial.close();
+
+    map<string, int> errors = serial.getMapError();
+    const char* names[] = {"random lengths", "8 byte frames", "noise"};
+    cout << names[type] << ", reads of " << chunk << " B: " << stream.size() * repetitions / (double) time
+            << " MB/s, frames " << frames << " hash " << hash_value << ", errors header " << errors["Header"]
+            << " length " << errors["Length"] << " checksum " << errors["Checksum"] << endl;
+}
+
+int main(int argc, char** argv) {
+    int repetitions = argc > 1 ? atoi(argv[1]) : 20;
+    cout << "checksum kernel " << frameChecksumKernel() << endl;
+    size_t chunks[] = {64, 4096};
+    for (int type = STREAM_RANDOM; type <= STREAM_NOISE; ++type) {
+        for (int i = 0; i < 2; ++i)
+            measure((stream_t) type, chunks[i], repetitions);
+    }
+    return 0;
+}
@@ -0,0 +1,194 @@
+/*
+ * Copyright (C) 2014 Officine Robotiche
+ * Author: Raffaello Bonghi
+ * email:  raffaello.bonghi@officinerobotiche.it
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the GNU Lesser General Public License
+ * (LGPL) version 2.1 which accompanies this distribution, and is available at
+ * http://www.gnu.org/licenses/lgpl-2.1.html
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ */
+
+/*
+ * Checks and cost of PreparedCommand:
+ * * a payload patched with set() gives the frame of a full reseal, with
+ *   every check
+ * * setCommandMessage() gives the data of encoder()
+ * * prepared frames round trip through a pty in header and COBS format
+ * * ns per command of two MOTOR_VEL_REF messages, createDataPacket(),
+ *   encoder() and seal against setCommandMessage() on a prepared command
+ * Exits with 1 if a check fails.
+ *
+ * Usage: bench_prepared_command [commands]
+ */
+
+#include "serial_parser_packet/ParserPacket.h"
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+using namespace std;
+
+static const char* check_names[] = {"sum", "crc16", "crc32"};
+static bool failed = false;
+
+static void expect(bool condition, const char* message) {
+    if (!condition) {
+        cout << "FAILED: " << message << endl;
+        failed = true;
+    }
+}
+
+static void checkPatch() {
+    srand(1);
+    int mismatches = 0, trials = 0;
+    for (int check = FRAME_CHECK_SUM; check <= FRAME_CHECK_CRC32; ++check) {
+        for (int i = 0; i < 20000; ++i) {
+            size_t length = 1 + rand() % MAX_BUFF_RX;
+            unsigned char data[MAX_BUFF_RX], bytes[MAX_BUFF_RX];
+            for (size_t k = 0; k < length; ++k)
+                data[k] = rand();
+            PreparedCommand patched(HEADER_SYNC, data, length, (frame_check_t) check);
+            size_t offset = rand() % length, size = 1 + rand() % (length - offset);
+            for (size_t k = 0; k < size; ++k)
+                bytes[k] = rand();
+            patched.set(offset, bytes, size);
+            memcpy(data + offset, bytes, size);
+            PreparedCommand sealed(HEADER_SYNC, data, length, (frame_check_t) check);
+            if (patched.size() != sealed.size() || memcmp(patched.frame(), sealed.frame(), sealed.size()) != 0)
+                mismatches++;
+            trials++;
+        }
+    }
+    cout << "patch against reseal: " << mismatches << " mismatches of " << trials << endl;
+    expect(mismatches == 0, "a patched frame differs from the resealed one");
+}
+
+static vector<packet_information_t> motorSpeeds(ParserPacket& parser, int16_t left, int16_t right) {
+    motor_command_map_t command;
+    command.bitset.command = MOTOR_VEL_REF;
+    vector<packet_information_t> list;
+    command.bitset.motor = 0;
+    list.push_back(parser.createDataPacket(command.command_message, HASHMAP_MOTOR, (message_abstract_u*) & left));
+    command.bitset.motor = 1;
+    list.push_back(parser.createDataPacket(command.command_message, HASHMAP_MOTOR, (message_abstract_u*) & right));
+    return list;
+}
+
+static void checkCommandMessage() {
+    ParserPacket parser;
+    PreparedCommand command = parser.prepareCommand(motorSpeeds(parser, 0, 0));
+    int16_t left = 1234, right = -77;
+    ParserPacket::setCommandMessage(command, 0, (message_abstract_u*) & left);
+    ParserPacket::setCommandMessage(command, 1, (message_abstract_u*) & right);
+    packet_t encoded = parser.encoder(motorSpeeds(parser, left, right));
+    bool same = encoded.length == command.length() && memcmp(encoded.buffer, command.data(), encoded.length) == 0;
+    cout << "setCommandMessage against encoder: " << (same ? "same" : "different") << endl;
+    expect(same, "setCommandMessage differs from encoder");
+}
+
+static boost::mutex received_mutex;
+static vector<vector<unsigned char> > received;
+
+static void storePacket(const packet_t* packet) {
+    boost::lock_guard<boost::mutex> l(received_mutex);
+    received.push_back(vector<unsigned char>(packet->buffer, packet->buffer + packet->length));
+}
+
+static void checkRoundTrip(frame_format_t format, frame_check_t check) {
+    const int commands = 200;
+    PacketSerial board;
+    board.setFrameFormat(format);
+    board.setFrameCheck(check);
+    board.setAsyncPacketCallback(storePacket);
+    boost::shared_ptr<PtyTransport> pty(new PtyTransport(board.ioService()));
+    board.open(pty);
+    PacketSerial host(pty->slaveName(), 115200);
+    host.setFrameFormat(format);
+    host.setFrameCheck(check);
+    {
+        boost::lock_guard<boost::mutex> l(received_mutex);
+        received.clear();
+    }
+
+    vector<vector<unsigned char> > sent;
+    unsigned char data[40];
+    for (int i = 0; i < 40; ++i)
+        data[i] = rand() % 3 ? 0 : rand();
+    // Sealed with the sum, writePrepared() reseals it with the check of the link
+    PreparedCommand command(HEADER_ASYNC, data, sizeof (data));
+    for (int k = 0; k < commands; ++k) {
+        unsigned char bytes[4];
+        for (int i = 0; i < 4; ++i)
+            bytes[i] = rand() % 2 ? 0 : rand();
+        command.set(k % 36, bytes, sizeof (bytes));
+        memcpy(data + k % 36, bytes, sizeof (bytes));
+        sent.push_back(vector<unsigned char>(data, data + sizeof (data)));
+        host.writePrepared(command);
+    }
+    host.flush();
+    for (int wait = 0; wait < 200; ++wait) {
+        {
+            boost::lock_guard<boost::mutex> l(received_mutex);
+            if (received.size() >= sent.size())
+                break;
+        }
+        usleep(10000);
+    }
+    host.close();
+    board.close();
+
+    boost::lock_guard<boost::mutex> l(received_mutex);
+    bool same = received == sent;
+    cout << (format == FRAME_FORMAT_COBS ? "cobs" : "header") << ", " << check_names[check]
+            << ": " << received.size() << " of " << sent.size() << " commands received"
+            << (same ? "" : ", different") << endl;
+    expect(same, "the commands received differ from the sent ones");
+}
+
+static void measure(frame_check_t check, int commands) {
+    ParserPacket parser;
+    parser.setFrameCheck(check);
+    volatile unsigned int sink = 0;
+    uint64_t start = AsyncSerial::monotonicTime();
+    for (int i = 0; i < commands; ++i) {
+        packet_t encoded = parser.encoder(motorSpeeds(parser, i, i));
+        unsigned char frame[HEAD_PKG + MAX_BUFF_RX + FRAME_CHECK_MAX];
+        frame[0] = HEADER_SYNC;
+        frame[1] = encoded.length;
+        memcpy(&frame[HEAD_PKG], encoded.buffer, encoded.length);
+        sealFrame(frame, HEAD_PKG + encoded.length, check);
+        sink += frame[HEAD_PKG + encoded.length];
+    }
+    uint64_t encoded = AsyncSerial::monotonicTime() - start;
+
+    PreparedCommand command = parser.prepareCommand(motorSpeeds(parser, 0, 0));
+    command.seal(check);
+    start = AsyncSerial::monotonicTime();
+    for (int i = 0; i < commands; ++i) {
+        int16_t speed = i;
+        ParserPacket::setCommandMessage(command, 0, (message_abstract_u*) & speed);
+        ParserPacket::setCommandMessage(command, 1, (message_abstract_u*) & speed);
+        sink += command.frame()[command.size() - 1];
+    }
+    uint64_t prepared = AsyncSerial::monotonicTime() - start;
+    cout << check_names[check] << ", frame of " << command.size() << " B: createDataPacket+encoder+seal "
+            << encoded * 1000.0 / commands << " ns, prepared " << prepared * 1000.0 / commands << " ns" << endl;
+}
+
+int main(int argc, char** argv) {
+    int commands = argc > 1 ? atoi(argv[1]) : 2000000;
+    checkPatch();
+    checkCommandMessage();
+    for (int format = FRAME_FORMAT_HEADER; format <= FRAME_FORMAT_COBS; ++format) {
+        for (int check = FRAME_CHECK_SUM; check <= FRAME_CHECK_CRC32; ++check)
+            checkRoundTrip((frame_format_t) format, (frame_check_t) check);
+    }
+    for (int check = FRAME_CHECK_SUM; check <= FRAME_CHECK_CRC32; ++check)
+        measure((frame_check_t) check, commands);
+    return failed ? 1 : 0;
+}
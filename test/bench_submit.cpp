@@ -0,0 +1,138 @@
+/*
+ * Copyright (C) 2014 Officine Robotiche
+ * Author: Raffaello Bonghi
+ * email:  raffaello.bonghi@officinerobotiche.it
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the GNU Lesser General Public License
+ * (LGPL) version 2.1 which accompanies this distribution, and is available at
+ * http://www.gnu.org/licenses/lgpl-2.1.html
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ */
+
+
+/*
+ * Frame submission from many threads: each thread writes 11 byte frames to
+ * one port on a socketpair, the other end echoes them back. Prints the ns
+ * per frame of the writers and the heap allocations per frame, from the
+ * start of the writers to the last byte echoed.
+ *
+ * Usage: bench_submit [threads] [frames per thread]
+ */
+
+#include "serial_parser_packet/AsyncSerial.h"
+#include <sys/socket.h>
+#include <unistd.h>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <boost/thread/barrier.hpp>
+
+using namespace std;
+
+static boost::atomic<long> allocations(0);
+
+// Out of line: inlined in the callers, GCC would pair each free() with a
+// new expression and warn
+__attribute__((noinline))
+void* operator new(size_t size) throw (std::bad_alloc) {
+    allocations.fetch_add(1, boost::memory_order_relaxed);
+    void* memory = malloc(size > 0 ? size : 1);
+    if (memory == NULL)
+        throw std::bad_alloc();
+    return memory;
+}
+
+__attribute__((noinline))
+void operator delete(void* memory) throw () {
+    free(memory);
+}
+
+__attribute__((noinline))
+void* operator new[](size_t size) throw (std::bad_alloc) {
+    return operator new(size);
+}
+
+__attribute__((noinline))
+void operator delete[](void* memory) throw () {
+    free(memory);
+}
+
+static const size_t frame_size = 11;
+static boost::atomic<long> received(0);
+
+static void countBytes(const char* /*data*/, size_t size) {
+    received.fetch_add(size, boost::memory_order_release);
+}
+
+static void waitReceived(long bytes) {
+    while (received.load(boost::memory_order_acquire) < bytes)
+        usleep(100);
+}
+
+static void echo(int fd, long bytes) {
+    char buffer[65536];
+    for (long total = 0; total < bytes;) {
+        ssize_t n = read(fd, buffer, sizeof (buffer));
+        if (n <= 0 || write(fd, buffer, n) != n)
+            break;
+        total += n;
+    }
+}
+
+static void writeFrames(CallbackAsyncSerial* serial, int frames, boost::barrier* start) {
+    char frame[frame_size];
+    memset(frame, 1, sizeof (frame));
+    if (start != NULL)
+        start->wait();
+    for (int i = 0; i < frames; ++i)
+        serial->write(frame, sizeof (frame));
+}
+
+int main(int argc, char** argv) {
+    int threads = argc > 1 ? atoi(argv[1]) : 4;
+    int frames = argc > 2 ? atoi(argv[2]) : 100000;
+    const int warm_up = 1000;
+    long bytes = ((long) threads * frames + warm_up) * frame_size;
+
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+        cerr << "socketpair failed" << endl;
+        return 1;
+    }
+    CallbackAsyncSerial serial;
+    serial.setCallback(countBytes);
+    typedef StreamTransport<boost::asio::local::stream_protocol::socket> SocketTransport;
+    boost::shared_ptr<SocketTransport> transport(new SocketTransport(serial.ioService()));
+    transport->native().assign(boost::asio::local::stream_protocol(), fds[0]);
+    serial.open(transport);
+    boost::thread peer(boost::bind(echo, fds[1], bytes));
+
+    // The first frames allocate the memory of the loops
+    writeFrames(&serial, warm_up, NULL);
+    waitReceived(warm_up * frame_size);
+
+    boost::barrier start(threads + 1);
+    boost::thread_group writers;
+    for (int i = 0; i < threads; ++i)
+        writers.create_thread(boost::bind(writeFrames, &serial, frames, &start));
+    start.wait();
+    long allocated = allocations.load();
+    uint64_t begin = AsyncSerial::monotonicTime();
+    writers.join_all();
+    uint64_t submitted = AsyncSerial::monotonicTime() - begin;
+    waitReceived(bytes);
+    uint64_t echoed = AsyncSerial::monotonicTime() - begin;
+    allocated = allocations.load() - allocated;
+
+    long total = (long) threads * frames;
+    cout << threads << " threads x " << frames << " frames: " << submitted * 1000.0 / total << " ns/frame, all echoed in "
+            << echoed / 1000 << " ms, " << serial.writeStatistics().writes << " writes, "
+            << allocated << " heap allocations (" << (double) allocated / total << " per frame)" << endl;
+    peer.join();
+    serial.close();
+    return 0;
+}
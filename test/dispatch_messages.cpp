@@ -0,0 +1,146 @@
+/*
+ * Copyright (C) 2014 Officine Robotiche
+ * Author: Raffaello Bonghi
+ * email:  raffaello.bonghi@officinerobotiche.it
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the GNU Lesser General Public License
+ * (LGPL) version 2.1 which accompanies this distribution, and is available at
+ * http://www.gnu.org/licenses/lgpl-2.1.html
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ */
+
+
+/*
+ * Checks the messages reassembled from fragments with dispatch threads:
+ * two ports on a socketpair, one writes packets and long messages in turn,
+ * the other must get each message on the thread of the first read
+ * callback, in order with the packets. Exits with 1 if a check fails.
+ *
+ * Usage: dispatch_messages [rounds]
+ */
+
+#include "serial_parser_packet/PacketSerial.h"
+#include <sys/socket.h>
+#include <cstdlib>
+#include <iostream>
+#include <boost/thread.hpp>
+
+using namespace std;
+
+typedef StreamTransport<boost::asio::local::stream_protocol::socket> SocketTransport;
+
+static bool failed = false;
+
+static void expect(bool condition, const char* message) {
+    if (!condition) {
+        cout << "FAILED: " << message << endl;
+        failed = true;
+    }
+}
+
+/// Bytes of a message, more than one fragment
+static const size_t message_size = 3 * MAX_BUFF_RX + 17;
+
+/// Written by the thread of the first callbacks only
+static vector<int> events;
+static boost::thread::id first_thread;
+static bool mixed_threads = false;
+static bool bad_message = false;
+static boost::atomic<int> received(0);
+
+static void onThread() {
+    if (first_thread == boost::thread::id())
+        first_thread = boost::this_thread::get_id();
+    else if (first_thread != boost::this_thread::get_id())
+        mixed_threads = true;
+}
+
+/**
+ * First read callback: the packet i is logged as 2 * i
+ */
+static void logPacket(const packet_t* packet) {
+    onThread();
+    events.push_back(2 * packet->buffer[0]);
+    received++;
+}
+
+/**
+ * Second read callback, on the other thread, to keep it busy
+ */
+static void ignorePacket(const packet_t*) {
+}
+
+/**
+ * Message callback: the message i is logged as 2 * i + 1
+ */
+static void logMessage(const unsigned char* message, size_t length) {
+    onThread();
+    if (length != message_size)
+        bad_message = true;
+    for (size_t i = 0; i < length && !bad_message; ++i)
+        bad_message = message[i] != (unsigned char) (message[0] + i);
+    events.push_back(2 * message[0] + 1);
+    received++;
+}
+
+int main(int argc, char** argv) {
+    int rounds = argc > 1 ? atoi(argv[1]) : 200;
+    if (rounds > 256)
+        rounds = 256;
+
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+        cerr << "socketpair failed" << endl;
+        return 1;
+    }
+    // Queues as long as the test, no packet or message is ever dropped
+    PacketSerial receiver;
+    receiver.setDispatchThreads(2, 256);
+    receiver.setAsyncPacketCallback(logPacket);
+    receiver.setAsyncPacketCallback(ignorePacket);
+    receiver.setMessageCallback(logMessage);
+    boost::shared_ptr<SocketTransport> in(new SocketTransport(receiver.ioService()));
+    in->native().assign(boost::asio::local::stream_protocol(), fds[0]);
+    receiver.open(in);
+
+    PacketSerial sender;
+    boost::shared_ptr<SocketTransport> out(new SocketTransport(sender.ioService()));
+    out->native().assign(boost::asio::local::stream_protocol(), fds[1]);
+    sender.open(out);
+
+    // The same lane keeps the packets and the messages in order
+    vector<unsigned char> message(message_size);
+    for (int i = 0; i < rounds; ++i) {
+        unsigned char data = i;
+        sender.writePacket(&data, 1, HEADER_ASYNC, WRITE_PRIORITY_BULK);
+        for (size_t k = 0; k < message_size; ++k)
+            message[k] = i + k;
+        sender.writeMessage(&message[0], message_size, WRITE_PRIORITY_BULK);
+    }
+
+    for (int wait = 0; wait < 500 && received.load() < 2 * rounds; ++wait)
+        boost::this_thread::sleep(boost::posix_time::milliseconds(10));
+    receiver.close();
+    try {
+        sender.close();
+    } catch (boost::system::system_error&) {
+        // The sender read the end of the stream, the receiver closed first
+    }
+
+    expect(received.load() == 2 * rounds, "all the packets and messages received");
+    bool ordered = true;
+    for (size_t i = 0; i < events.size(); ++i)
+        ordered = ordered && events[i] == (int) i;
+    expect(ordered, "messages in order with the packets");
+    expect(!mixed_threads, "messages on the thread of the first read callback");
+    expect(first_thread != boost::thread::id() && first_thread != boost::this_thread::get_id(),
+            "callbacks on a dispatch thread");
+    expect(!bad_message, "messages reassembled whole");
+    if (!failed)
+        cout << "dispatch_messages: " << rounds << " packets and messages in order" << endl;
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,144 @@
+/*
+ * Copyright (C) 2014 Officine Robotiche
+ * Author: Raffaello Bonghi
+ * email:  raffaello.bonghi@officinerobotiche.it
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the GNU Lesser General Public License
+ * (LGPL) version 2.1 which accompanies this distribution, and is available at
+ * http://www.gnu.org/licenses/lgpl-2.1.html
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ */
+
+
+/*
+ * Sync requests against BoardEmulator. The first cases sweep the window of
+ * the request ids, with part of the replies reordered and duplicated: every
+ * reply in id mode must match its request and every duplicate must count as
+ * ERROR_STALE_PACKET. The last case sends part of the replies after the
+ * timeout of their request, each must end as a timeout and then as a stale
+ * reply. Exits with 1 if a check fails.
+ *
+ * Usage: sync_ids [reorder %] [duplicate %] [requests]
+ */
+
+#include "serial_parser_packet/ParserPacket.h"
+#include "BoardEmulator.h"
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+using namespace std;
+
+static const unsigned int reply_delay_us = 1000;
+static bool failed = false;
+
+static void check(bool condition, const char* message) {
+    if (!condition) {
+        cout << "FAILED: " << message << endl;
+        failed = true;
+    }
+}
+
+static vector<packet_t> makeRequests(int count) {
+    vector<packet_t> requests(count);
+    for (int i = 0; i < count; ++i) {
+        requests[i].length = 20;
+        for (int j = 0; j < 20; ++j)
+            requests[i].buffer[j] = (i * 7 + j) & 0xFF;
+    }
+    return requests;
+}
+
+static int mismatched(const vector<packet_t>& requests, const vector<packet_t>& replies) {
+    int count = 0;
+    for (size_t i = 0; i < requests.size(); ++i) {
+        if (replies[i].length != requests[i].length ||
+                memcmp(replies[i].buffer, requests[i].buffer, requests[i].length) != 0)
+            count++;
+    }
+    return count;
+}
+
+/**
+ * Window 0 is the old round trip without ids
+ */
+static void sweep(int reorder_pct, int duplicate_pct, int count) {
+    vector<packet_t> requests = makeRequests(count);
+    int windows[] = {0, 1, 2, 4, 8, 16, 32};
+    for (size_t k = 0; k < sizeof (windows) / sizeof (windows[0]); ++k) {
+        BoardEmulator board(reply_delay_us, reorder_pct, duplicate_pct);
+        ParserPacket parser;
+        parser.open(board.port(), 115200);
+        parser.setSyncIds(windows[k] > 0);
+        if (windows[k] > 0)
+            parser.setSyncWindow(windows[k]);
+
+        link_statistics_t previous = parser.getLinkStatistics();
+        uint64_t start = AsyncSerial::monotonicTime();
+        vector<packet_t> replies = parser.sendSyncPackets(requests, 0, boost::posix_time::millisec(500));
+        uint64_t time = AsyncSerial::monotonicTime() - start;
+        // The last duplicates
+        usleep(20000);
+        link_statistics_t statistics = parser.getLinkStatistics(previous);
+        parser.close();
+
+        int wrong = mismatched(requests, replies);
+        long stale = statistics.errors[-ERROR_STALE_PACKET];
+        if (windows[k] > 0)
+            cout << "ids, window " << windows[k];
+        else
+            cout << "no ids";
+        cout << ": " << (int) (count * 1e6 / time) << " req/s, mismatched " << wrong
+                << ", stale " << stale << ", duplicated " << board.duplicated() << endl;
+        if (windows[k] > 0) {
+            check(wrong == 0, "a reply with id doesn't match its request");
+            check(stale == board.duplicated(), "the duplicates are not counted as stale");
+        }
+    }
+}
+
+static void lateReplies(int count) {
+    const int timeout_ms = 20;
+    vector<packet_t> requests = makeRequests(count);
+    BoardEmulator board(reply_delay_us, 0, 0, 5, 2 * timeout_ms * 1000);
+    ParserPacket parser;
+    parser.open(board.port(), 115200);
+    parser.setSyncIds(true);
+
+    link_statistics_t previous = parser.getLinkStatistics();
+    int timeouts = 0, wrong = 0;
+    for (int i = 0; i < count; ++i) {
+        try {
+            packet_t reply = parser.sendSyncPacket(requests[i], 0, boost::posix_time::millisec(timeout_ms));
+            if (reply.length != requests[i].length || memcmp(reply.buffer, requests[i].buffer, reply.length) != 0)
+                wrong++;
+        } catch (parser_exception&) {
+            timeouts++;
+        }
+    }
+    usleep(4 * timeout_ms * 1000);
+    link_statistics_t statistics = parser.getLinkStatistics(previous);
+    parser.close();
+
+    long stale = statistics.errors[-ERROR_STALE_PACKET];
+    cout << "late replies: " << board.late() << ", timeouts " << timeouts << ", stale " << stale
+            << ", mismatched " << wrong << endl;
+    check(wrong == 0, "a reply with id doesn't match its request");
+    check(timeouts == board.late(), "a late reply didn't end in a timeout");
+    check(stale == board.late(), "the late replies are not counted as stale");
+}
+
+int main(int argc, char** argv) {
+    int reorder_pct = argc > 1 ? atoi(argv[1]) : 30;
+    int duplicate_pct = argc > 2 ? atoi(argv[2]) : 5;
+    int count = argc > 3 ? atoi(argv[3]) : 2000;
+    cout << count << " requests of 20 bytes, replies after " << reply_delay_us << " us, "
+            << reorder_pct << "% reordered, " << duplicate_pct << "% duplicated" << endl;
+    sweep(reorder_pct, duplicate_pct, count);
+    lateReplies(count / 4);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,119 @@
+/*
+ * Copyright (C) 2014 Officine Robotiche
+ * Author: Raffaello Bonghi
+ * email:  raffaello.bonghi@officinerobotiche.it
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the GNU Lesser General Public License
+ * (LGPL) version 2.1 which accompanies this distribution, and is available at
+ * http://www.gnu.org/licenses/lgpl-2.1.html
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ */
+
+
+/*
+ * Checks of TxRing, exits with 1 if one fails.
+ *
+ * Usage: tx_ring
+ */
+
+#include "serial_parser_packet/TxRing.h"
+#include <cstring>
+#include <iostream>
+
+using namespace std;
+
+static bool failed = false;
+
+static void expect(bool condition, const char* message) {
+    if (!condition) {
+        cout << "FAILED: " << message << endl;
+        failed = true;
+    }
+}
+
+/**
+ * Send the frames one at a time, each claimed and released before the next
+ * @return frames sent, stops at the first refused
+ */
+static int sendFrames(TxRing& ring, size_t size, int frames) {
+    for (int i = 0; i < frames; ++i) {
+        tx_slot_t slot;
+        if (!ring.reserve(size, slot))
+            return i;
+        memset(slot.data, i, size);
+        ring.commit(slot);
+        boost::asio::const_buffer spans[4];
+        size_t count = ring.claim(spans, 4);
+        if (count != 1 || boost::asio::buffer_size(spans[0]) != size ||
+                boost::asio::buffer_cast<const char*>(spans[0])[size - 1] != (char) i)
+            return i;
+        ring.release();
+    }
+    return frames;
+}
+
+/**
+ * A limit below twice the frame: the frame that wraps must not count the
+ * skipped end of the buffer while the ring is empty
+ */
+static void wrapBelowTwiceTheFrame() {
+    TxRing ring(4096, 128);
+    ring.setLimit(64, 0);
+    int sent = sendFrames(ring, 50, 10000);
+    cout << "limit 64, frames of 50 B: " << sent << " of 10000 sent" << endl;
+    expect(sent == 10000, "a frame that wraps is refused by an empty ring");
+    expect(ring.queuedBytes() == 0 && ring.queuedFrames() == 0, "the ring isn't empty");
+}
+
+/**
+ * The limit still holds while frames are queued
+ */
+static void limitWhileQueued() {
+    TxRing ring(4096, 128);
+    ring.setLimit(64, 0);
+    tx_slot_t first, second;
+    expect(ring.reserve(50, first), "the first frame is refused");
+    expect(!ring.reserve(50, second), "a frame over the limit is accepted");
+    ring.commit(first);
+    boost::asio::const_buffer spans[4];
+    ring.claim(spans, 4);
+    ring.release();
+    expect(ring.reserve(50, second), "a frame is refused after the release");
+}
+
+/**
+ * Near the end of the buffer a frame that wraps waits for the queued ones,
+ * then goes at the beginning of the buffer
+ */
+static void wrapWhileQueued() {
+    TxRing ring(256, 16);
+    ring.setLimit(128, 0);
+    tx_slot_t first, queued, wrapping;
+    expect(ring.reserve(100, first), "the first frame is refused");
+    char* begin = first.data;
+    ring.commit(first);
+    boost::asio::const_buffer spans[4];
+    ring.claim(spans, 4);
+    ring.release();
+    expect(sendFrames(ring, 100, 1) == 1, "the second frame is refused");
+    expect(ring.reserve(20, queued), "a frame before the end is refused");
+    expect(!ring.reserve(100, wrapping), "a frame that wraps over the limit is accepted");
+    ring.commit(queued);
+    ring.claim(spans, 4);
+    ring.release();
+    expect(ring.reserve(100, wrapping), "a frame that wraps is refused by an empty ring");
+    expect(wrapping.data == begin, "the frame that wraps isn't at the beginning of the buffer");
+}
+
+int main() {
+    wrapBelowTwiceTheFrame();
+    limitWhileQueued();
+    wrapWhileQueued();
+    if (!failed)
+        cout << "all passed" << endl;
+    return failed ? 1 : 0;
+}